@@ -50,6 +50,15 @@ struct GimbalOrientation
      */
     cv::Mat rotationMatrix();
 
+    /**
+     * @brief cameraRotation
+     * Calculate the camera to world rotation for the given pose, as used by
+     * cv::detail::CameraParams::R.  Both frames have x pointing right,
+     * y down and z forward, and the world frame is that of a level camera
+     * facing yaw 0.  Yaw turns right, pitch up and roll right side down.
+     */
+    cv::Mat cameraRotation();
+
     /**
      * @brief rotateTo
      * Calculate the rotation between the current pose
@@ -63,6 +63,16 @@ struct SourceImages
                  std::shared_ptr<airmap::logging::Logger> logger,
                  const int _minimumImageCount = 2);
 
+    /**
+     * @brief SourceImages
+     * Wrap images that have already been loaded.
+     * @param panorama Source image paths and metadata.
+     * @param loaded_images The images of the panorama, in the same order.
+     */
+    SourceImages(const Panorama &panorama, std::vector<cv::Mat> loaded_images,
+                 std::shared_ptr<airmap::logging::Logger> logger,
+                 const int _minimumImageCount = 2);
+
     /**
      * @brief clear
      * Clear all storage.
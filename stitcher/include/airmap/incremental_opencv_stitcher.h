@@ -0,0 +1,145 @@
+#pragma once
+
+#include "airmap/opencv_stitcher.h"
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace airmap {
+namespace stitcher {
+
+/**
+ * @brief IncrementalOpenCVStitcher
+ * A LowLevelOpenCVStitcher that can be fed images while they are still being
+ * downloaded, so that most of the work before camera estimation overlaps the
+ * download.  As soon as an image is added, a worker thread decodes and
+ * undistorts it, finds its features and matches them against the images
+ * already present.  Camera parameters are estimated from the collected
+ * matches once the panorama is complete, i.e. when stitch() is called.
+ *
+ * Once all images are present, a stitch template of the same site is
+ * verified against the features found so far, and its cameras and seams are
+ * reused as by LowLevelOpenCVStitcher::stitch.  Retries start over with the
+ * full LowLevelOpenCVStitcher pipeline, as everything has been downloaded by
+ * then.
+ */
+class IncrementalOpenCVStitcher : public LowLevelOpenCVStitcher
+{
+public:
+    /**
+     * @brief IncrementalOpenCVStitcher
+     * Create an instance of the stitcher and start processing the images
+     * of the panorama.
+     * @param config
+     * @param panorama The images available so far, at least one.  The
+     * camera model is detected from the first image.
+     */
+    IncrementalOpenCVStitcher(
+            const Configuration &config, const Panorama &panorama,
+            const Panorama::Parameters &parameters, const std::string &outputPath,
+            std::shared_ptr<airmap::logging::Logger> logger,
+            monitor::Estimator::UpdatedCb updatedCb = []() {}, bool debug = false,
+            path debugPath = path("debug"));
+
+    ~IncrementalOpenCVStitcher() override;
+
+    /**
+     * @brief add
+     * Add a newly downloaded image to the panorama, and queue it for
+     * processing.  Images must be added in capture order.
+     * @param image
+     * @return Whether the image was accepted.  See Panorama::add.
+     */
+    bool add(const GeoImage &image);
+
+    /**
+     * @brief stitch
+     * Wait for all added images to be processed, then estimate camera
+     * parameters and stitch.
+     * @throws std::runtime_error if the stitcher was cancelled.
+     */
+    Report stitch() override;
+
+    /**
+     * @brief cancel
+     * Stop processing images.  The stitcher can't be used afterwards.
+     */
+    void cancel() override;
+
+protected:
+    /**
+     * @brief finish
+     * Stop accepting images and wait for the queued ones to be processed.
+     */
+    void finish();
+
+    /**
+     * @brief pairwiseMatches
+     * Assemble the incremental matches into the all pairs layout of
+     * cv::detail::FeaturesMatcher, filling in the reverse of each pair.
+     * @return
+     */
+    std::vector<cv::detail::MatchesInfo> pairwiseMatches() const;
+
+    /**
+     * @brief process
+     * Worker thread loop, processing queued images until finished.
+     */
+    void process();
+
+    /**
+     * @brief processImage
+     * Decode and undistort an image, find its features at work scale and
+     * match them against the features of the previous images.
+     * @param image
+     */
+    void processImage(const GeoImage &image);
+
+    /**
+     * @brief stitchIncremental
+     * Stitch from the images, features and matches collected so far.
+     * @param result
+     * @param result_mask
+     */
+    Stitcher::Report stitchIncremental(cv::Mat &result, cv::Mat &result_mask);
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    std::deque<GeoImage> _queue;
+    bool _finished;
+    bool _cancelled;
+
+    /**
+     * @brief _error
+     * Error that stopped the worker thread, if any.  The stitch then falls
+     * back to the full pipeline.
+     */
+    std::string _error;
+    size_t _attempts;
+
+    /**
+     * @brief _findFeatures
+     * Whether features are needed at all, i.e. cameras aren't built from
+     * gimbal orientations.
+     */
+    const bool _findFeatures;
+    cv::Ptr<cv::Feature2D> _featuresFinder;
+    cv::Ptr<cv::detail::FeaturesMatcher> _featuresMatcher;
+
+    //! Decoded and undistorted images, in panorama order.
+    std::vector<cv::Mat> _images;
+    //! Features of the images at work scale.
+    std::vector<cv::detail::ImageFeatures> _features;
+    //! Matches between image pairs (i, j), i < j.
+    std::map<std::pair<int, int>, cv::detail::MatchesInfo> _matches;
+
+    std::thread _worker;
+};
+
+} // namespace stitcher
+} // namespace airmap
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/stitching/detail/blenders.hpp>
+
+namespace airmap {
+namespace stitcher {
+namespace opencv {
+namespace detail {
+
+/**
+ * @brief FixedPointMultiBandBlender
+ * Multi-band blender taking the same inputs and producing the same output
+ * as cv::detail::MultiBandBlender, with fixed-point weights.
+ *
+ * cv::detail::MultiBandBlender keeps a CV_32F weight pyramid next to the
+ * CV_16S Laplacian pyramid of the destination.  Here only the weight sums of
+ * the finest band are kept, in Q12 CV_16U, and the sums of the coarser
+ * bands are rebuilt from them when blending: pyramids are linear, so the
+ * sum of the downsampled weights of all images is the downsampled sum of
+ * their weights.  Weights of fed images are Q15 CV_16U.
+ *
+ * Weighting and accumulating all bands of a fed image is one parallel pass
+ * over the rows of all bands, and the collapse of the pyramid is done in
+ * parallel strips of rows.
+ */
+class FixedPointMultiBandBlender : public cv::detail::Blender
+{
+public:
+    /**
+     * @brief FIXED_POINT_MULTI_BAND
+     * Configuration::blender_type selecting this blender.
+     */
+    static constexpr int FIXED_POINT_MULTI_BAND = cv::detail::Blender::MULTI_BAND + 1;
+
+    explicit FixedPointMultiBandBlender(int num_bands = 5);
+
+    int numBands() const;
+    void setNumBands(int val);
+
+    using cv::detail::Blender::prepare;
+    void prepare(cv::Rect dst_roi) override;
+    void feed(cv::InputArray img, cv::InputArray mask, cv::Point tl) override;
+    void blend(cv::InputOutputArray dst, cv::InputOutputArray dst_mask) override;
+
+private:
+    int _actual_num_bands;
+    int _num_bands;
+    cv::Rect _dst_roi_final;
+
+    //! Weighted Laplacian pyramid of the destination, CV_16SC3.
+    std::vector<cv::Mat> _dst_pyr_laplace;
+    //! Weight sums of the finest band, Q12 CV_16U.
+    cv::Mat _dst_weights;
+};
+
+/**
+ * @brief SeamBandBlender
+ * Multi-band blender that only blends around seams.
+ *
+ * The destination is split into small tiles.  Tiles within the reach of the
+ * pyramid of a seam are band tiles, blended by multi-band blending.  Every
+ * other pixel is covered by a single image far enough from any other,
+ * where the multi-band blend is that image, so it is copied as is.
+ *
+ * Band tiles are grouped in blocks of the destination, and the band tiles
+ * of a block are blended by a FixedPointMultiBandBlender of their own,
+ * prepared over them and a halo covering the reach of the pyramid.  If the
+ * images are known ahead of time, a block is blended and its pyramid
+ * released as soon as the last image overlapping it has been fed.  Blend
+ * cost and memory then scale with the length of the seams instead of the
+ * area of the panorama.  The reach grows with the number of bands, so the
+ * fewer the bands, the more is copied.
+ *
+ * Seams have to be set with setSeams() before feeding images.
+ */
+class SeamBandBlender : public cv::detail::Blender
+{
+public:
+    /**
+     * @brief SEAM_BAND
+     * Configuration::blender_type selecting this blender.
+     */
+    static constexpr int SEAM_BAND = FixedPointMultiBandBlender::FIXED_POINT_MULTI_BAND + 1;
+
+    explicit SeamBandBlender(int num_bands = 5);
+
+    int numBands() const;
+    void setNumBands(int val);
+
+    /**
+     * @brief setSeams
+     * Set the regions of the destination the seams go through.
+     * @param seams See findSeamRegions.
+     * @param images Regions of the destination of the images to be fed, if
+     * known.  Each image has to be fed once, within its region.
+     */
+    void setSeams(const std::vector<cv::Rect> &seams,
+                  const std::vector<cv::Rect> &images = std::vector<cv::Rect>());
+
+    /**
+     * @brief bandTileCount
+     * Number of band tiles of the prepared destination, once fed.
+     */
+    size_t bandTileCount() const;
+
+    using cv::detail::Blender::prepare;
+    void prepare(cv::Rect dst_roi) override;
+    void feed(cv::InputArray img, cv::InputArray mask, cv::Point tl) override;
+    void blend(cv::InputOutputArray dst, cv::InputOutputArray dst_mask) override;
+
+private:
+    /**
+     * @brief The Block struct
+     * Band tiles of a block of the destination, blended together.
+     */
+    struct Block
+    {
+        //! Band tiles of the block, in tile units.
+        std::vector<int> tiles;
+        //! Region of the destination the pyramid of the block covers.
+        cv::Rect pyramid_rect;
+        //! Images still to be fed overlapping the pyramid, -1 if unknown.
+        int pending_images = -1;
+        //! Blender of the block, created when first fed.
+        std::unique_ptr<FixedPointMultiBandBlender> blender;
+        //! Whether the band tiles have been blended.
+        bool blended = false;
+    };
+
+    int _actual_num_bands;
+    int _num_bands;
+    cv::Rect _dst_roi_final;
+    std::vector<cv::Rect> _seams;
+    std::vector<cv::Rect> _images;
+
+    int _halo;
+    cv::Size _tiles;
+    int _block_tiles;
+    cv::Size _blocks;
+    //! Whether each tile is within the reach of a seam.
+    std::vector<bool> _band_tiles;
+    //! Blocks with band tiles.
+    std::vector<Block> _band_blocks;
+
+    //! Destination, holding the copied pixels until blending, CV_16SC3.
+    cv::Mat _dst;
+    cv::Mat _dst_mask;
+
+    cv::Rect tileRect(int tile) const;
+    //! Tiles overlapping a non-empty region of the destination, in tile units.
+    cv::Rect tileRange(const cv::Rect &rect) const;
+    //! Find the band tiles and blocks, once seams are set.
+    void findBandBlocks();
+    //! Blend the band tiles of a block into the destination.
+    void blendBlock(Block &block);
+};
+
+/**
+ * @brief findSeamRegions
+ * Find the regions of the destination the seams between images go through,
+ * from the seam masks found at a lower scale: wherever the dilated masks of
+ * two images overlap, as do the masks fed to the blender.
+ * @param seam_masks Seam masks at seam scale.
+ * @param seam_corners Corners of the seam masks.
+ * @param corners Corners of the images at blend scale.
+ * @param sizes Sizes of the images at blend scale.
+ * @return Regions at blend scale.
+ */
+std::vector<cv::Rect> findSeamRegions(const std::vector<cv::UMat> &seam_masks,
+                                      const std::vector<cv::Point> &seam_corners,
+                                      const std::vector<cv::Point> &corners,
+                                      const std::vector<cv::Size> &sizes);
+
+} // namespace detail
+} // namespace opencv
+} // namespace stitcher
+} // namespace airmap
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/stitching/detail/motion_estimators.hpp>
+
+namespace airmap {
+namespace stitcher {
+namespace opencv {
+namespace detail {
+
+/**
+ * @brief SparseBundleAdjusterRay
+ * A drop-in replacement for cv::detail::BundleAdjusterRay, minimizing the
+ * same error (the distance between the rays through matched keypoints,
+ * scaled by the focal lengths) over the same parameters (focal length and
+ * Rodrigues rotation vector per camera).
+ *
+ * OpenCV's implementation builds a dense Jacobian, by perturbing every
+ * camera parameter and re-evaluating the error of every match, and solves
+ * the dense normal equations.  Both grow with the number of cameras times
+ * the number of matches.  Here the residuals of an image pair depend only on
+ * the parameters of its two cameras, so:
+ *  - residuals and 3x8 Jacobian blocks are evaluated per pair, in parallel;
+ *  - the normal equations are kept as 4x4 blocks, one per camera and one per
+ *    image pair;
+ *  - each Levenberg-Marquardt step is solved by conjugate gradients,
+ *    preconditioned with the inverted per-camera blocks.
+ */
+class SparseBundleAdjusterRay : public cv::detail::BundleAdjusterBase {
+public:
+    using ProgressCb = std::function<void(double)>;
+
+    SparseBundleAdjusterRay();
+
+    /**
+     * @brief setProgressCallback
+     * Set a callback that is invoked after every Levenberg-Marquardt
+     * iteration, with the estimated fraction (0-1) of convergence.
+     * @param progressCb
+     */
+    void setProgressCallback(ProgressCb progressCb);
+
+protected:
+    bool estimate(const std::vector<cv::detail::ImageFeatures> &features,
+                  const std::vector<cv::detail::MatchesInfo> &pairwise_matches,
+                  std::vector<cv::detail::CameraParams> &cameras) CV_OVERRIDE;
+
+    void setUpInitialCameraParams(
+            const std::vector<cv::detail::CameraParams> &cameras) CV_OVERRIDE;
+    void obtainRefinedCameraParams(
+            std::vector<cv::detail::CameraParams> &cameras) const CV_OVERRIDE;
+    void calcError(cv::Mat &err) CV_OVERRIDE;
+    void calcJacobian(cv::Mat &jac) CV_OVERRIDE;
+
+private:
+    /**
+     * @brief Pair
+     * The inlier matches of an image pair, as keypoint coordinates relative
+     * to the principal points of the two images.
+     */
+    struct Pair {
+        int from;
+        int to;
+        std::vector<cv::Point2d> points_from;
+        std::vector<cv::Point2d> points_to;
+    };
+
+    /**
+     * @brief Linearization
+     * The contribution of a single pair to the normal equations.
+     */
+    struct Linearization {
+        cv::Matx44d from_from;
+        cv::Matx44d from_to;
+        cv::Matx44d to_to;
+        cv::Vec4d gradient_from;
+        cv::Vec4d gradient_to;
+        double cost;
+    };
+
+    void setUpPairs();
+
+    /**
+     * @brief pairError
+     * Evaluate the residuals of a pair with the given camera parameters.
+     * @param pair
+     * @param params_from Focal and rotation vector of the first camera.
+     * @param params_to Focal and rotation vector of the second camera.
+     * @param err Output, 3 residuals per match.
+     */
+    static void pairError(const Pair &pair, const cv::Vec4d &params_from,
+                          const cv::Vec4d &params_to, double *err);
+
+    /**
+     * @brief pairJacobian
+     * Evaluate the 8 columns of the Jacobian of a pair's residuals, by
+     * central differences.  Columns 0-3 belong to the first camera and
+     * columns 4-7 to the second camera.
+     * @param jac Output, 8 values per residual.
+     */
+    static void pairJacobian(const Pair &pair, const cv::Vec4d &params_from,
+                             const cv::Vec4d &params_to, bool refine_focal,
+                             double *jac);
+
+    Linearization linearize(const Pair &pair, const cv::Mat &params) const;
+    double cost(const cv::Mat &params) const;
+
+    /**
+     * @brief solve
+     * Solve the damped normal equations with block-Jacobi preconditioned
+     * conjugate gradients.
+     */
+    void solve(const std::vector<cv::Matx44d> &diagonal,
+               const std::vector<cv::Matx44d> &off_diagonal,
+               const std::vector<cv::Vec4d> &rhs,
+               std::vector<cv::Vec4d> &step) const;
+
+    std::vector<Pair> _pairs;
+    ProgressCb _progressCb;
+};
+
+} // namespace detail
+} // namespace opencv
+} // namespace stitcher
+} // namespace airmap
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/stitching/detail/exposure_compensate.hpp>
+
+namespace airmap {
+namespace stitcher {
+namespace opencv {
+namespace detail {
+
+/**
+ * @brief ParallelBlocksGainCompensator
+ * A drop-in replacement for cv::detail::BlocksGainCompensator, estimating
+ * the same gain per block of each image, and smoothing them into the same
+ * per-image gain maps.
+ *
+ * OpenCV's implementation hands all blocks of all images to a
+ * GainCompensator, which tests every pair of blocks for overlap, gathers
+ * their overlap statistics sequentially and solves the dense normal
+ * equations.  Here:
+ *  - blocks are only paired within overlapping images, using the block
+ *    grid to find overlapping blocks;
+ *  - overlap statistics are gathered in parallel, per pair of images;
+ *  - the normal equations, where each block only depends on the blocks it
+ *    overlaps, are solved by conjugate gradients, preconditioned with their
+ *    diagonal.
+ *
+ * Repeated feeds scale the overlap intensities by the gains found so far,
+ * instead of compensating the images and gathering the statistics again,
+ * which only differs where compensated pixels saturate.
+ *
+ * Gains are applied by interpolating the gain map a row at a time, either
+ * to whole images with apply(), or to rows of an image as they are produced
+ * with applyRows().
+ */
+class ParallelBlocksGainCompensator : public cv::detail::ExposureCompensator
+{
+public:
+    ParallelBlocksGainCompensator(int bl_width = 32, int bl_height = 32, int nr_feeds = 1);
+
+    using cv::detail::ExposureCompensator::feed;
+    void feed(const std::vector<cv::Point> &corners, const std::vector<cv::UMat> &images,
+              const std::vector<std::pair<cv::UMat, uchar>> &masks) override;
+    void apply(int index, cv::Point corner, cv::InputOutputArray image,
+               cv::InputArray mask) override;
+
+    /**
+     * @brief applyRows
+     * Compensate some rows of an image, as apply() would.  Can be called
+     * concurrently.
+     * @param index Index of the image.
+     * @param image_size Size of the whole image.
+     * @param first_row Index of the first of the rows in the image.
+     * @param rows Rows to compensate in place, CV_8UC3, as wide as the image.
+     */
+    void applyRows(int index, cv::Size image_size, int first_row, cv::Mat &rows) const;
+
+    void getMatGains(std::vector<cv::Mat> &umv) override;
+    void setMatGains(std::vector<cv::Mat> &umv) override;
+
+    void setNrFeeds(int nr_feeds);
+    int getNrFeeds() const;
+    void setBlockSize(int width, int height);
+    void setNrGainsFilteringIterations(int nr_iterations);
+    int getNrGainsFilteringIterations() const;
+
+private:
+    int _bl_width;
+    int _bl_height;
+    int _nr_feeds;
+    int _nr_gain_filtering_iterations;
+
+    //! Smoothed gains of the blocks of each image, CV_32F.
+    std::vector<cv::Mat> _gain_maps;
+};
+
+} // namespace detail
+} // namespace opencv
+} // namespace stitcher
+} // namespace airmap
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+namespace airmap {
+namespace stitcher {
+namespace opencv {
+namespace detail {
+
+/**
+ * @brief GridGraph
+ * Max-flow over a 4-connected grid of vertices, one per pixel, numbered row
+ * by row.
+ *
+ * This is the Boykov-Kolmogorov algorithm of cv::detail::GCGraph, step for
+ * step: the search trees grow, augment and are restored in the same order
+ * as for a GCGraph whose edges were added row by row, right then down, so
+ * the same cut is found.  Neighbours are implicit, edge capacities are
+ * kept per direction in flat arrays, and all buffers are kept across
+ * create() calls, so a graph can be reused for many cuts.
+ */
+class GridGraph
+{
+public:
+    /**
+     * @brief create
+     * Reset the graph to a grid without edges or terminal weights.
+     * @param size Size of the grid.
+     */
+    void create(cv::Size size);
+
+    /**
+     * @brief addTermWeights
+     * As GCGraph::addTermWeights.
+     */
+    void addTermWeights(int v, float source_weight, float sink_weight);
+
+    /**
+     * @brief setEdgeWeights
+     * Set the capacities of the edges between neighbours, in both
+     * directions.  Edges with a zero capacity are as if missing.
+     * @param horizontal CV_32F capacities of the edges to the right of each
+     * vertex.  The last column is unused.
+     * @param vertical CV_32F capacities of the edges below each vertex.  The
+     * last row is unused.
+     */
+    void setEdgeWeights(const cv::Mat &horizontal, const cv::Mat &vertical);
+
+    float maxFlow();
+
+    bool inSourceSegment(int v) const;
+
+private:
+    enum Direction { Down, Right, Left, Up, Directions };
+
+    int neighbour(int v, int direction) const;
+    bool hasNeighbour(int v, int direction) const;
+
+    cv::Size _size;
+    float _flow;
+
+    //! Residual capacities of the edges from each vertex, per direction.
+    std::vector<float> _capacities[Directions];
+    //! Terminal weights, positive towards the source.
+    std::vector<float> _weights;
+    //! Edge to the parent in the search tree, as direction + 1, or 0 if free.
+    std::vector<signed char> _parents;
+    //! Search tree of each vertex, 0 for the source.
+    std::vector<unsigned char> _trees;
+    std::vector<int> _timestamps;
+    std::vector<int> _distances;
+    //! Next vertex in the active queue, or -1 if not queued.
+    std::vector<int> _next;
+    std::vector<int> _orphans;
+};
+
+} // namespace detail
+} // namespace opencv
+} // namespace stitcher
+} // namespace airmap
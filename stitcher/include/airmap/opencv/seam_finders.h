@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <vector>
 
 #include "airmap/monitor/monitor.h"
@@ -12,6 +13,91 @@ namespace stitcher {
 namespace opencv {
 namespace detail {
 
+/**
+ * @brief SeamPair
+ * A pair of overlapping images, and their overlap in the destination.
+ */
+struct SeamPair
+{
+    size_t first;
+    size_t second;
+    cv::Rect roi;
+};
+
+/**
+ * @brief scheduleSeamPairs
+ * Schedule the overlapping pairs of images into batches of pairs that can be
+ * searched concurrently, giving the same seams as searching all pairs in
+ * sequence as cv::detail::PairwiseSeamFinder does.
+ *
+ * A pair only changes the masks of its own images, so it only depends on
+ * the pairs sharing one of its images that come before it in sequence.
+ * Each pair goes in the batch following the latest of these, which colours
+ * the graph of pairs sharing an image: no two pairs of a batch share an
+ * image, and every pair comes after the pairs it depends on.
+ * @param corners Corners of the images.
+ * @param sizes Sizes of the images.
+ * @return Batches of pairs, in order.
+ */
+std::vector<std::vector<SeamPair>> scheduleSeamPairs(const std::vector<cv::Point> &corners,
+                                                     const std::vector<cv::Size> &sizes);
+
+/**
+ * @brief gradientMagnitudes
+ * Squared magnitudes of the horizontal and vertical gradients of 3 channel
+ * images, as normL2 of their 3x3 Sobel gradients, with the default border of
+ * Sobel.  Strips of rows of all images are computed in parallel, straight
+ * from the images.
+ * @param src CV_8UC3 or CV_32FC3 images.
+ * @param dx CV_32F horizontal gradients of each image.
+ * @param dy CV_32F vertical gradients of each image.
+ */
+void gradientMagnitudes(const std::vector<cv::UMat> &src, std::vector<cv::Mat> &dx,
+                        std::vector<cv::Mat> &dy);
+
+/**
+ * @brief ParallelPairwiseSeamFinder
+ * cv::detail::PairwiseSeamFinder searching the pairs of each batch of
+ * scheduleSeamPairs() in parallel.  findInPair() must only change the masks
+ * of the pair it is given.
+ */
+class ParallelPairwiseSeamFinder : public cv::detail::PairwiseSeamFinder {
+public:
+    using ProgressCb = std::function<void(double)>;
+
+    void find(const std::vector<cv::UMat> &src,
+              const std::vector<cv::Point> &corners,
+              std::vector<cv::UMat> &masks) override;
+
+    /**
+     * @brief setProgressCallback
+     * Set a callback called with the fraction of pairs searched, after each
+     * batch.
+     * @param progressCb
+     */
+    void setProgressCallback(ProgressCb progressCb);
+
+private:
+    ProgressCb _progressCb;
+};
+
+/**
+ * @brief ParallelVoronoiSeamFinder
+ * cv::detail::VoronoiSeamFinder searching pairs in parallel.
+ */
+class ParallelVoronoiSeamFinder : public ParallelPairwiseSeamFinder {
+protected:
+    void findInPair(size_t first, size_t second, cv::Rect roi) override;
+};
+
+/**
+ * @brief MonitoredGraphCutSeamFinder
+ * cv::detail::GraphCutSeamFinder that reports its progress to a monitor.
+ * Accepts CV_8UC3 as well as CV_32FC3 images, converting only the windows
+ * around the overlaps of image pairs to float, so that the warped images
+ * don't need to be kept in float.  Pairs are searched in parallel, as by
+ * ParallelPairwiseSeamFinder.
+ */
 class MonitoredGraphCutSeamFinder : public cv::detail::GraphCutSeamFinder {
 public:
     MonitoredGraphCutSeamFinder(
@@ -21,13 +107,38 @@ public:
 
     ~MonitoredGraphCutSeamFinder();
 
+    /**
+     * @brief setLevels
+     * Find seams coarse to fine: cut the whole overlaps with the images
+     * halved levels times, then at each finer level re-cut only a band
+     * around the seams upscaled from the coarser level.  Seam masks are
+     * upscaled dilated by band_radius, so that both images of a seam keep
+     * the band, and only the band can change.  Seams are then as accurate
+     * as at full scale, for about the cost of a cut at the coarsest level.
+     * @param levels Number of halvings, 0 to cut the whole overlaps.
+     * @param band_radius Pixels the band reaches on either side of the
+     * upscaled seams.  It should cover the error of upscaling a seam, 2
+     * pixels.
+     */
+    void setLevels(int levels, int band_radius = 4);
+
+    /**
+     * @brief setMinOverlapPixels
+     * Split pairs of images kept by both images over fewer pixels as by the
+     * Voronoi seam finder, instead of cutting a graph.  Graphs are only cut
+     * over the bounding box of the pixels kept by both images.
+     * @param min_overlap_pixels Minimum number of pixels, at the scale of the
+     * images seams are found for.
+     */
+    void setMinOverlapPixels(int min_overlap_pixels);
+
     void find(const std::vector<cv::UMat> &src,
               const std::vector<cv::Point> &corners,
               std::vector<cv::UMat> &masks) override;
 
 private:
     class Impl; // avoid GCGraph dependency in header
-    cv::Ptr<cv::detail::PairwiseSeamFinder> _impl;
+    cv::Ptr<ParallelPairwiseSeamFinder> _impl;
 };
 
 } // namespace detail
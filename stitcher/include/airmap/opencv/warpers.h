@@ -0,0 +1,66 @@
+#pragma once
+
+#include <functional>
+
+#include <opencv2/core.hpp>
+#include <opencv2/stitching/detail/warpers.hpp>
+
+namespace airmap {
+namespace stitcher {
+namespace opencv {
+namespace detail {
+
+/**
+ * @brief WarpedRowsCallback
+ * Called with consecutive rows of a warped image as soon as they are warped,
+ * and the index of the first of them.  May be called concurrently for
+ * different rows.
+ */
+using WarpedRowsCallback = std::function<void(cv::Mat &rows, int first_row)>;
+
+/**
+ * @brief warpImageAndMask
+ * Warp an image, and the mask of its valid pixels in the warped image, from
+ * a single pair of projection maps.
+ *
+ * cv::detail::RotationWarper::warp builds the maps on every call, so warping
+ * an image and then an all-255 mask of the same size builds the same maps
+ * twice.  Here the maps are built once.  The mask is derived from them: a
+ * warped pixel is valid if its map points inside the source image, which
+ * is what warping the all-255 mask with INTER_NEAREST and BORDER_CONSTANT
+ * yields.
+ *
+ * Spherical and cylindrical warpers don't build full-size maps at all: the
+ * maps are computed a tile of rows at a time, by kernels specialised on the
+ * projection, and each tile is remapped as soon as its maps are ready.
+ * Warped ROIs are still those of the OpenCV warper.
+ *
+ * Only the rows in dst_rows are warped, so that composing a strip of the
+ * panorama doesn't warp the rows of the image outside of it.  The result is
+ * the same as cropping the whole warped image to them.
+ * @param warper
+ * @param src Source image.
+ * @param K Camera intrinsics.
+ * @param R Camera rotation.
+ * @param interp_mode Interpolation mode for the image.
+ * @param border_mode Border extrapolation mode for the image.
+ * @param dst Warped image.
+ * @param mask_warped Warped mask, CV_8U.
+ * @param on_rows If set, called on the warped rows, while they are still
+ * in cache with the tiled warps, or on the whole image otherwise.  Rows are
+ * numbered from the top of the whole warped image.
+ * @param dst_rows Rows to warp, in the coordinates of the warper.  All rows
+ * by default.
+ * @return Top left corner of the warped image.
+ */
+cv::Point warpImageAndMask(cv::detail::RotationWarper &warper, cv::InputArray src,
+                           cv::InputArray K, cv::InputArray R, int interp_mode,
+                           int border_mode, cv::OutputArray dst,
+                           cv::OutputArray mask_warped,
+                           const WarpedRowsCallback &on_rows = WarpedRowsCallback(),
+                           const cv::Range &dst_rows = cv::Range::all());
+
+} // namespace detail
+} // namespace opencv
+} // namespace stitcher
+} // namespace airmap
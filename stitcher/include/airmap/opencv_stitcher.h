@@ -7,9 +7,14 @@
 #include "airmap/images.h"
 #include "airmap/logging.h"
 #include "airmap/monitor/estimator.h"
+#include "airmap/opencv/blenders.h"
+#include "airmap/opencv/bundle_adjusters.h"
+#include "airmap/opencv/exposure_compensators.h"
 #include "airmap/opencv/forward.h"
 #include "airmap/opencv/matchers.h"
 #include "airmap/opencv/seam_finders.h"
+#include "airmap/opencv/warpers.h"
+#include "airmap/stitch_templates.h"
 #include "airmap/stitcher.h"
 #include "airmap/stitcher_configuration.h"
 
@@ -57,7 +62,8 @@ public:
 
     Report stitch() override;
     void cancel() override;
-    void postprocess(cv::Mat&& result);
+    void postprocess(cv::Mat&& result, cv::Mat&& result_mask = cv::Mat(),
+                     bool full_sphere = false);
     void setFallbackMode() override;
     void setUseOpenCL(bool enabled = true);
 
@@ -92,14 +98,10 @@ public:
         std::vector<cv::Point> corners;
         //! Warped masks used for finding seams and blending.
         std::vector<cv::UMat> masks_warped;
-        //! Warped images used for blending.
+        //! Warped images used for exposure compensation and finding seams.
         std::vector<cv::UMat> images_warped;
-        //! Float versions of warped images for finding seams.
-        std::vector<cv::UMat> images_warped_f;
         //! Sizes of the warped images.
         std::vector<cv::Size> sizes;
-        //! Masks used for warping images.
-        std::vector<cv::UMat> masks;
 
         /**
          * @brief WarpResults
@@ -110,9 +112,7 @@ public:
             : corners(image_count)
             , masks_warped(image_count)
             , images_warped(image_count)
-            , images_warped_f(image_count)
             , sizes(image_count)
-            , masks(image_count)
         {
         }
     };
@@ -139,12 +139,20 @@ protected:
      */
     const Configuration _config;
 
+    /**
+     * @brief _stitchTemplates
+     * Store of stitch templates, if enabled by
+     * Panorama::Parameters::stitchTemplatesPath.
+     */
+    const StitchTemplates::SharedPtr _stitchTemplates;
+
     /**
      * @brief stitch
      * Stitch the input images into a panorama.
      * @param result
+     * @param result_mask Mask of the pixels of the panorama covered by images.
      */
-    Stitcher::Report stitch(cv::Mat &result);
+    Stitcher::Report stitch(cv::Mat &result, cv::Mat &result_mask);
 
     /**
      * @brief adjustCameraParameters
@@ -152,10 +160,31 @@ protected:
      * @param features
      * @param matches
      * @param cameras
+     * @param max_iterations Maximum bundle adjuster iterations, or 0 for the
+     * bundle adjuster's default.
      */
     void adjustCameraParameters(std::vector<cv::detail::ImageFeatures> &features,
                                 std::vector<cv::detail::MatchesInfo> &matches,
-                                std::vector<cv::detail::CameraParams> &cameras);
+                                std::vector<cv::detail::CameraParams> &cameras,
+                                int max_iterations = 0);
+
+    /**
+     * @brief adjustTemplateCameraParameters
+     * Verify that the capture matches a stitch template, by matching features
+     * only between images that overlap in the template, and refining the
+     * template cameras with a short bundle adjustment.
+     * @param stitch_template
+     * @param source_images
+     * @param features
+     * @param cameras The refined cameras, in the frame of the template.
+     * @param unchanged Set if the refined cameras are close enough to the
+     * template for its cameras, seams and gains to be reused as they are.
+     * @return Whether the capture matches the template.
+     */
+    bool adjustTemplateCameraParameters(
+            const StitchTemplate &stitch_template, SourceImages &source_images,
+            std::vector<cv::detail::ImageFeatures> &features,
+            std::vector<cv::detail::CameraParams> &cameras, bool &unchanged);
 
     /**
      * @brief compose
@@ -167,12 +196,73 @@ protected:
      * @param work_scale
      * @param warped_image_scale
      * @param result
+     * @param result_mask
      */
     void compose(SourceImages &source_images,
                  std::vector<cv::detail::CameraParams> &cameras,
                  cv::Ptr<cv::detail::ExposureCompensator> &exposure_compensator,
                  WarpResults &warp_results, double work_scale,
-                 double compose_scale, float warped_image_scale, cv::Mat &result);
+                 double compose_scale, float warped_image_scale, cv::Mat &result,
+                 cv::Mat &result_mask);
+
+    /**
+     * @brief composeRoi
+     * Region of the panorama the images are composed onto, in the coordinates
+     * of the warper: the compose canvas if there is one, the bounding
+     * rectangle of the warped images otherwise.
+     * @param warp_results Corners and sizes at compose scale.
+     * @return
+     */
+    cv::Rect composeRoi(const WarpResults &warp_results);
+
+    /**
+     * @brief composeTiles
+     * Compose the panorama in strips of compose_tile_size rows.  Each strip is
+     * blended with a halo covering the reach of the blender, and only the
+     * images overlapping it, so that the blender never holds more than a
+     * strip.
+     * @param source_images
+     * @param cameras
+     * @param exposure_compensator
+     * @param warp_results Corners and sizes at compose scale.
+     * @param compose_work_scale
+     * @param seams Seam regions for a seam band blender.
+     * @param result
+     * @param result_mask
+     */
+    void composeTiles(SourceImages &source_images,
+                      std::vector<cv::detail::CameraParams> &cameras,
+                      cv::Ptr<cv::detail::ExposureCompensator> &exposure_compensator,
+                      WarpResults &warp_results, float compose_work_scale,
+                      const std::vector<cv::Rect> &seams, cv::Mat &result,
+                      cv::Mat &result_mask);
+
+    /**
+     * @brief createBlender
+     * Create blender according to configuration, with its settings derived
+     * from the size of the destination.
+     * @param destination_size Size of the whole panorama.
+     * @param log_settings
+     * @return
+     */
+    cv::Ptr<cv::detail::Blender> createBlender(const cv::Size &destination_size,
+                                               bool log_settings = true);
+
+    /**
+     * @brief createStitchTemplate
+     * Create a stitch template of the current capture, from the seam scale
+     * warp results after seams have been found.
+     * @param cameras
+     * @param warp_results
+     * @param exposure_compensator
+     * @param work_width Width of the images at work scale.
+     * @return
+     */
+    StitchTemplate createStitchTemplate(
+            const std::vector<cv::detail::CameraParams> &cameras,
+            WarpResults &warp_results,
+            cv::Ptr<cv::detail::ExposureCompensator> &exposure_compensator,
+            int work_width);
 
     /**
      * @brief debugFeatures
@@ -228,6 +318,56 @@ protected:
     estimateCameraParameters(std::vector<cv::detail::ImageFeatures> &features,
                              std::vector<cv::detail::MatchesInfo> &matches);
 
+    /**
+     * @brief estimateCameraParametersFromPose
+     * Build camera parameters from the gimbal orientations of the images and
+     * the intrinsics of the detected camera model, without any features.
+     * Requires a detected camera model.
+     * @param source_images Source images, scaled to work scale.
+     * @return
+     */
+    std::vector<cv::detail::CameraParams>
+    estimateCameraParametersFromPose(SourceImages &source_images);
+
+    /**
+     * @brief estimateCameraParametersFromMatches
+     * Drop images that aren't part of the biggest matched component, then
+     * estimate, refine and wave correct the camera parameters.
+     * @param source_images Source images, scaled to work scale.
+     * @param features
+     * @param matches Pairwise matches between all images.
+     * @return
+     */
+    std::vector<cv::detail::CameraParams>
+    estimateCameraParametersFromMatches(SourceImages &source_images,
+                                        std::vector<cv::detail::ImageFeatures> &features,
+                                        std::vector<cv::detail::MatchesInfo> &matches);
+
+    /**
+     * @brief feedBlender
+     * Warp, compensate and mask the given images on a pool of workers, and
+     * feed them to the blender in order, clipped to the given region.  Only
+     * the rows of the images in the region are warped.
+     * @param source_images
+     * @param cameras
+     * @param exposure_compensator
+     * @param warp_results
+     * @param compose_work_scale
+     * @param indices Images to feed.
+     * @param roi Region of the panorama being blended.
+     * @param last_use Whether each image can be released once fed.
+     * @param blender A prepared blender.
+     * @param progress_start
+     * @param progress_end
+     */
+    void feedBlender(SourceImages &source_images,
+                     std::vector<cv::detail::CameraParams> &cameras,
+                     cv::Ptr<cv::detail::ExposureCompensator> &exposure_compensator,
+                     WarpResults &warp_results, float compose_work_scale,
+                     const std::vector<size_t> &indices, const cv::Rect &roi,
+                     const std::vector<bool> &last_use, cv::detail::Blender &blender,
+                     double progress_start, double progress_end);
+
     /**
      * @brief findFeatures
      * Find features in the source images.  Scale images to work_scale first.
@@ -259,6 +399,15 @@ protected:
      */
     cv::Ptr<cv::detail::BundleAdjusterBase> getBundleAdjuster();
 
+    /**
+     * @brief getComposeCanvas
+     * Full sphere, 2:1 equirectangular canvas of _config.output_width pixels,
+     * in the coordinates of the spherical warper, or an empty rectangle if
+     * the panorama isn't composed onto a fixed canvas.
+     * @return
+     */
+    cv::Rect getComposeCanvas();
+
     /**
      * @brief getComposeScale
      * Determine compose scale from source image sizes and _config.compose_megapix.
@@ -267,6 +416,17 @@ protected:
      */
     double getComposeScale(SourceImages &source_images);
 
+    /**
+     * @brief getComposeWorkScale
+     * Scale of the warper at compose scale: the warped image scale of the
+     * registration resized to compose scale, or the scale that maps the
+     * sphere onto the compose canvas if there is one.
+     * @param warped_image_scale Warped image scale at work scale.
+     * @param compose_work_aspect Ratio of the compose scale to the work scale.
+     * @return
+     */
+    float getComposeWorkScale(float warped_image_scale, float compose_work_aspect);
+
     /**
      * @brief getEstimator
      * Create and return a camera rotation estimator according to configuration..
@@ -336,10 +496,12 @@ protected:
      * @brief matchFeatures
      * Matches features seen in multiple images and populates pairwise matches.
      * @param features
+     * @param mask Optional mask of the image pairs to match.
      * @return
      */
     std::vector<cv::detail::MatchesInfo>
-    matchFeatures(std::vector<cv::detail::ImageFeatures> &features);
+    matchFeatures(std::vector<cv::detail::ImageFeatures> &features,
+                  const cv::UMat &mask = cv::UMat());
 
     /**
      * @brief prepareBlender
@@ -360,12 +522,16 @@ protected:
     prepareExposureCompensation(WarpResults &warp_results);
 
     /**
-     * @brief rotateImage
-     * Rotate an image by the given angle in 2D.
-     * @param image The cv::Mat panorama image to rotate.
+     * @brief rotateCameras
+     * Rotate the camera rotations about the panorama's optical axis, so that
+     * images warped with them come out rotated in 2D by the given angle.
+     * A 180 degree rotation flips the x and y axes of the world frame, which
+     * for the spherical projection mirrors both u and v, i.e. rotates the
+     * projected panorama by 180 degrees without resampling it.
+     * @param cameras
      * @param angle Angle in degrees.
      */
-    void rotateImage(cv::Mat &image, double angle);
+    void rotateCameras(std::vector<cv::detail::CameraParams> &cameras, double angle);
 
     /**
      * @brief shouldRotateThreeSixty
@@ -378,6 +544,34 @@ protected:
     shouldRotateThreeSixty(const std::vector<cv::Mat> &original_images,
                            cv::InputArray &warped_images);
 
+    /**
+     * @brief stitchFromCameras
+     * Warp, find seams, compensate exposure and compose the panorama, once
+     * camera parameters are known.
+     * @param source_images Source images, scaled to work scale.
+     * @param cameras Camera parameters at work scale.
+     * @param seam_scale
+     * @param work_scale
+     * @param compose_scale
+     * @param oriented Whether the cameras are already in their final
+     * orientation, i.e. the panorama doesn't need to be checked for rotation.
+     * @param matched_template Template the cameras were verified against,
+     * or nullptr.  A template saved by this stitch replaces it.
+     * @param template_cameras_unchanged Whether the cameras are those of
+     * matched_template, whose seams and gains are then reused if the images
+     * warp as they did for it.
+     * @param save_template Whether to save a template of the stitch, if stitch
+     * templates are enabled.
+     * @param result
+     * @param result_mask
+     */
+    void stitchFromCameras(SourceImages &source_images,
+                           std::vector<cv::detail::CameraParams> &cameras,
+                           double seam_scale, double work_scale, double compose_scale,
+                           bool oriented, const StitchTemplate *matched_template,
+                           bool template_cameras_unchanged, bool save_template,
+                           cv::Mat &result, cv::Mat &result_mask);
+
     /**
      * @brief undistortImages
      * Optionally undistort the images, depending on whether the
@@ -207,7 +207,10 @@ public:
                 size_t _retries = 6,
                 double _maximumCropRatio = 99. / 100,
                 size_t _maxInputImageSize =
-                        12740198 // empirical (Anafi image cols x rows scaled to 0.8)
+                        12740198, // empirical (Anafi image cols x rows scaled to 0.8)
+                const std::string &_stitchTemplatesPath = "",
+                const std::string &_tilePyramidPath = "",
+                int _tilePyramidTileSize = 512
                 )
             : memoryBudgetMB { _memoryBudgetMB }
             , alsoCreateCubeMap(_alsoCreateCubeMap)
@@ -219,6 +222,9 @@ public:
             , retries(_retries)
             , maxInputImageSize { _maxInputImageSize }
             , maximumCropRatio { _maximumCropRatio }
+            , stitchTemplatesPath { _stitchTemplatesPath }
+            , tilePyramidPath { _tilePyramidPath }
+            , tilePyramidTileSize { _tilePyramidTileSize }
 
         {
         }
@@ -284,6 +290,27 @@ public:
          * imag is returned as if no cropping was performed.
          */
         double maximumCropRatio;
+
+        /**
+         * @brief stitchTemplatesPath
+         * Directory of stitch templates.  If set, a capture matching a
+         * previous stitch of the same site starts from its cameras, seams and
+         * gains, and successful stitches are saved as templates.
+         */
+        std::string stitchTemplatesPath;
+
+        /**
+         * @brief tilePyramidPath
+         * Directory to also write a multiresolution pyramid of cube face tiles
+         * to, for web viewers.  Not written if empty.
+         */
+        std::string tilePyramidPath;
+
+        /**
+         * @brief tilePyramidTileSize
+         * Width and height of the tiles of the tile pyramid, in pixels.
+         */
+        int tilePyramidTileSize;
     };
 
     inline Panorama()
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "airmap/logging.h"
+#include "airmap/panorama.h"
+#include "airmap/stitcher_configuration.h"
+
+#include <opencv2/core.hpp>
+#include <opencv2/stitching/detail/camera.hpp>
+
+namespace airmap {
+namespace stitcher {
+
+/**
+ * @brief StitchTemplate
+ * The products of a successful stitch, which can be used as a starting point
+ * for a later stitch of the same site, captured with the same camera and the
+ * same waypoint mission.
+ */
+struct StitchTemplate
+{
+    /**
+     * @brief MaxCapturePatternDeviationDeg
+     * Maximum difference in relative gimbal yaw or pitch, for an image of a
+     * capture to be considered the same as the corresponding template image.
+     */
+    static constexpr double MaxCapturePatternDeviationDeg = 5.;
+
+    /**
+     * @brief centre
+     * Location of the panorama.  See Panorama::centre().
+     */
+    geocoordinate_t centre { 0., 0. };
+
+    /**
+     * @brief camera
+     * Camera make and model of the images.
+     */
+    std::string camera;
+
+    /**
+     * @brief capture_pattern
+     * Gimbal yaw (relative to the first image) and pitch of each image,
+     * in degrees.
+     */
+    std::vector<cv::Point2d> capture_pattern;
+
+    /**
+     * @brief work_width
+     * Width of the images at work scale.  Camera intrinsics are relative to
+     * it.
+     */
+    int work_width = 0;
+
+    /**
+     * @brief cameras
+     * Refined, wave corrected (and, if needed, rotated) camera parameters.
+     */
+    std::vector<cv::detail::CameraParams> cameras;
+
+    /**
+     * @brief corners
+     * Top left corners of the images warped at seam scale.
+     */
+    std::vector<cv::Point> corners;
+
+    /**
+     * @brief seam_masks
+     * Seam masks of the images warped at seam scale.
+     */
+    std::vector<cv::Mat> seam_masks;
+
+    /**
+     * @brief gains
+     * Exposure compensator gains.  See cv::detail::ExposureCompensator::getMatGains.
+     */
+    std::vector<cv::Mat> gains;
+
+    /**
+     * @brief exposure_compensator_type
+     * Type of the exposure compensator the gains are from.  Gains are only
+     * valid for a compensator of the same type and block size.
+     */
+    ExposureCompensatorType exposure_compensator_type = ExposureCompensatorType::No;
+
+    /**
+     * @brief exposure_compensation_block_size
+     * Block size of the exposure compensator the gains are from.
+     */
+    int exposure_compensation_block_size = 0;
+
+    /**
+     * @brief directory
+     * Directory of the store the template was loaded from, and is saved back
+     * to, or empty for a template of a new capture.  Not saved.
+     */
+    std::string directory;
+
+    /**
+     * @brief fromPanorama
+     * Create an empty template, keyed by the given panorama.
+     * @param panorama
+     */
+    static StitchTemplate fromPanorama(const Panorama &panorama);
+
+    /**
+     * @brief matches
+     * Whether the given panorama was captured at the template's site, with
+     * the same camera and capture pattern.
+     * @param panorama
+     */
+    bool matches(const Panorama &panorama) const;
+
+    /**
+     * @brief scaleCameras
+     * Return the template cameras, with intrinsics scaled to the given work
+     * width.
+     * @param width
+     */
+    std::vector<cv::detail::CameraParams> scaleCameras(int width) const;
+};
+
+/**
+ * @brief StitchTemplates
+ * A store of stitch templates on disk.  Each template lives in its own
+ * directory, holding a YAML file with the key, cameras and gains, and
+ * the seam masks as PNG images.  Only the YAML file is read while looking
+ * for a template, the seam masks are loaded for the matching template only.
+ */
+class StitchTemplates
+{
+public:
+    using SharedPtr = std::shared_ptr<StitchTemplates>;
+
+    StitchTemplates(const std::string &directory,
+                    std::shared_ptr<airmap::logging::Logger> logger);
+
+    /**
+     * @brief find
+     * Find a template matching the given panorama.
+     * @param panorama
+     * @param stitch_template Populated with the matching template.
+     * @return Whether a matching template was found.
+     */
+    bool find(const Panorama &panorama, StitchTemplate &stitch_template) const;
+
+    /**
+     * @brief save
+     * Save the template to the directory it was loaded from, or else replace
+     * the nearest template of the same camera and image count within
+     * Panorama::MaxSpatialDistanceMts, so that the store holds a single
+     * template per site.
+     * @param stitch_template
+     */
+    void save(const StitchTemplate &stitch_template) const;
+
+private:
+    std::string siteDirectory(const StitchTemplate &stitch_template) const;
+
+    bool load(const std::string &directory, StitchTemplate &stitch_template,
+              bool load_seam_masks) const;
+
+    std::string _directory;
+    std::shared_ptr<airmap::logging::Logger> _logger;
+};
+
+} // namespace stitcher
+} // namespace airmap
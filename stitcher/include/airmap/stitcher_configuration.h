@@ -5,6 +5,7 @@ namespace stitcher {
 
 enum class BundleAdjusterType{
     Ray,
+    SparseRay,
     Reproj,
     AffinePartial,
     No
@@ -90,7 +91,12 @@ struct Configuration
         */
     float blend_strength;
 
-    //! The type of blender to use (e.g. multi-band or feather).
+    /*!
+        * The type of blender to use (e.g. multi-band or feather): one of
+        * cv::detail::Blender's types,
+        * FixedPointMultiBandBlender::FIXED_POINT_MULTI_BAND or
+        * SeamBandBlender::SEAM_BAND.
+        */
     int blender_type;
 
     /*!
@@ -102,6 +108,14 @@ struct Configuration
     //! Megapixels an image will be scaled down to for the composition step.
     double compose_megapix;
 
+    /*!
+        * Rows of the panorama composed at a time.  The images overlapping each
+        * strip are warped and blended into it on their own, so that memory
+        * used while blending depends on the strip size instead of the size of
+        * the panorama.  A value of 0 composes the whole panorama at once.
+        */
+    int compose_tile_size;
+
     /*!
         * The type of estimator (e.g. affine or homography) to use to estimate initial
         * camera parameters.
@@ -120,7 +134,12 @@ struct Configuration
     //! TODO(bkd): I haven't yet read details of what this does. */
     int exposure_compensation_nr_filtering;
 
-    //! TODO(bkd): I haven't yet read details of what this does. */
+    /**
+     * @brief exposure_compensation_block_size
+     * Size of the blocks of block exposure compensators, in pixels of the
+     * images at seam scale.  Raise it with seam_megapix to keep the blocks
+     * over the same part of the images.
+     */
     int exposure_compensation_block_size;
 
     //! The type of features finder (e.g. ORB, SIFT, etc.) to use.
@@ -149,6 +168,24 @@ struct Configuration
         */
     double match_conf_thresh;
 
+    /*!
+        * Width of a full sphere, 2:1 equirectangular canvas the panorama is
+        * composed onto, with the warper scale that maps the sphere onto it.
+        * The panorama then needs no cropping or padding.  Only used with the
+        * spherical warper.  A value of 0 composes onto the bounding
+        * rectangle of the warped images, at the scale of the images.
+        */
+    int output_width;
+
+    /*!
+        * Build camera parameters directly from the gimbal orientations of the
+        * images and the intrinsics of the detected camera model, instead of
+        * finding and matching features.  This is much faster, but the quality
+        * of the stitch depends on the accuracy of the gimbal data.  Ignored if
+        * the camera model isn't detected.
+        */
+    bool pose_only;
+
     /*!
         * If a homography features matcher is used, a value of -1 will
         * use a BestOf2NearestMatcher.  Otherwise, a BestOf2NearestRangeMatcher
@@ -190,6 +227,24 @@ struct Configuration
      */
     float seam_finder_graph_cut_bad_region_penalty;
 
+    /**
+     * @brief seam_finder_graph_cut_levels
+     * Number of times the images are halved to cut the seams coarse to fine.
+     * Seams are cut over the whole overlaps at the coarsest level, and only
+     * refined around them at finer levels, so seam_megapix can be raised by
+     * 4^levels for about the same cost.  0 cuts the whole overlaps at
+     * seam_megapix.
+     */
+    int seam_finder_graph_cut_levels;
+
+    /**
+     * @brief seam_finder_min_overlap_pixels
+     * Pairs of images overlapping over fewer pixels at seam scale are split
+     * by distance to their pixels outside the overlap, as by the Voronoi
+     * seam finder, instead of by a graph cut.
+     */
+    int seam_finder_min_overlap_pixels;
+
     /**
      * @brief stitch_type
      * The type of stitch (e.g. ThreeSixty).
@@ -269,6 +324,12 @@ struct Configuration
      * @param wave_correct
      * @param wave_correct_type
      * @param work_megapix
+     * @param stitch_type
+     * @param pose_only
+     * @param compose_tile_size
+     * @param seam_finder_graph_cut_levels
+     * @param seam_finder_min_overlap_pixels
+     * @param output_width
      */
     Configuration(float blend_strength, int blender_type,
                   BundleAdjusterType bundle_adjuster_type,
@@ -286,7 +347,10 @@ struct Configuration
                   float seam_finder_graph_cut_bad_region_penalty, bool try_cuda,
                   WarperType warper_type, bool wave_correct,
                   WaveCorrectType wave_correct_type, double work_megapix,
-                  StitchType stitch_type = StitchType::No);
+                  StitchType stitch_type = StitchType::No,
+                  bool pose_only = false, int compose_tile_size = 0,
+                  int seam_finder_graph_cut_levels = 0,
+                  int seam_finder_min_overlap_pixels = 0, int output_width = 0);
 };
 
 } // namespace stitcher
@@ -2,6 +2,7 @@
 #include <iostream>
 #include <unistd.h>
 
+#include "airmap/incremental_opencv_stitcher.h"
 #include "airmap/opencv_stitcher.h"
 using namespace airmap::stitcher;
 using namespace airmap::logging;
@@ -19,12 +20,28 @@ int main(int argc, char *argv[])
             ("output", boost::program_options::value<std::string>()->default_value("./panorama.jpg"),
                 "path to the resulting equirectangular stitching")
             ("cubemap", "if set, also generates cubemap in <output>.<face>.jpg")
+            ("tile_pyramid", boost::program_options::value<std::string>(),
+                "If set, also generates a multiresolution pyramid of cubemap tiles for web viewers in this folder.")
+            ("tile_size", boost::program_options::value<int>()->default_value(512),
+                "Width and height of the tiles of the tile pyramid, in pixels.")
             ("ram_budget",
                 boost::program_options::value<size_t>()->default_value(Panorama::Parameters::defaultMemoryBudgetMB()),
                 "RAM buget (in MB) the stitcher can assume it can use")
             ("retries",
                 boost::program_options::value<size_t>()->default_value(6),
                 "The stitching process is non-deterministic, this increases chances to succeed")
+            ("compose_tile_size",
+                boost::program_options::value<int>()->default_value(0),
+                "Rows of the panorama composed at a time, to bound memory used by large panoramas.  0 composes it at once.")
+            ("output_width",
+                boost::program_options::value<int>()->default_value(0),
+                "Width of the full sphere panorama to compose directly, without cropping or padding.  0 composes at the scale of the images.")
+            ("seam_megapix",
+                boost::program_options::value<double>()->default_value(0.4),
+                "Megapixels images are scaled to to find seams.")
+            ("seam_finder_graph_cut_levels",
+                boost::program_options::value<int>()->default_value(1),
+                "Times images are halved to find seams coarse to fine.  Raising seam_megapix by 4^levels keeps about the same cost.")
             ("debug", "If set, debug artifacts (e.g. detected features, matches, warping, etc.) will be created in <debug_output>.")
             ("debug_path", boost::program_options::value<std::string>()->default_value("debug"),
                 "Path to the debug output.")
@@ -33,6 +50,10 @@ int main(int argc, char *argv[])
             ("elapsed_time_log", "Log elapsed times of stitch operations.")
             ("estimate", "Estimate time remaining during stitch.  Always enabled if elapsed_time or estimate_log are.")
             ("estimate_log", "Log estimates of remaining time.  Always enabled if elapsed_time_log is.")
+            ("pose_only", "If set, cameras are built from gimbal orientations instead of matching features.  Faster, preview quality.")
+            ("incremental", "If set, images are processed as they are read, as they would be while being downloaded.")
+            ("templates_path", boost::program_options::value<std::string>(),
+                "If set, stitch templates of previously stitched sites are read from and saved to this folder.")
             ;
     try {
         boost::program_options::positional_options_description positional;
@@ -53,12 +74,11 @@ int main(int argc, char *argv[])
           return EXIT_FAILURE;
         }
 
-        std::list<GeoImage> input;
-        for (std::string path : vm["input"].as<std::vector<std::string>>()) {
-            if (vm.count("input_path")) {
+        std::vector<std::string> paths = vm["input"].as<std::vector<std::string>>();
+        if (vm.count("input_path")) {
+            for (std::string &path : paths) {
                 path = (boost::filesystem::path(vm["input_path"].as<std::string>()) / path).string();
             }
-            input.push_back(GeoImage::fromExif(path));
         }
 
         std::string debugPath;
@@ -77,10 +97,45 @@ int main(int argc, char *argv[])
             vm.count("estimate_log") > 0,
             vm["retries"].as<size_t>()
         };
-        RetryingStitcher{
-            std::make_shared<LowLevelOpenCVStitcher>(
-                Configuration(
-                    StitchType::ThreeSixty),
+        if (vm.count("templates_path")) {
+            parameters.stitchTemplatesPath = vm["templates_path"].as<std::string>();
+        }
+        if (vm.count("tile_pyramid")) {
+            parameters.tilePyramidPath = vm["tile_pyramid"].as<std::string>();
+            parameters.tilePyramidTileSize = vm["tile_size"].as<int>();
+        }
+        Configuration configuration(StitchType::ThreeSixty);
+        configuration.pose_only = vm.count("pose_only") > 0;
+        configuration.compose_tile_size = vm["compose_tile_size"].as<int>();
+        configuration.output_width = vm["output_width"].as<int>();
+        configuration.seam_megapix = vm["seam_megapix"].as<double>();
+        configuration.seam_finder_graph_cut_levels =
+            vm["seam_finder_graph_cut_levels"].as<int>();
+        MonitoredStitcher::SharedPtr stitcher;
+        if (vm.count("incremental")) {
+            auto incremental = std::make_shared<IncrementalOpenCVStitcher>(
+                configuration,
+                Panorama{GeoImage::fromExif(paths.front())},
+                parameters,
+                vm["output"].as<std::string>(),
+                logger,
+                []() {},
+                vm.count("debug") > 0,
+                debugPath
+            );
+            for (auto path = std::next(paths.begin()); path != paths.end(); ++path) {
+                if (!incremental->add(GeoImage::fromExif(*path))) {
+                    throw std::invalid_argument{"exif of " + *path + " doesn't fit previous images"};
+                }
+            }
+            stitcher = incremental;
+        } else {
+            std::list<GeoImage> input;
+            for (const std::string &path : paths) {
+                input.push_back(GeoImage::fromExif(path));
+            }
+            stitcher = std::make_shared<LowLevelOpenCVStitcher>(
+                configuration,
                 Panorama{input},
                 parameters,
                 vm["output"].as<std::string>(),
@@ -88,8 +143,9 @@ int main(int argc, char *argv[])
                 []() {},
                 vm.count("debug") > 0,
                 debugPath
-            ), parameters, logger
-        }.stitch();
+            );
+        }
+        RetryingStitcher{stitcher, parameters, logger}.stitch();
         return EXIT_SUCCESS;
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
@@ -6,6 +6,12 @@
 #include <opencv2/imgproc.hpp>
 
 cv::Mat Cropper::cropNullEdges(const cv::Mat &original, double maximumRatio)
+{
+    return cropNullEdges(original, cv::Mat(), maximumRatio);
+}
+
+cv::Mat Cropper::cropNullEdges(const cv::Mat &original, const cv::Mat &mask,
+                               double maximumRatio)
 {
     // To crop null edges, we will:
     //
@@ -14,13 +20,13 @@ cv::Mat Cropper::cropNullEdges(const cv::Mat &original, double maximumRatio)
     //
     // 2) Convert the image to a mask -- black for null regions and white for image data.
     // The mask will be used to facilitate contour detection along the image/null
-    // boundaries.
+    // boundaries. If a mask is given, it is used as is.
     //
     // 3) Find the contour along the mask. Black-and-white is important here.
     //
-    // 4) Build a minimum bounding rectangle along the contour and repeatedly erode the
-    // contour along the bounding rectangle and updating the bounding rectangle. Erosion
-    // helps to minimize noise from non-linear null regions intersecting the boundary.
+    // 4) Build a minimum bounding rectangle along the contour and inset it by a pixel.
+    // The inset helps to minimize noise from non-linear null regions intersecting the
+    // boundary.
     //
     // 5) Crop to the finalized bounding rectangle.
     if (1.0 <= maximumRatio) {
@@ -29,24 +35,27 @@ cv::Mat Cropper::cropNullEdges(const cv::Mat &original, double maximumRatio)
 
     cv::Mat panorama_mask;
     cv::Rect bounds;
-    cv::Mat crop_mask;
     cv::Mat cropped;
 
     // Step name and its functor
     using step_type = std::pair<const char *, std::function<void(void)>>;
     std::vector<step_type> steps {
         { "Validating image minimums", [&]() { validateMinimumSize(original); } },
-        { "Building crop mask", [&]() { panorama_mask = buildPanoramaMask(original); } },
-        { "Finding contours along the crop mask",
+        { "Building crop mask",
           [&]() {
-              std::tie(crop_mask, bounds) = maskContour(panorama_mask);
-              panorama_mask.release();
+              if (mask.empty()) {
+                  panorama_mask = buildPanoramaMask(original);
+              } else {
+                  CV_Assert(mask.type() == CV_8U && mask.size() == original.size());
+                  panorama_mask = mask;
+              }
           } },
-        { "Eroding down to find boundary",
+        { "Finding contours along the crop mask",
           [&]() {
-              bounds = findErosionBoundary(crop_mask, original);
-              crop_mask.release();
+              bounds = bestContourRect(panorama_mask);
+              panorama_mask.release();
           } },
+        { "Insetting boundary", [&]() { bounds = insetBounds(bounds, original.size()); } },
         { "Cropping",
           [&]() {
               double ratio = (double(bounds.area()) / original.size().area());
@@ -98,14 +107,16 @@ cv::Mat Cropper::buildPanoramaMask(const cv::Mat &original)
     //
     // The OpenCV tutorial on thresholding has good visualization about how to build a
     // mask: https://docs.opencv.org/4.2.0/db/d8e/tutorial_threshold.html
-    cv::Mat bordered;
-    cv::copyMakeBorder(original, bordered, borderPixels_, borderPixels_, borderPixels_,
-                       borderPixels_, cv::BORDER_CONSTANT, { 0.f });
-
-    // Grayscale requires 8-bit data. Downscale to eight-bit data.
+    //
+    // No border is needed around the mask: cv::findContours pads it with null pixels
+    // itself.
     cv::Mat eightbit;
-    bordered.convertTo(eightbit, CV_8U);
-    bordered.release();
+    if (original.depth() == CV_8U) {
+        eightbit = original;
+    } else {
+        // Grayscale requires 8-bit data. Downscale to eight-bit data.
+        original.convertTo(eightbit, CV_8U);
+    }
 
     // Convert to grayscale
     cv::Mat gray;
@@ -145,42 +156,15 @@ cv::Rect Cropper::bestContourRect(const cv::Mat &img)
     return bounds;
 }
 
-Cropper::CropMask Cropper::maskContour(const cv::Mat &img)
-{
-    auto bounds = bestContourRect(img);
-    cv::Mat crop_mask { img.size(), CV_8U };
-    cv::rectangle(crop_mask, bounds.tl(), bounds.br(), cv::Scalar { 255.f }, cv::FILLED);
-    return std::make_pair(crop_mask, bounds);
-}
-
-cv::Mat Cropper::erodeMask(const cv::Mat &input_black_and_white_mask)
+cv::Rect Cropper::insetBounds(const cv::Rect &bounds, const cv::Size &size)
 {
-    cv::Mat eroded_mask { input_black_and_white_mask.clone() };
-    cv::Mat sub { input_black_and_white_mask.clone() };
-    while (auto nz = countNonZero(sub)) {
-        cv::Mat eroded { eroded_mask.clone() };
-        cv::erode(eroded_mask, eroded,
-                  cv::getStructuringElement(cv::MORPH_RECT, cv::Size { 3, 3 }));
-        eroded_mask = eroded;
-        subtract(eroded_mask, input_black_and_white_mask, sub);
-        if (countNonZero(sub) == nz) {
-            throw std::logic_error { "infinite erosion" };
-        }
+    // The bounding rectangle is inset by a pixel on the top and left only: the mask it
+    // used to be eroded from was filled up to and including its bottom right corner.
+    cv::Rect inset { bounds.x + 1, bounds.y + 1, bounds.width - 1, bounds.height - 1 };
+    inset &= cv::Rect { 0, 0, size.width - borderPixels_, size.height - borderPixels_ };
+    if (inset.empty()) {
+        std::string errmsg { "No contours found!" };
+        throw std::logic_error { errmsg };
     }
-    return eroded_mask;
-}
-
-cv::Rect Cropper::findErosionBoundary(const cv::Mat &uneroded_mask,
-                                      const cv::Mat &original)
-{
-
-    // erodeMask will return a tighter mask after erosion.
-    cv::Mat eroded_mask = erodeMask(uneroded_mask);
-    return bestContourRect(
-            { eroded_mask,
-              // Remember that our border at the beginning increased our
-              // image area. So, we provide a Region of Interest to clip
-              // our contour area.
-              cv::Rect { cv::Point { borderPixels_, borderPixels_ },
-                         cv::Point { original.size().width, original.size().height } } });
+    return inset;
 }
@@ -8,7 +8,7 @@
 /**
  * @brief The Cropper class
  *  Provides `cropNullEdges` function which accepts an input image and crops them off.
- * The crop function works by eroding
+ * The crop function works by insetting the bounding rectangle of the panorama data.
  */
 class Cropper
 {
@@ -33,17 +33,25 @@ public:
      */
     cv::Mat cropNullEdges(const cv::Mat &original, double maximumRatio = 99. / 100);
 
+    /**
+     * @brief cropNullRegions
+     *  As above, with the null regions given by a mask rather than searched for among
+     * the black pixels of the image.
+     * @param original
+     * @param mask
+     *  CV_8U mask of the image, non-zero where there is image data, such as the result
+     * mask of a blender. If empty, the mask is built from the image.
+     * @param maximumRatio
+     * @return
+     */
+    cv::Mat cropNullEdges(const cv::Mat &original, const cv::Mat &mask,
+                          double maximumRatio = 99. / 100);
+
 protected:
     using Contour = std::vector<cv::Point>;
     using Contours = std::vector<Contour>;
     using Areas = std::vector<double>;
 
-    /**
-     * @brief CropMask
-     *  Rect describing the inner crop region, and a Mat with that region filled white.
-     */
-    using CropMask = std::pair<cv::Mat, cv::Rect>;
-
     /**
      * @brief validateMinimumSize
      * Throws if the image shouldn't be processed.
@@ -72,53 +80,28 @@ protected:
     cv::Rect bestContourRect(const cv::Mat &img);
 
     /**
-     * @brief Cropper::maskContour
-     * maskContour gets the minimum bounding rectangle of the image's contour (excluding
-     * the null edge). It fills the bounding rectangle with white, returning a new mask.
-     * The returned cropping rectangle may intersect null regions and image data along the
-     * boundary.
-     * @param img
-     * @return
-     */
-    CropMask maskContour(const cv::Mat &img);
-
-    /**
-     * @brief Cropper::erodeMask
-     * This accepts an input black-and-white mask.
-     * It will clone the mask to two temporaries;
-     *  * the first will contain the erosion result
-     *  * the second will be used to count the number of pixels remaining to be eroded
-     * (which are white) In a loop, it will erode the second, subtract the input, and save
-     * to the first. It repeats while any white pixels remain outside of the erosion
-     * boundary.
-     *
-     * The returned image is strictly a tighter view of the input mask.
-     * The erosion reduces noise (null region intersections) along the edge by tightening
-     * the view.
+     * @brief Cropper::insetBounds
+     * Tighten the bounding rectangle of the panorama data by a pixel on each side to
+     * reduce noise (null region intersections) along the edge, and clip it to the
+     * panorama less its last `borderPixels_` rows and columns.
      *
-     * The OpenCV tutorial on erosion describes the effect with some visual aid:
-     * https://docs.opencv.org/4.2.0/db/df6/tutorial_erosion_dilatation.html
-     * @param input_black_and_white_mask
-     * @return
-     */
-    cv::Mat erodeMask(const cv::Mat &input_black_and_white_mask);
-
-    /**
-     * @brief Cropper::findErosionBoundary
-     *  Search for the "best" boundary along a mask, erode it to reduce noise, and return
-     * a bounding rectangle for it.
-     * @param uneroded_mask
-     * @param original
+     * This is the rectangle that used to be found by filling the bounding rectangle
+     * into a mask, eroding the mask with a 3x3 kernel until no pixel remained outside
+     * of the filled rectangle (which always took a single erosion), and searching for
+     * the contour of the eroded mask again.
+     * @param bounds
+     *  Bounding rectangle of the panorama data.
+     * @param size
+     *  Size of the panorama.
      * @return
+     * @throws std::logic_error -- nothing is left of the bounding rectangle
      */
-    cv::Rect findErosionBoundary(const cv::Mat &uneroded_mask, const cv::Mat &original);
+    cv::Rect insetBounds(const cv::Rect &bounds, const cv::Size &size);
 
     /**
      * @brief Cropper::borderPixels
-     *  A border will be added during the cropping function.
-     *  The size of the border affects algorithmic performance.
-     *  Too small will result in the crop function failing.
-     *  Too large will result in the crop function performing slowly.
+     *  Rows and columns at the bottom and right of the panorama which are always
+     * cropped off.
      */
     int borderPixels_ = 10;
 
@@ -1,55 +1,154 @@
 #include "cubemap.h"
+#include <algorithm>
 #include <cmath>
+#include <list>
+#include <mutex>
+#include <tuple>
+
+namespace {
+
+/*
+ * Code found:
+ * https://stackoverflow.com/questions/29678510/convert-21-equirectangular-panorama-to-cube-map/34720686#34720686
+ * and after https://stackoverflow.com/help/licensing, presumed licensed under the
+ * CC BY-SA 3.0 (see https://creativecommons.org/licenses/by-sa/3.0/)
+ */
+const float faceTransform[6][2] = { { 0, 0 },         { M_PI / 2, 0 },  { M_PI, 0 },
+                                    { -M_PI / 2, 0 }, { 0, -M_PI / 2 }, { 0, M_PI / 2 } };
+
+// Maps of the faces written, by panorama size, face size, face and flip code, most
+// recently used first.  Panoramas of a site are usually all of the same size, so their
+// faces are only computed once.
+using FaceKey = std::tuple<int, int, int, int, int, int>;
+struct CachedFaceMaps
+{
+    FaceKey key;
+    cv::Mat map1;
+    cv::Mat map2;
+};
+std::mutex faceMapsMutex;
+std::list<CachedFaceMaps> faceMapsCache;
+size_t faceMapsCacheLimit = 0;
+size_t faceMapsCacheBytes = 0;
+
+size_t mapsBytes(const cv::Mat &map1, const cv::Mat &map2)
+{
+    return map1.total() * map1.elemSize() + map2.total() * map2.elemSize();
+}
+
+/**
+ * @brief evictFaceMaps drops the least recently used maps until the cache fits the limit
+ */
+void evictFaceMaps()
+{
+    while (faceMapsCacheBytes > faceMapsCacheLimit) {
+        const CachedFaceMaps &last = faceMapsCache.back();
+        faceMapsCacheBytes -= mapsBytes(last.map1, last.map2);
+        faceMapsCache.pop_back();
+    }
+}
+
+/**
+ * @brief toTexture maps angular coordinates to coordinates in the panorama
+ */
+void toTexture(float u, float v, float inWidth, float inHeight, float &x, float &y)
+{
+    // Map from angular coordinates to [-1, 1], respectively.
+    u = u / (M_PI);
+    v = v / (M_PI / 2);
+
+    // Warp around, if our coordinates are out of bounds.
+    while (v < -1) {
+        v += 2;
+        u += 1;
+    }
+    while (v > 1) {
+        v -= 2;
+        u += 1;
+    }
+
+    while (u < -1) {
+        u += 2;
+    }
+    while (u > 1) {
+        u -= 2;
+    }
+
+    // Map from [-1, 1] to in texture space
+    u = u / 2.0f + 0.5f;
+    v = v / 2.0f + 0.5f;
+
+    x = u * (inWidth - 1);
+    y = v * (inHeight - 1);
+}
+
+} // namespace
 
 void CubeMap::write(const cv::Mat &input, const Paths &paths)
 {
     size_t face_dimension = input.cols / 4;
 
-    writeFace(input, Face::Front, paths.at(Face::Front), face_dimension, face_dimension,
-              FlipCode::None);
-    writeFace(input, Face::Right, paths.at(Face::Right), face_dimension, face_dimension,
-              FlipCode::None);
-    writeFace(input, Face::Back, paths.at(Face::Back), face_dimension, face_dimension,
-              FlipCode::None);
-    writeFace(input, Face::Left, paths.at(Face::Left), face_dimension, face_dimension,
-              FlipCode::None);
-    writeFace(input, Face::Top, paths.at(Face::Top), face_dimension, face_dimension,
-              FlipCode::Y);
-    writeFace(input, Face::Bottom, paths.at(Face::Bottom), face_dimension, face_dimension,
-              FlipCode::X);
+    // Faces are resampled and encoded concurrently.
+    cv::parallel_for_(cv::Range(0, static_cast<int>(Face::NumFaces)),
+                      [&](const cv::Range &range) {
+                          for (int i = range.start; i < range.end; ++i) {
+                              Face face = static_cast<Face>(i);
+                              writeFace(input, face, paths.at(face), face_dimension,
+                                        face_dimension, faceFlipCode(face));
+                          }
+                      });
+}
+
+CubeMap::FlipCode CubeMap::faceFlipCode(Face faceId)
+{
+    switch (faceId) {
+    case Face::Top:
+        return FlipCode::Y;
+    case Face::Bottom:
+        return FlipCode::X;
+    default:
+        return FlipCode::None;
+    }
 }
 
 void CubeMap::writeFace(const cv::Mat &in, Face faceId, const std::string &pathOut,
                         int width, int height, FlipCode flipCode)
 {
     cv::Mat out;
-    createFace(in, out, faceId, width, height);
-    if (flipCode != FlipCode::None) {
-        cv::transpose(out, out);
-        cv::flip(out, out, static_cast<int>(flipCode));
-    }
+    createFace(in, out, faceId, width, height, flipCode);
     cv::imwrite(pathOut, out);
 }
 
-/*
- * Code found:
- * https://stackoverflow.com/questions/29678510/convert-21-equirectangular-panorama-to-cube-map/34720686#34720686
- * and after https://stackoverflow.com/help/licensing, presumed licensed under the
- * CC BY-SA 3.0 (see https://creativecommons.org/licenses/by-sa/3.0/)
- */
-float faceTransform[6][2] = { { 0, 0 },         { M_PI / 2, 0 },  { M_PI, 0 },
-                              { -M_PI / 2, 0 }, { 0, -M_PI / 2 }, { 0, M_PI / 2 } };
-
 void CubeMap::createFace(const cv::Mat &in, cv::Mat &face, Face faceId, int width,
-                         int height)
+                         int height, FlipCode flipCode)
 {
-    const float inWidth = in.cols;
-    const float inHeight = in.rows;
     assert(in.size().height == in.size().width / 2);
 
+    cv::Mat map1, map2;
+    cachedFaceMaps(in.size(), faceId, width, height, flipCode, map1, map2);
+
+    // Do actual resampling using OpenCV's remap
+    cv::remap(in, face, map1, map2, cv::INTER_CUBIC, cv::BORDER_CONSTANT,
+              cv::Scalar(0, 0, 0));
+}
+
+void CubeMap::faceMaps(const cv::Size &inSize, Face faceId, int width, int height,
+                       FlipCode flipCode, cv::Mat &map1, cv::Mat &map2)
+{
+    const float inWidth = inSize.width;
+    const float inHeight = inSize.height;
+
+    // The face is computed with width rows and height columns, then transposed and
+    // flipped if there is a flip code.
+    bool transposed = flipCode != FlipCode::None;
+    bool flipRows = flipCode == FlipCode::X || flipCode == FlipCode::Both;
+    bool flipCols = flipCode == FlipCode::Y || flipCode == FlipCode::Both;
+    int rows = transposed ? height : width;
+    int cols = transposed ? width : height;
+
     // Allocate map
-    cv::Mat mapx(height, width, CV_32F);
-    cv::Mat mapy(height, width, CV_32F);
+    cv::Mat mapx(rows, cols, CV_32F);
+    cv::Mat mapy(rows, cols, CV_32F);
 
     // Calculate adjacent (ak) and opposite (an) of the
     // triangle that is spanned from the sphere center
@@ -60,84 +159,116 @@ void CubeMap::createFace(const cv::Mat &in, cv::Mat &face, Face faceId, int widt
     const float ftu = faceTransform[static_cast<int>(faceId)][0];
     const float ftv = faceTransform[static_cast<int>(faceId)][1];
 
+    // Map face pixel coordinates to [-1, 1] on plane, then [-1, 1] plane coords to
+    // [-an, an], thats the coordinates in respect to a unit sphere that contains our
+    // box.  nx follows the columns of the untransposed face, ny its rows.
+    std::vector<float> nxs(height), nys(width);
+    for (int y = 0; y < height; y++) {
+        nxs[y] = ((float)y / (float)height - 0.5f) * 2 * an;
+    }
+    for (int x = 0; x < width; x++) {
+        nys[x] = ((float)x / (float)width - 0.5f) * 2 * an;
+    }
+
+    // On center faces, the longitude only depends on nx.
+    std::vector<float> us(height), cosus(height);
+    if (ftv == 0) {
+        for (int y = 0; y < height; y++) {
+            us[y] = atan2(nxs[y], ak);
+            cosus[y] = cos(us[y]);
+        }
+    }
+
     // For each point in the target image,
     // calculate the corresponding source coordinates.
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-
-            // Map face pixel coordinates to [-1, 1] on plane
-            float nx = (float)y / (float)height - 0.5f;
-            float ny = (float)x / (float)width - 0.5f;
-
-            nx *= 2;
-            ny *= 2;
-
-            // Map [-1, 1] plane coords to [-an, an]
-            // thats the coordinates in respect to a unit sphere
-            // that contains our box.
-            nx *= an;
-            ny *= an;
-
-            float u, v;
-
-            // Project from plane to sphere surface.
-            if (ftv == 0) {
-                // Center faces
-                u = atan2(nx, ak);
-                v = atan2(ny * cos(u), ak);
-                u += ftu;
-            } else if (ftv > 0) {
-                // Bottom face
-                float d = sqrt(nx * nx + ny * ny);
-                v = M_PI / 2 - atan2(d, ak);
-                u = atan2(ny, nx);
-            } else {
-                // Top face
-                float d = sqrt(nx * nx + ny * ny);
-                v = -M_PI / 2 + atan2(d, ak);
-                u = atan2(-ny, nx);
-            }
+    cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range) {
+        for (int i = range.start; i < range.end; i++) {
+            float *mapxRow = mapx.ptr<float>(i);
+            float *mapyRow = mapy.ptr<float>(i);
+            for (int j = 0; j < cols; j++) {
+                // Pixel of the untransposed, unflipped face.
+                int fi = flipRows ? rows - 1 - i : i;
+                int fj = flipCols ? cols - 1 - j : j;
+                int x = transposed ? fj : fi;
+                int y = transposed ? fi : fj;
 
-            // Map from angular coordinates to [-1, 1], respectively.
-            u = u / (M_PI);
-            v = v / (M_PI / 2);
+                float nx = nxs[y];
+                float ny = nys[x];
+                float u, v;
 
-            // Warp around, if our coordinates are out of bounds.
-            while (v < -1) {
-                v += 2;
-                u += 1;
-            }
-            while (v > 1) {
-                v -= 2;
-                u += 1;
-            }
+                // Project from plane to sphere surface.
+                if (ftv == 0) {
+                    // Center faces
+                    u = us[y] + ftu;
+                    v = atan2(ny * cosus[y], ak);
+                } else if (ftv > 0) {
+                    // Bottom face
+                    float d = sqrt(nx * nx + ny * ny);
+                    v = M_PI / 2 - atan2(d, ak);
+                    u = atan2(ny, nx);
+                } else {
+                    // Top face
+                    float d = sqrt(nx * nx + ny * ny);
+                    v = -M_PI / 2 + atan2(d, ak);
+                    u = atan2(-ny, nx);
+                }
 
-            while (u < -1) {
-                u += 2;
+                toTexture(u, v, inWidth, inHeight, mapxRow[j], mapyRow[j]);
             }
-            while (u > 1) {
-                u -= 2;
-            }
-
-            // Map from [-1, 1] to in texture space
-            u = u / 2.0f + 0.5f;
-            v = v / 2.0f + 0.5f;
+        }
+    });
 
-            u = u * (inWidth - 1);
-            v = v * (inHeight - 1);
+    cv::convertMaps(mapx, mapy, map1, map2, CV_16SC2);
+}
 
-            // Save the result for this pixel in map
-            mapx.at<float>(x, y) = u;
-            mapy.at<float>(x, y) = v;
+void CubeMap::cachedFaceMaps(const cv::Size &inSize, Face faceId, int width, int height,
+                             FlipCode flipCode, cv::Mat &map1, cv::Mat &map2)
+{
+    FaceKey key { inSize.width, inSize.height, width, height, static_cast<int>(faceId),
+                  static_cast<int>(flipCode) };
+    auto find = [&key]() {
+        return std::find_if(faceMapsCache.begin(), faceMapsCache.end(),
+                            [&key](const CachedFaceMaps &maps) { return maps.key == key; });
+    };
+    {
+        std::lock_guard<std::mutex> lock(faceMapsMutex);
+        auto it = find();
+        if (it != faceMapsCache.end()) {
+            faceMapsCache.splice(faceMapsCache.begin(), faceMapsCache, it);
+            map1 = it->map1;
+            map2 = it->map2;
+            return;
         }
     }
 
-    // Recreate output image if it has wrong size or type.
-    if (face.cols != width || face.rows != height || face.type() != in.type()) {
-        face = cv::Mat(width, height, in.type());
+    faceMaps(inSize, faceId, width, height, flipCode, map1, map2);
+
+    std::lock_guard<std::mutex> lock(faceMapsMutex);
+    size_t bytes = mapsBytes(map1, map2);
+    if (bytes > faceMapsCacheLimit || find() != faceMapsCache.end()) {
+        return;
     }
+    faceMapsCache.push_front(CachedFaceMaps { key, map1, map2 });
+    faceMapsCacheBytes += bytes;
+    evictFaceMaps();
+}
 
-    // Do actual resampling using OpenCV's remap
-    cv::remap(in, face, mapx, mapy, cv::INTER_CUBIC, cv::BORDER_CONSTANT,
-              cv::Scalar(0, 0, 0));
+void CubeMap::setFaceMapsCacheLimit(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(faceMapsMutex);
+    faceMapsCacheLimit = bytes;
+    evictFaceMaps();
+}
+
+void CubeMap::clearFaceMapsCache()
+{
+    std::lock_guard<std::mutex> lock(faceMapsMutex);
+    faceMapsCache.clear();
+    faceMapsCacheBytes = 0;
+}
+
+size_t CubeMap::faceMapsCacheSize()
+{
+    std::lock_guard<std::mutex> lock(faceMapsMutex);
+    return faceMapsCacheBytes;
 }
@@ -30,6 +30,55 @@ public:
 
     static void writeFace(const cv::Mat &in, Face faceId, const std::string &out, int width,
                           int height, FlipCode flipCode);
+
+    /**
+     * @brief faceFlipCode returns the flip code faces are written with
+     */
+    static FlipCode faceFlipCode(Face faceId);
+
+    /**
+     * @brief createFace resamples a cube face from an equirectangular panorama
+     * @param in - the equirectangular panorama
+     * @param face - the face, of width rows and height columns, transposed and flipped
+     * if flipCode isn't None
+     * @param flipCode - flip of the transposed face, as cv::flip
+     */
     static void createFace(const cv::Mat &in, cv::Mat &face, Face faceId, int width,
-                           int height);
+                           int height, FlipCode flipCode = FlipCode::None);
+
+    /**
+     * @brief faceMaps computes the fixed-point remap maps of a cube face, as for
+     * cv::convertMaps to CV_16SC2, with the transpose and flip of the face folded in
+     * @param inSize - size of the equirectangular panorama
+     * @param map1 - CV_16SC2 integer source coordinates
+     * @param map2 - CV_16UC1 interpolation table indices
+     */
+    static void faceMaps(const cv::Size &inSize, Face faceId, int width, int height,
+                         FlipCode flipCode, cv::Mat &map1, cv::Mat &map2);
+
+    /**
+     * @brief setFaceMapsCacheLimit bounds the memory the maps of the faces created are
+     * cached in, dropping the least recently used maps beyond it.  0, the default,
+     * disables the cache.
+     * @param bytes - memory limit, in bytes
+     */
+    static void setFaceMapsCacheLimit(size_t bytes);
+
+    /**
+     * @brief clearFaceMapsCache releases the cached maps of the faces created
+     */
+    static void clearFaceMapsCache();
+
+    /**
+     * @brief faceMapsCacheSize returns the memory held by cached maps, in bytes
+     */
+    static size_t faceMapsCacheSize();
+
+private:
+    /**
+     * @brief cachedFaceMaps returns the maps of faceMaps, computed once per panorama
+     * and face size while they fit the cache
+     */
+    static void cachedFaceMaps(const cv::Size &inSize, Face faceId, int width, int height,
+                               FlipCode flipCode, cv::Mat &map1, cv::Mat &map2);
 };
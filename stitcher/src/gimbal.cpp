@@ -71,10 +71,29 @@ cv::Mat GimbalOrientation::rotationMatrix()
     cv::Mat R = Rx * Ry.inv() * Rz;
     R.at<double>(1, 1) *= -1;
     R.at<double>(2, 1) *= -1;
-    R.at<double>(3, 1) *= -1;
     return R;
 }
 
+cv::Mat GimbalOrientation::cameraRotation()
+{
+    GimbalOrientation gimbal_orientation = convertTo(Units::Radians);
+
+    double x = gimbal_orientation.pitch;
+    double y = gimbal_orientation.yaw;
+    double z = gimbal_orientation.roll;
+
+    cv::Mat Rx =
+            (cv::Mat_<double>(3, 3) << 1, 0, 0, 0, cos(x), -sin(x), 0, sin(x), cos(x));
+
+    cv::Mat Ry =
+            (cv::Mat_<double>(3, 3) << cos(y), 0, sin(y), 0, 1, 0, -sin(y), 0, cos(y));
+
+    cv::Mat Rz =
+            (cv::Mat_<double>(3, 3) << cos(z), -sin(z), 0, sin(z), cos(z), 0, 0, 0, 1);
+
+    return Ry * Rx * Rz;
+}
+
 cv::Mat GimbalOrientation::rotateTo(GimbalOrientation &to)
 {
     cv::Mat R1 = rotationMatrix();
@@ -24,6 +24,25 @@ SourceImages::SourceImages(const Panorama &panorama,
     ensureImageCount();
 }
 
+SourceImages::SourceImages(const Panorama &panorama,
+                           std::vector<cv::Mat> loaded_images,
+                           std::shared_ptr<airmap::logging::Logger> logger,
+                           const int _minimumImageCount)
+    : panorama(panorama)
+    , images(std::move(loaded_images))
+    , images_scaled(images)
+    , _logger(logger)
+    , minimumImageCount(_minimumImageCount)
+{
+    assert(images.size() == panorama.size());
+    for (const GeoImage &panorama_image : panorama) {
+        gimbal_orientations.push_back(GimbalOrientation(panorama_image.cameraPitchDeg,
+                                                        panorama_image.cameraRollDeg,
+                                                        panorama_image.cameraYawDeg));
+    }
+    ensureImageCount();
+}
+
 void SourceImages::clear()
 {
     gimbal_orientations.clear();
@@ -0,0 +1,285 @@
+#include "airmap/incremental_opencv_stitcher.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+namespace airmap {
+namespace stitcher {
+
+IncrementalOpenCVStitcher::IncrementalOpenCVStitcher(
+    const Configuration &config, const Panorama &panorama,
+    const Panorama::Parameters &parameters, const std::string &outputPath,
+    std::shared_ptr<logging::Logger> logger,
+    monitor::Estimator::UpdatedCb updatedCb, bool debug, path debugPath)
+    : LowLevelOpenCVStitcher(config, panorama, parameters, outputPath, logger,
+                             updatedCb, debug, debugPath)
+    , _queue(panorama.begin(), panorama.end())
+    , _finished(false)
+    , _cancelled(false)
+    , _attempts(0)
+    , _findFeatures(!(_config.pose_only && _camera))
+    , _featuresFinder(_findFeatures ? getFeaturesFinder() : cv::Ptr<cv::Feature2D>())
+    , _featuresMatcher(_findFeatures ? getFeaturesMatcher()
+                                   : cv::Ptr<cv::detail::FeaturesMatcher>())
+{
+    _worker = std::thread(&IncrementalOpenCVStitcher::process, this);
+}
+
+IncrementalOpenCVStitcher::~IncrementalOpenCVStitcher()
+{
+    cancel();
+    finish();
+}
+
+bool IncrementalOpenCVStitcher::add(const GeoImage &image)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_finished) {
+        throw std::logic_error("Can't add images once stitching has started.");
+    }
+
+    size_t size = _panorama.size();
+    if (!_panorama.add(image)) {
+        return false;
+    }
+
+    // Panorama::add accepts, but ignores previously stitched panoramas.
+    if (_panorama.size() > size) {
+        _queue.push_back(image);
+        _condition.notify_one();
+    }
+    return true;
+}
+
+void IncrementalOpenCVStitcher::cancel()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _cancelled = true;
+    _queue.clear();
+    _condition.notify_one();
+}
+
+void IncrementalOpenCVStitcher::finish()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _finished = true;
+        _condition.notify_one();
+    }
+
+    if (_worker.joinable()) {
+        _worker.join();
+    }
+}
+
+std::vector<cv::detail::MatchesInfo> IncrementalOpenCVStitcher::pairwiseMatches() const
+{
+    size_t num_images = _features.size();
+    std::vector<cv::detail::MatchesInfo> pairwise_matches(num_images * num_images);
+    for (const auto &pair_matches : _matches) {
+        size_t from = static_cast<size_t>(pair_matches.first.first);
+        size_t to = static_cast<size_t>(pair_matches.first.second);
+        pairwise_matches[from * num_images + to] = pair_matches.second;
+
+        // Same as cv::detail::FeaturesMatcher, which only matches each pair
+        // once.
+        cv::detail::MatchesInfo &dual = pairwise_matches[to * num_images + from];
+        dual = pair_matches.second;
+        dual.src_img_idx = static_cast<int>(to);
+        dual.dst_img_idx = static_cast<int>(from);
+        if (!pair_matches.second.H.empty()) {
+            dual.H = pair_matches.second.H.inv();
+        }
+        for (auto &match : dual.matches) {
+            std::swap(match.queryIdx, match.trainIdx);
+        }
+    }
+    return pairwise_matches;
+}
+
+void IncrementalOpenCVStitcher::process()
+{
+    while (true) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _condition.wait(lock, [this]() { return _finished || !_queue.empty(); });
+        if (_queue.empty()) {
+            return;
+        }
+        GeoImage image = _queue.front();
+        _queue.pop_front();
+        lock.unlock();
+
+        try {
+            processImage(image);
+        } catch (const std::exception &e) {
+            lock.lock();
+            _error = e.what();
+            _queue.clear();
+            return;
+        }
+    }
+}
+
+void IncrementalOpenCVStitcher::processImage(const GeoImage &image)
+{
+    cv::Mat decoded = cv::imread(image.path);
+    if (decoded.empty()) {
+        std::stringstream ss;
+        ss << "Can't read image " << image.path;
+        throw std::invalid_argument(ss.str());
+    }
+
+    if (_camera && _camera->distortion_model && _camera->distortion_model->enabled()) {
+        _camera->distortion_model->undistort(decoded, _camera->K());
+    }
+
+    int index = static_cast<int>(_images.size());
+    _images.push_back(decoded);
+
+    std::stringstream message;
+    message << "Loaded image " << index << " (" << image.path << ").";
+    _logger->log(logging::Logger::Severity::debug, message, "stitcher");
+
+    if (!_findFeatures) {
+        return;
+    }
+
+    // The work scale only depends on the size of each image, so features
+    // found now are at the work scale of the complete panorama.
+    double work_scale = _config.work_megapix < 0
+            ? 1.0
+            : cv::min(1.0, sqrt(_config.work_megapix * 1e6 / decoded.size().area()));
+    cv::Mat work_image;
+    cv::resize(decoded, work_image, cv::Size(), work_scale, work_scale,
+               defaultInterpolationFlags());
+
+    cv::detail::ImageFeatures features;
+    cv::detail::computeImageFeatures(_featuresFinder, work_image, features);
+    features.img_idx = index;
+    _features.push_back(features);
+
+    // Match against the neighbours already present, restricted to the same
+    // range as cv::detail::BestOf2NearestRangeMatcher.
+    int first = _config.range_width > 0 ? std::max(0, index - _config.range_width + 1) : 0;
+    for (int i = first; i < index; ++i) {
+        // Force a stable RNG seed for each pair, as cv::detail::FeaturesMatcher.
+        cv::theRNG() = cv::RNG(static_cast<uint64>(index) * (index - 1) / 2 + i);
+
+        cv::detail::MatchesInfo &matches_info = _matches[std::make_pair(i, index)];
+        (*_featuresMatcher)(_features[i], _features[index], matches_info);
+        matches_info.src_img_idx = i;
+        matches_info.dst_img_idx = index;
+    }
+
+    std::stringstream().swap(message);
+    message << "Found " << features.keypoints.size() << " features in image " << index
+            << " and matched them against " << index - first << " images.";
+    _logger->log(logging::Logger::Severity::debug, message, "stitcher");
+}
+
+Stitcher::Report IncrementalOpenCVStitcher::stitch()
+{
+    finish();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_cancelled) {
+            throw std::runtime_error("Stitch cancelled.");
+        }
+    }
+
+    bool incremental = _attempts++ == 0;
+    if (incremental && !_error.empty()) {
+        std::stringstream message;
+        message << "Incremental processing failed, stitching from scratch: " << _error;
+        _logger->log(logging::Logger::Severity::error, message, "stitcher");
+        incremental = false;
+    }
+
+    cv::Mat result, result_mask;
+    Stitcher::Report report;
+
+    try {
+        report = incremental ? stitchIncremental(result, result_mask)
+                             : LowLevelOpenCVStitcher::stitch(result, result_mask);
+    } catch (const std::exception &e) {
+        throw RetriableError(e.what());
+    }
+
+    postprocess(std::move(result), std::move(result_mask), !getComposeCanvas().empty());
+    return report;
+}
+
+Stitcher::Report IncrementalOpenCVStitcher::stitchIncremental(cv::Mat &result,
+                                                              cv::Mat &result_mask)
+{
+    _monitor->changeOperation(monitor::Operation::Start());
+
+    Stitcher::Report report;
+
+    // Images are already loaded and undistorted.
+    SourceImages source_images(_panorama, std::move(_images), _logger);
+    _images.clear();
+
+    if (_debug && _camera && _camera->distortion_model
+        && _camera->distortion_model->enabled()) {
+        debugImages(source_images.images, _debugPath / "undistorted");
+    }
+
+    // Scale images based on available memory.
+    source_images.scaleToAvailableMemory(_parameters.memoryBudgetMB,
+                                         _parameters.maxInputImageSize,
+                                         report.inputSizeMB,
+                                         report.inputScaled);
+
+    // Determine scales for operations.
+    double seam_scale = getSeamScale(source_images);
+    double work_scale = getWorkScale(source_images);
+    double compose_scale = getComposeScale(source_images);
+
+    // Scale images down to the scale the features were found at.
+    source_images.scale(work_scale);
+
+    std::vector<cv::detail::CameraParams> cameras;
+    StitchTemplate stitch_template;
+    bool template_cameras_unchanged = false;
+    bool warm_start = false;
+    if (_findFeatures) {
+        std::vector<cv::detail::MatchesInfo> matches = pairwiseMatches();
+        std::vector<cv::detail::ImageFeatures> features = std::move(_features);
+        _features.clear();
+        _matches.clear();
+
+        debugFeatures(source_images, features);
+
+        // All images are present by now, so a previous stitch of the same
+        // site can be verified against the capture.
+        warm_start = _stitchTemplates
+                && _stitchTemplates->find(_panorama, stitch_template)
+                && adjustTemplateCameraParameters(stitch_template, source_images,
+                                                  features, cameras,
+                                                  template_cameras_unchanged);
+        if (!warm_start) {
+            cameras = estimateCameraParametersFromMatches(source_images, features,
+                                                          matches);
+        }
+    } else {
+        cameras = estimateCameraParametersFromPose(source_images);
+    }
+
+    stitchFromCameras(source_images, cameras, seam_scale, work_scale, compose_scale,
+                      warm_start || !_findFeatures,
+                      warm_start ? &stitch_template : nullptr,
+                      template_cameras_unchanged,
+                      _findFeatures, result, result_mask);
+
+    _monitor->changeOperation(monitor::Operation::Complete());
+
+    return report;
+}
+
+} // namespace stitcher
+} // namespace airmap
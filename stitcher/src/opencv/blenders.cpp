@@ -0,0 +1,573 @@
+#include "airmap/opencv/blenders.h"
+
+#include <opencv2/core/utility.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace airmap {
+namespace stitcher {
+namespace opencv {
+namespace detail {
+
+namespace {
+
+//! Fractional bits of the weights of fed images.
+const int ImageWeightBits = 15;
+//! Fractional bits of the destination weight sums, leaving room for sums up
+//! to 16.
+const int SumWeightBits = 12;
+//! Rows of the destination per strip when collapsing the pyramid.
+const int CollapseStripRows = 64;
+//! Side of the cells, at seam scale, seams are reported in.
+const int SeamRegionCellSize = 8;
+//! Side of the tiles of a seam band blender, which are either blended or
+//! copied as a whole.
+const int SeamBandTileSize = 32;
+//! Minimum side of the blocks of a seam band blender, blended together.
+const int SeamBandMinBlockSize = 256;
+
+inline short saturateShort(int value)
+{
+    return static_cast<short>(std::min(std::max(value, -32768), 32767));
+}
+
+/**
+ * @brief accumulateRow
+ * Add a row of a Laplacian band, weighted by its Q15 weights, to the
+ * destination band and, for the finest band, the weights to the Q12 sums.
+ */
+void accumulateRow(const short *src, const ushort *weights, short *dst,
+                   ushort *dst_weights, int width)
+{
+    const int round = 1 << (ImageWeightBits - 1);
+    for (int x = 0; x < width; ++x) {
+        int weight = weights[x];
+        for (int c = 0; c < 3; ++c) {
+            int weighted = (src[3 * x + c] * weight + round) >> ImageWeightBits;
+            dst[3 * x + c] = saturateShort(dst[3 * x + c] + weighted);
+        }
+    }
+
+    if (dst_weights) {
+        const int shift = ImageWeightBits - SumWeightBits;
+        for (int x = 0; x < width; ++x) {
+            int sum = dst_weights[x] + ((weights[x] + (1 << (shift - 1))) >> shift);
+            dst_weights[x] = static_cast<ushort>(std::min(sum, 65535));
+        }
+    }
+}
+
+/**
+ * @brief normalizeRow
+ * Divide a row of a destination band by its Q12 weight sums.
+ */
+void normalizeRow(short *band, const ushort *weights, int width)
+{
+    for (int x = 0; x < width; ++x) {
+        float inverse = weights[x] > 0
+                ? static_cast<float>(1 << SumWeightBits) / weights[x]
+                : 0.f;
+        for (int c = 0; c < 3; ++c) {
+            band[3 * x + c] = saturateShort(cvRound(band[3 * x + c] * inverse));
+        }
+    }
+}
+
+} // namespace
+
+FixedPointMultiBandBlender::FixedPointMultiBandBlender(int num_bands)
+{
+    setNumBands(num_bands);
+}
+
+int FixedPointMultiBandBlender::numBands() const
+{
+    return _actual_num_bands;
+}
+
+void FixedPointMultiBandBlender::setNumBands(int val)
+{
+    _actual_num_bands = val;
+}
+
+void FixedPointMultiBandBlender::prepare(cv::Rect dst_roi)
+{
+    // Same bands and padding as cv::detail::MultiBandBlender.
+    _dst_roi_final = dst_roi;
+
+    double max_len = static_cast<double>(std::max(dst_roi.width, dst_roi.height));
+    _num_bands = std::min(_actual_num_bands,
+                          static_cast<int>(ceil(std::log(max_len) / std::log(2.0))));
+
+    int alignment = 1 << _num_bands;
+    dst_roi.width += (alignment - dst_roi.width % alignment) % alignment;
+    dst_roi.height += (alignment - dst_roi.height % alignment) % alignment;
+    dst_roi_ = dst_roi;
+
+    _dst_pyr_laplace.resize(static_cast<size_t>(_num_bands) + 1);
+    cv::Size band_size = dst_roi.size();
+    for (auto &band : _dst_pyr_laplace) {
+        band.create(band_size, CV_16SC3);
+        band.setTo(cv::Scalar::all(0));
+        band_size = cv::Size(band_size.width / 2, band_size.height / 2);
+    }
+    _dst_weights.create(dst_roi.size(), CV_16U);
+    _dst_weights.setTo(cv::Scalar::all(0));
+}
+
+void FixedPointMultiBandBlender::feed(cv::InputArray _img, cv::InputArray _mask,
+                                      cv::Point tl)
+{
+    CV_Assert(_img.type() == CV_16SC3 || _img.type() == CV_8UC3);
+    CV_Assert(_mask.type() == CV_8U);
+    cv::Mat img = _img.getMat();
+    cv::Mat mask = _mask.getMat();
+
+    // Keep the source image with a border, aligned so that the scale between
+    // bands is exactly 2, as cv::detail::MultiBandBlender.
+    int alignment = 1 << _num_bands;
+    int gap = 3 * alignment;
+    cv::Point tl_new(std::max(dst_roi_.x, tl.x - gap), std::max(dst_roi_.y, tl.y - gap));
+    cv::Point br_new(std::min(dst_roi_.br().x, tl.x + img.cols + gap),
+                     std::min(dst_roi_.br().y, tl.y + img.rows + gap));
+    tl_new.x = dst_roi_.x + (((tl_new.x - dst_roi_.x) >> _num_bands) << _num_bands);
+    tl_new.y = dst_roi_.y + (((tl_new.y - dst_roi_.y) >> _num_bands) << _num_bands);
+    int width = br_new.x - tl_new.x;
+    int height = br_new.y - tl_new.y;
+    width += (alignment - width % alignment) % alignment;
+    height += (alignment - height % alignment) % alignment;
+    br_new.x = tl_new.x + width;
+    br_new.y = tl_new.y + height;
+    int dx = std::max(br_new.x - dst_roi_.br().x, 0);
+    int dy = std::max(br_new.y - dst_roi_.br().y, 0);
+    tl_new.x -= dx;
+    br_new.x -= dx;
+    tl_new.y -= dy;
+    br_new.y -= dy;
+
+    int top = tl.y - tl_new.y;
+    int left = tl.x - tl_new.x;
+    int bottom = br_new.y - tl.y - img.rows;
+    int right = br_new.x - tl.x - img.cols;
+
+    // Laplacian pyramid of the source image.
+    std::vector<cv::Mat> src_pyr_laplace(static_cast<size_t>(_num_bands) + 1);
+    if (img.type() == CV_8UC3) {
+        cv::Mat img_s;
+        img.convertTo(img_s, CV_16S);
+        cv::copyMakeBorder(img_s, src_pyr_laplace[0], top, bottom, left, right,
+                           cv::BORDER_REFLECT);
+    } else {
+        cv::copyMakeBorder(img, src_pyr_laplace[0], top, bottom, left, right,
+                           cv::BORDER_REFLECT);
+    }
+    for (int i = 0; i < _num_bands; ++i) {
+        cv::pyrDown(src_pyr_laplace[i], src_pyr_laplace[i + 1]);
+    }
+    cv::Mat upsampled;
+    for (int i = 0; i < _num_bands; ++i) {
+        cv::pyrUp(src_pyr_laplace[i + 1], upsampled, src_pyr_laplace[i].size());
+        cv::subtract(src_pyr_laplace[i], upsampled, src_pyr_laplace[i]);
+    }
+    upsampled.release();
+
+    // Gaussian pyramid of the Q15 weights.
+    std::vector<cv::Mat> weight_pyr_gauss(static_cast<size_t>(_num_bands) + 1);
+    cv::Mat weight_map;
+    mask.convertTo(weight_map, CV_16U, static_cast<double>(1 << ImageWeightBits) / 255.);
+    cv::copyMakeBorder(weight_map, weight_pyr_gauss[0], top, bottom, left, right,
+                       cv::BORDER_CONSTANT);
+    weight_map.release();
+    for (int i = 0; i < _num_bands; ++i) {
+        cv::pyrDown(weight_pyr_gauss[i], weight_pyr_gauss[i + 1]);
+    }
+
+    // Accumulate the rows of all bands in a single parallel pass.
+    std::vector<int> first_rows;
+    int total_rows = 0;
+    for (const auto &band : src_pyr_laplace) {
+        first_rows.push_back(total_rows);
+        total_rows += band.rows;
+    }
+    cv::Point offset = tl_new - dst_roi_.tl();
+
+    cv::parallel_for_(cv::Range(0, total_rows), [&](const cv::Range &range) {
+        for (int row = range.start; row < range.end; ++row) {
+            int band = static_cast<int>(
+                    std::upper_bound(first_rows.begin(), first_rows.end(), row)
+                    - first_rows.begin() - 1);
+            int y = row - first_rows[static_cast<size_t>(band)];
+            const cv::Mat &src = src_pyr_laplace[static_cast<size_t>(band)];
+            cv::Mat &dst = _dst_pyr_laplace[static_cast<size_t>(band)];
+            int x_tl = offset.x >> band;
+            int y_tl = offset.y >> band;
+
+            accumulateRow(src.ptr<short>(y),
+                          weight_pyr_gauss[static_cast<size_t>(band)].ptr<ushort>(y),
+                          dst.ptr<short>(y_tl + y) + 3 * x_tl,
+                          band == 0 ? _dst_weights.ptr<ushort>(y_tl + y) + x_tl : nullptr,
+                          src.cols);
+        }
+    });
+}
+
+void FixedPointMultiBandBlender::blend(cv::InputOutputArray dst,
+                                       cv::InputOutputArray dst_mask)
+{
+    // Normalise each band by its weight sums, downsampling the sums of the
+    // finest band as we go.
+    cv::Mat weights = _dst_weights;
+    for (size_t i = 0; i < _dst_pyr_laplace.size(); ++i) {
+        cv::Mat &band = _dst_pyr_laplace[i];
+        if (i > 0) {
+            cv::Mat coarser_weights;
+            cv::pyrDown(weights, coarser_weights, band.size());
+            weights = coarser_weights;
+        }
+        cv::parallel_for_(cv::Range(0, band.rows), [&](const cv::Range &range) {
+            for (int y = range.start; y < range.end; ++y) {
+                normalizeRow(band.ptr<short>(y), weights.ptr<ushort>(y), band.cols);
+            }
+        });
+    }
+    weights.release();
+
+    // Collapse the pyramid, in strips of rows of each finer band.  Each strip
+    // is upsampled from the rows of the coarser band it depends on, one more
+    // on either side, so strips are independent.
+    for (size_t i = _dst_pyr_laplace.size() - 1; i > 0; --i) {
+        const cv::Mat &coarser = _dst_pyr_laplace[i];
+        cv::Mat &finer = _dst_pyr_laplace[i - 1];
+        int strips = (finer.rows + CollapseStripRows - 1) / CollapseStripRows;
+
+        cv::parallel_for_(cv::Range(0, strips), [&](const cv::Range &range) {
+            cv::Mat upsampled;
+            for (int strip = range.start; strip < range.end; ++strip) {
+                int y0 = strip * CollapseStripRows;
+                int y1 = std::min(y0 + CollapseStripRows, finer.rows);
+                int coarser_y0 = std::max(y0 / 2 - 1, 0);
+                int coarser_y1 = std::min(y1 / 2 + 1, coarser.rows);
+
+                cv::Mat coarser_strip = coarser.rowRange(coarser_y0, coarser_y1).clone();
+                cv::pyrUp(coarser_strip, upsampled,
+                          cv::Size(finer.cols, 2 * coarser_strip.rows));
+                cv::Mat finer_strip = finer.rowRange(y0, y1);
+                cv::add(finer_strip,
+                        upsampled.rowRange(y0 - 2 * coarser_y0, y1 - 2 * coarser_y0),
+                        finer_strip);
+            }
+        });
+        _dst_pyr_laplace[i].release();
+    }
+
+    cv::Rect dst_rc(0, 0, _dst_roi_final.width, _dst_roi_final.height);
+    cv::Mat result = _dst_pyr_laplace[0](dst_rc);
+    cv::Mat result_mask;
+    cv::compare(_dst_weights(dst_rc), 0, result_mask, cv::CMP_GT);
+    result.setTo(cv::Scalar::all(0), result_mask == 0);
+
+    _dst_pyr_laplace.clear();
+    _dst_weights.release();
+
+    dst.assign(result);
+    dst_mask.assign(result_mask);
+}
+
+SeamBandBlender::SeamBandBlender(int num_bands)
+    : _halo(0)
+    , _block_tiles(0)
+{
+    setNumBands(num_bands);
+}
+
+int SeamBandBlender::numBands() const
+{
+    return _actual_num_bands;
+}
+
+void SeamBandBlender::setNumBands(int val)
+{
+    _actual_num_bands = val;
+}
+
+void SeamBandBlender::setSeams(const std::vector<cv::Rect> &seams,
+                               const std::vector<cv::Rect> &images)
+{
+    _seams = seams;
+    _images = images;
+    _band_tiles.clear();
+    _band_blocks.clear();
+}
+
+size_t SeamBandBlender::bandTileCount() const
+{
+    return static_cast<size_t>(std::count(_band_tiles.begin(), _band_tiles.end(), true));
+}
+
+cv::Rect SeamBandBlender::tileRect(int tile) const
+{
+    cv::Point tl = dst_roi_.tl()
+            + cv::Point(tile % _tiles.width, tile / _tiles.width) * SeamBandTileSize;
+    return cv::Rect(tl, cv::Size(SeamBandTileSize, SeamBandTileSize)) & dst_roi_;
+}
+
+cv::Rect SeamBandBlender::tileRange(const cv::Rect &rect) const
+{
+    cv::Point first = rect.tl() - dst_roi_.tl();
+    cv::Point last = rect.br() - cv::Point(1, 1) - dst_roi_.tl();
+    return cv::Rect(cv::Point(first.x / SeamBandTileSize, first.y / SeamBandTileSize),
+                    cv::Point(last.x / SeamBandTileSize + 1, last.y / SeamBandTileSize + 1));
+}
+
+void SeamBandBlender::prepare(cv::Rect dst_roi)
+{
+    _dst_roi_final = dst_roi;
+    dst_roi_ = dst_roi;
+
+    double max_len = static_cast<double>(std::max(dst_roi.width, dst_roi.height));
+    _num_bands = std::min(_actual_num_bands,
+                          static_cast<int>(ceil(std::log(max_len) / std::log(2.0))));
+
+    // The blend of a pixel depends on the images within about 2^(bands + 2)
+    // pixels, the same reach strips are composed with.  Blocks are multiples
+    // of the coarsest band, and about twice the reach, which balances the
+    // halos of their pyramids against the pixels they blend.
+    int alignment = 1 << _num_bands;
+    _halo = 4 * alignment;
+    int block_size = std::max(2 * _halo, SeamBandMinBlockSize);
+    _block_tiles = (block_size + SeamBandTileSize - 1) / SeamBandTileSize;
+    _tiles = cv::Size((dst_roi.width + SeamBandTileSize - 1) / SeamBandTileSize,
+                      (dst_roi.height + SeamBandTileSize - 1) / SeamBandTileSize);
+    _blocks = cv::Size((_tiles.width + _block_tiles - 1) / _block_tiles,
+                       (_tiles.height + _block_tiles - 1) / _block_tiles);
+    _band_tiles.clear();
+    _band_blocks.clear();
+
+    _dst.create(dst_roi.size(), CV_16SC3);
+    _dst.setTo(cv::Scalar::all(0));
+    _dst_mask.create(dst_roi.size(), CV_8U);
+    _dst_mask.setTo(cv::Scalar::all(0));
+}
+
+void SeamBandBlender::findBandBlocks()
+{
+    _band_tiles.assign(static_cast<size_t>(_tiles.area()), false);
+    for (const auto &seam : _seams) {
+        cv::Rect reach = cv::Rect(seam.x - _halo, seam.y - _halo, seam.width + 2 * _halo,
+                                  seam.height + 2 * _halo)
+                & dst_roi_;
+        if (reach.empty()) {
+            continue;
+        }
+        cv::Rect tiles = tileRange(reach);
+        for (int y = tiles.y; y < tiles.br().y; ++y) {
+            for (int x = tiles.x; x < tiles.br().x; ++x) {
+                _band_tiles[static_cast<size_t>(y * _tiles.width + x)] = true;
+            }
+        }
+    }
+
+    std::vector<Block> blocks(static_cast<size_t>(_blocks.area()));
+    for (int tile = 0; tile < _tiles.area(); ++tile) {
+        if (!_band_tiles[static_cast<size_t>(tile)]) {
+            continue;
+        }
+        int block = (tile / _tiles.width) / _block_tiles * _blocks.width
+                + (tile % _tiles.width) / _block_tiles;
+        blocks[static_cast<size_t>(block)].tiles.push_back(tile);
+    }
+
+    // Pyramids cover the band tiles of their block and the reach around
+    // them, on the grid of the coarsest band of the whole destination.
+    int alignment = 1 << _num_bands;
+    _band_blocks.clear();
+    for (auto &block : blocks) {
+        if (block.tiles.empty()) {
+            continue;
+        }
+        cv::Rect band = tileRect(block.tiles.front());
+        for (int tile : block.tiles) {
+            band |= tileRect(tile);
+        }
+        cv::Point tl = band.tl() - cv::Point(_halo, _halo) - dst_roi_.tl();
+        cv::Point br = band.br() + cv::Point(_halo, _halo) - dst_roi_.tl();
+        tl = cv::Point(cvFloor(static_cast<double>(tl.x) / alignment) * alignment,
+                       cvFloor(static_cast<double>(tl.y) / alignment) * alignment);
+        br = cv::Point(cvCeil(static_cast<double>(br.x) / alignment) * alignment,
+                       cvCeil(static_cast<double>(br.y) / alignment) * alignment);
+        block.pyramid_rect = cv::Rect(tl + dst_roi_.tl(), br + dst_roi_.tl()) & dst_roi_;
+
+        if (!_images.empty()) {
+            block.pending_images = static_cast<int>(
+                    std::count_if(_images.begin(), _images.end(), [&](const cv::Rect &image) {
+                        return !(image & block.pyramid_rect).empty();
+                    }));
+        }
+        _band_blocks.push_back(std::move(block));
+    }
+}
+
+void SeamBandBlender::blendBlock(Block &block)
+{
+    if (block.blender) {
+        cv::Mat result, result_mask;
+        block.blender->blend(result, result_mask);
+        block.blender.reset();
+
+        // Keep the band tiles only.
+        for (int tile : block.tiles) {
+            cv::Rect tile_rect = tileRect(tile);
+            cv::Rect tile_in_pyramid = tile_rect - block.pyramid_rect.tl();
+            result(tile_in_pyramid).copyTo(_dst(tile_rect - dst_roi_.tl()));
+            result_mask(tile_in_pyramid).copyTo(_dst_mask(tile_rect - dst_roi_.tl()));
+        }
+    }
+    block.blended = true;
+}
+
+void SeamBandBlender::feed(cv::InputArray _img, cv::InputArray _mask, cv::Point tl)
+{
+    CV_Assert(_img.type() == CV_16SC3 || _img.type() == CV_8UC3);
+    CV_Assert(_mask.type() == CV_8U);
+    cv::Mat img = _img.getMat();
+    cv::Mat mask = _mask.getMat();
+    cv::Rect img_rect = cv::Rect(tl, img.size()) & dst_roi_;
+
+    if (_band_tiles.empty()) {
+        findBandBlocks();
+    }
+    if (img_rect.empty()) {
+        return;
+    }
+
+    // Pixels of the other tiles are copied, those of band tiles fed to the
+    // blocks whose pyramid the image overlaps.
+    std::vector<int> copy_tiles;
+    cv::Rect tile_range = tileRange(img_rect);
+    for (int y = tile_range.y; y < tile_range.br().y; ++y) {
+        for (int x = tile_range.x; x < tile_range.br().x; ++x) {
+            int tile = y * _tiles.width + x;
+            if (!_band_tiles[static_cast<size_t>(tile)]) {
+                copy_tiles.push_back(tile);
+            }
+        }
+    }
+    std::vector<Block *> blocks;
+    for (auto &block : _band_blocks) {
+        if (!block.blended && !(block.pyramid_rect & img_rect).empty()) {
+            blocks.push_back(&block);
+        }
+    }
+
+    int job_count = static_cast<int>(copy_tiles.size() + blocks.size());
+    cv::parallel_for_(cv::Range(0, job_count), [&](const cv::Range &range) {
+        for (int k = range.start; k < range.end; ++k) {
+            if (k < static_cast<int>(blocks.size())) {
+                Block &block = *blocks[static_cast<size_t>(k)];
+                if (!block.blender) {
+                    block.blender.reset(new FixedPointMultiBandBlender(_num_bands));
+                    block.blender->prepare(block.pyramid_rect);
+                }
+                cv::Rect rect = block.pyramid_rect & img_rect;
+                block.blender->feed(img(rect - tl), mask(rect - tl), rect.tl());
+
+                // The last image of the block has been fed.
+                if (block.pending_images > 0 && --block.pending_images == 0) {
+                    blendBlock(block);
+                }
+                continue;
+            }
+
+            int tile = copy_tiles[static_cast<size_t>(k) - blocks.size()];
+            cv::Rect rect = tileRect(tile) & img_rect;
+            cv::Mat dst = _dst(rect - dst_roi_.tl());
+            if (img.type() == CV_16SC3) {
+                img(rect - tl).copyTo(dst, mask(rect - tl));
+            } else {
+                cv::Mat img_s;
+                img(rect - tl).convertTo(img_s, CV_16S);
+                img_s.copyTo(dst, mask(rect - tl));
+            }
+            _dst_mask(rect - dst_roi_.tl()).setTo(cv::Scalar::all(255), mask(rect - tl));
+        }
+    });
+}
+
+void SeamBandBlender::blend(cv::InputOutputArray dst, cv::InputOutputArray dst_mask)
+{
+    cv::parallel_for_(cv::Range(0, static_cast<int>(_band_blocks.size())),
+                      [&](const cv::Range &range) {
+                          for (int k = range.start; k < range.end; ++k) {
+                              Block &block = _band_blocks[static_cast<size_t>(k)];
+                              if (!block.blended) {
+                                  blendBlock(block);
+                              }
+                          }
+                      });
+    _band_blocks.clear();
+    _band_tiles.clear();
+
+    _dst.setTo(cv::Scalar::all(0), _dst_mask == 0);
+    dst.assign(_dst);
+    dst_mask.assign(_dst_mask);
+    _dst.release();
+    _dst_mask.release();
+}
+
+std::vector<cv::Rect> findSeamRegions(const std::vector<cv::UMat> &seam_masks,
+                                      const std::vector<cv::Point> &seam_corners,
+                                      const std::vector<cv::Point> &corners,
+                                      const std::vector<cv::Size> &sizes)
+{
+    std::vector<cv::Rect> regions;
+    for (size_t i = 0; i < seam_masks.size(); ++i) {
+        cv::Mat mask_i = seam_masks[i].getMat(cv::ACCESS_READ);
+        cv::Rect rect_i(seam_corners[i], mask_i.size());
+        double scale_x = static_cast<double>(sizes[i].width) / mask_i.cols;
+        double scale_y = static_cast<double>(sizes[i].height) / mask_i.rows;
+        // Corners at both scales aren't exactly proportional.
+        int margin = cvCeil(2. * std::max(scale_x, scale_y));
+
+        for (size_t j = i + 1; j < seam_masks.size(); ++j) {
+            cv::Mat mask_j = seam_masks[j].getMat(cv::ACCESS_READ);
+            cv::Rect overlap = rect_i & cv::Rect(seam_corners[j], mask_j.size());
+            if (overlap.empty()) {
+                continue;
+            }
+
+            // Masks are dilated before blending.
+            cv::Mat dilated_i, dilated_j, seam;
+            cv::dilate(mask_i(overlap - seam_corners[i]), dilated_i, cv::Mat());
+            cv::dilate(mask_j(overlap - seam_corners[j]), dilated_j, cv::Mat());
+            cv::bitwise_and(dilated_i, dilated_j, seam);
+
+            for (int y = 0; y < seam.rows; y += SeamRegionCellSize) {
+                for (int x = 0; x < seam.cols; x += SeamRegionCellSize) {
+                    cv::Rect cell = cv::Rect(x, y, SeamRegionCellSize, SeamRegionCellSize)
+                            & cv::Rect(0, 0, seam.cols, seam.rows);
+                    if (cv::countNonZero(seam(cell)) == 0) {
+                        continue;
+                    }
+
+                    cv::Point tl = cell.tl() + overlap.tl() - seam_corners[i];
+                    cv::Point br = cell.br() + overlap.tl() - seam_corners[i];
+                    regions.push_back(cv::Rect(
+                            corners[i]
+                                    + cv::Point(cvFloor(tl.x * scale_x) - margin,
+                                                cvFloor(tl.y * scale_y) - margin),
+                            corners[i]
+                                    + cv::Point(cvCeil(br.x * scale_x) + margin,
+                                                cvCeil(br.y * scale_y) + margin)));
+                }
+            }
+        }
+    }
+    return regions;
+}
+
+} // namespace detail
+} // namespace opencv
+} // namespace stitcher
+} // namespace airmap
@@ -0,0 +1,480 @@
+#include "airmap/opencv/bundle_adjusters.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include <opencv2/calib3d.hpp>
+#include <opencv2/stitching/detail/util.hpp>
+
+using namespace cv;
+using namespace cv::detail;
+
+namespace airmap {
+namespace stitcher {
+namespace opencv {
+namespace detail {
+
+namespace {
+
+/**
+ * @brief Same differentiation step as cv::detail::BundleAdjusterRay.
+ */
+constexpr double kJacobianStep = 1e-4;
+
+Vec4d cameraParams(const Mat &params, int camera)
+{
+    return Vec4d(params.ptr<double>(camera * 4));
+}
+
+Matx33d rotation(const Vec4d &params)
+{
+    Matx33d R;
+    Rodrigues(Vec3d(params[1], params[2], params[3]), R);
+    return R;
+}
+
+double dot(const std::vector<Vec4d> &a, const std::vector<Vec4d> &b)
+{
+    double result = 0.;
+    for (size_t i = 0; i < a.size(); ++i) {
+        result += a[i].dot(b[i]);
+    }
+    return result;
+}
+
+} // namespace
+
+SparseBundleAdjusterRay::SparseBundleAdjusterRay()
+    : BundleAdjusterBase(4, 3)
+{
+}
+
+void SparseBundleAdjusterRay::setProgressCallback(ProgressCb progressCb)
+{
+    _progressCb = progressCb;
+}
+
+bool SparseBundleAdjusterRay::estimate(
+        const std::vector<ImageFeatures> &features,
+        const std::vector<MatchesInfo> &pairwise_matches,
+        std::vector<CameraParams> &cameras)
+{
+    num_images_ = static_cast<int>(features.size());
+    features_ = &features[0];
+    pairwise_matches_ = &pairwise_matches[0];
+
+    setUpInitialCameraParams(cameras);
+    setUpPairs();
+
+    const int max_iterations = (term_criteria_.type & TermCriteria::COUNT)
+            ? term_criteria_.maxCount
+            : 1000;
+    const double epsilon = (term_criteria_.type & TermCriteria::EPS)
+                    && term_criteria_.epsilon > 0. && term_criteria_.epsilon < 1.
+            ? term_criteria_.epsilon
+            : DBL_EPSILON;
+
+    std::vector<Linearization> linearizations(_pairs.size());
+    std::vector<Matx44d> diagonal(num_images_);
+    std::vector<Matx44d> damped(num_images_);
+    std::vector<Matx44d> off_diagonal(_pairs.size());
+    std::vector<Vec4d> gradient(num_images_);
+    std::vector<Vec4d> step(num_images_);
+
+    double lambda = 1e-3;
+    double current_cost = 0.;
+    double progress = 0.;
+    bool relinearize = true;
+
+    for (int iteration = 0; !_pairs.empty() && iteration < max_iterations;
+         ++iteration) {
+        if (relinearize) {
+            parallel_for_(Range(0, static_cast<int>(_pairs.size())),
+                          [&](const Range &range) {
+                              for (int i = range.start; i < range.end; ++i) {
+                                  linearizations[i] =
+                                          linearize(_pairs[i], cam_params_);
+                              }
+                          });
+
+            // Accumulate in pair order, so that results don't depend on
+            // the number of threads.
+            std::fill(diagonal.begin(), diagonal.end(), Matx44d::zeros());
+            std::fill(gradient.begin(), gradient.end(), Vec4d::all(0.));
+            current_cost = 0.;
+            for (size_t i = 0; i < _pairs.size(); ++i) {
+                const Linearization &linearization = linearizations[i];
+                diagonal[_pairs[i].from] += linearization.from_from;
+                diagonal[_pairs[i].to] += linearization.to_to;
+                off_diagonal[i] = linearization.from_to;
+                gradient[_pairs[i].from] += linearization.gradient_from;
+                gradient[_pairs[i].to] += linearization.gradient_to;
+                current_cost += linearization.cost;
+            }
+            relinearize = false;
+        }
+
+        // Marquardt damping, as in CvLevMarq.  Parameters that don't
+        // contribute to the error (unrefined focal lengths, cameras without
+        // matches) get a unit diagonal, and therefore a zero step.
+        std::vector<Vec4d> rhs(num_images_);
+        for (int i = 0; i < num_images_; ++i) {
+            damped[i] = diagonal[i];
+            for (int k = 0; k < 4; ++k) {
+                double d = diagonal[i](k, k);
+                damped[i](k, k) = d > 0. ? d * (1. + lambda) : 1.;
+            }
+            rhs[i] = -gradient[i];
+        }
+        solve(damped, off_diagonal, rhs, step);
+
+        Mat candidate = cam_params_.clone();
+        for (int i = 0; i < num_images_; ++i) {
+            double *params = candidate.ptr<double>(i * 4);
+            for (int k = 0; k < 4; ++k) {
+                params[k] += step[i][k];
+            }
+        }
+
+        double change = std::sqrt(dot(step, step)) / std::max(norm(cam_params_), DBL_EPSILON);
+        double candidate_cost = cost(candidate);
+        if (candidate_cost < current_cost) {
+            cam_params_ = candidate;
+            lambda = std::max(lambda / 10., 1e-16);
+            relinearize = true;
+        } else {
+            lambda = std::min(lambda * 10., 1e16);
+        }
+
+        if (_progressCb) {
+            // Report the number of converged digits of the step, relative
+            // to the termination criteria.
+            double converged = change > 0. ? std::log(change) / std::log(epsilon) : 1.;
+            progress = std::max(
+                    { progress, std::min(converged, 1.),
+                      static_cast<double>(iteration + 1) / max_iterations });
+            _progressCb(progress);
+        }
+
+        if (change < epsilon) {
+            break;
+        }
+    }
+
+    // Check if all camera parameters are valid
+    for (int i = 0; i < cam_params_.rows; ++i) {
+        if (cvIsNaN(cam_params_.at<double>(i, 0))) {
+            return false;
+        }
+    }
+
+    obtainRefinedCameraParams(cameras);
+
+    // Normalize motion to center image
+    Graph span_tree;
+    std::vector<int> span_tree_centers;
+    findMaxSpanningTree(num_images_, pairwise_matches, span_tree, span_tree_centers);
+    Mat R_inv = cameras[span_tree_centers[0]].R.inv();
+    for (int i = 0; i < num_images_; ++i) {
+        cameras[i].R = R_inv * cameras[i].R;
+    }
+
+    return true;
+}
+
+void SparseBundleAdjusterRay::setUpInitialCameraParams(
+        const std::vector<CameraParams> &cameras)
+{
+    cam_params_.create(num_images_ * 4, 1, CV_64F);
+    SVD svd;
+    for (int i = 0; i < num_images_; ++i) {
+        cam_params_.at<double>(i * 4, 0) = cameras[i].focal;
+
+        Mat R_in;
+        cameras[i].R.convertTo(R_in, CV_64F);
+        svd(R_in, SVD::FULL_UV);
+        Mat R = svd.u * svd.vt;
+        if (determinant(R) < 0) {
+            R *= -1;
+        }
+
+        Mat rvec;
+        Rodrigues(R, rvec);
+        cam_params_.at<double>(i * 4 + 1, 0) = rvec.at<double>(0, 0);
+        cam_params_.at<double>(i * 4 + 2, 0) = rvec.at<double>(1, 0);
+        cam_params_.at<double>(i * 4 + 3, 0) = rvec.at<double>(2, 0);
+    }
+}
+
+void SparseBundleAdjusterRay::obtainRefinedCameraParams(
+        std::vector<CameraParams> &cameras) const
+{
+    for (int i = 0; i < num_images_; ++i) {
+        Mat(rotation(cameraParams(cam_params_, i))).convertTo(cameras[i].R, CV_32F);
+        cameras[i].focal = cam_params_.at<double>(i * 4, 0);
+    }
+}
+
+void SparseBundleAdjusterRay::calcError(Mat &err)
+{
+    err.create(total_num_matches_ * 3, 1, CV_64F);
+    double *data = err.ptr<double>();
+    for (const Pair &pair : _pairs) {
+        pairError(pair, cameraParams(cam_params_, pair.from),
+                  cameraParams(cam_params_, pair.to), data);
+        data += pair.points_from.size() * 3;
+    }
+}
+
+void SparseBundleAdjusterRay::calcJacobian(Mat &jac)
+{
+    jac.create(total_num_matches_ * 3, num_images_ * 4, CV_64F);
+    jac.setTo(0);
+
+    const bool refine_focal = refinement_mask_.at<uchar>(0, 0) != 0;
+    int row = 0;
+    for (const Pair &pair : _pairs) {
+        const int rows = static_cast<int>(pair.points_from.size() * 3);
+        std::vector<double> block(static_cast<size_t>(rows) * 8);
+        pairJacobian(pair, cameraParams(cam_params_, pair.from),
+                     cameraParams(cam_params_, pair.to), refine_focal,
+                     block.data());
+        for (int i = 0; i < rows; ++i) {
+            double *jac_row = jac.ptr<double>(row + i);
+            for (int k = 0; k < 4; ++k) {
+                jac_row[pair.from * 4 + k] = block[i * 8 + k];
+                jac_row[pair.to * 4 + k] = block[i * 8 + 4 + k];
+            }
+        }
+        row += rows;
+    }
+}
+
+void SparseBundleAdjusterRay::setUpPairs()
+{
+    edges_.clear();
+    _pairs.clear();
+    total_num_matches_ = 0;
+
+    // Leave only consistent image pairs
+    for (int i = 0; i < num_images_ - 1; ++i) {
+        for (int j = i + 1; j < num_images_; ++j) {
+            const MatchesInfo &matches_info = pairwise_matches_[i * num_images_ + j];
+            if (matches_info.confidence <= conf_thresh_) {
+                continue;
+            }
+            edges_.push_back(std::make_pair(i, j));
+
+            const ImageFeatures &features1 = features_[i];
+            const ImageFeatures &features2 = features_[j];
+            Point2d center1(features1.img_size.width * 0.5,
+                            features1.img_size.height * 0.5);
+            Point2d center2(features2.img_size.width * 0.5,
+                            features2.img_size.height * 0.5);
+
+            Pair pair;
+            pair.from = i;
+            pair.to = j;
+            pair.points_from.reserve(static_cast<size_t>(matches_info.num_inliers));
+            pair.points_to.reserve(static_cast<size_t>(matches_info.num_inliers));
+            for (size_t k = 0; k < matches_info.matches.size(); ++k) {
+                if (!matches_info.inliers_mask[k]) {
+                    continue;
+                }
+                const DMatch &m = matches_info.matches[k];
+                pair.points_from.push_back(
+                        Point2d(features1.keypoints[m.queryIdx].pt) - center1);
+                pair.points_to.push_back(
+                        Point2d(features2.keypoints[m.trainIdx].pt) - center2);
+            }
+            total_num_matches_ += static_cast<int>(pair.points_from.size());
+            _pairs.push_back(std::move(pair));
+        }
+    }
+}
+
+void SparseBundleAdjusterRay::pairError(const Pair &pair, const Vec4d &params_from,
+                                        const Vec4d &params_to, double *err)
+{
+    const double f1 = params_from[0];
+    const double f2 = params_to[0];
+    const Matx33d R1 = rotation(params_from);
+    const Matx33d R2 = rotation(params_to);
+    const double mult = std::sqrt(f1 * f2);
+
+    for (size_t k = 0; k < pair.points_from.size(); ++k) {
+        const Point2d &p1 = pair.points_from[k];
+        Vec3d x1 = R1 * Vec3d(p1.x / f1, p1.y / f1, 1.);
+        x1 /= norm(x1);
+
+        const Point2d &p2 = pair.points_to[k];
+        Vec3d x2 = R2 * Vec3d(p2.x / f2, p2.y / f2, 1.);
+        x2 /= norm(x2);
+
+        err[k * 3] = mult * (x1[0] - x2[0]);
+        err[k * 3 + 1] = mult * (x1[1] - x2[1]);
+        err[k * 3 + 2] = mult * (x1[2] - x2[2]);
+    }
+}
+
+void SparseBundleAdjusterRay::pairJacobian(const Pair &pair,
+                                           const Vec4d &params_from,
+                                           const Vec4d &params_to,
+                                           bool refine_focal, double *jac)
+{
+    const size_t rows = pair.points_from.size() * 3;
+    std::vector<double> err1(rows);
+    std::vector<double> err2(rows);
+    Vec4d params[2] = { params_from, params_to };
+
+    for (int col = 0; col < 8; ++col) {
+        Vec4d &camera = params[col / 4];
+        const int k = col % 4;
+        if (k == 0 && !refine_focal) {
+            for (size_t i = 0; i < rows; ++i) {
+                jac[i * 8 + col] = 0.;
+            }
+            continue;
+        }
+
+        const double value = camera[k];
+        camera[k] = value - kJacobianStep;
+        pairError(pair, params[0], params[1], err1.data());
+        camera[k] = value + kJacobianStep;
+        pairError(pair, params[0], params[1], err2.data());
+        camera[k] = value;
+
+        for (size_t i = 0; i < rows; ++i) {
+            jac[i * 8 + col] = (err2[i] - err1[i]) / (2. * kJacobianStep);
+        }
+    }
+}
+
+SparseBundleAdjusterRay::Linearization
+SparseBundleAdjusterRay::linearize(const Pair &pair, const Mat &params) const
+{
+    const Vec4d params_from = cameraParams(params, pair.from);
+    const Vec4d params_to = cameraParams(params, pair.to);
+    const size_t rows = pair.points_from.size() * 3;
+
+    std::vector<double> err(rows);
+    std::vector<double> jac(rows * 8);
+    pairError(pair, params_from, params_to, err.data());
+    pairJacobian(pair, params_from, params_to,
+                 refinement_mask_.at<uchar>(0, 0) != 0, jac.data());
+
+    Linearization linearization;
+    linearization.from_from = Matx44d::zeros();
+    linearization.from_to = Matx44d::zeros();
+    linearization.to_to = Matx44d::zeros();
+    linearization.gradient_from = Vec4d::all(0.);
+    linearization.gradient_to = Vec4d::all(0.);
+    linearization.cost = 0.;
+
+    for (size_t i = 0; i < rows; ++i) {
+        const double *j = &jac[i * 8];
+        for (int a = 0; a < 4; ++a) {
+            for (int b = 0; b < 4; ++b) {
+                linearization.from_from(a, b) += j[a] * j[b];
+                linearization.from_to(a, b) += j[a] * j[4 + b];
+                linearization.to_to(a, b) += j[4 + a] * j[4 + b];
+            }
+            linearization.gradient_from[a] += j[a] * err[i];
+            linearization.gradient_to[a] += j[4 + a] * err[i];
+        }
+        linearization.cost += err[i] * err[i];
+    }
+
+    return linearization;
+}
+
+double SparseBundleAdjusterRay::cost(const Mat &params) const
+{
+    std::vector<double> costs(_pairs.size(), 0.);
+    parallel_for_(Range(0, static_cast<int>(_pairs.size())), [&](const Range &range) {
+        std::vector<double> err;
+        for (int i = range.start; i < range.end; ++i) {
+            const Pair &pair = _pairs[i];
+            err.resize(pair.points_from.size() * 3);
+            pairError(pair, cameraParams(params, pair.from),
+                      cameraParams(params, pair.to), err.data());
+            for (double e : err) {
+                costs[i] += e * e;
+            }
+        }
+    });
+
+    double total = 0.;
+    for (double c : costs) {
+        total += c;
+    }
+    return total;
+}
+
+void SparseBundleAdjusterRay::solve(const std::vector<Matx44d> &diagonal,
+                                    const std::vector<Matx44d> &off_diagonal,
+                                    const std::vector<Vec4d> &rhs,
+                                    std::vector<Vec4d> &step) const
+{
+    const size_t num_cameras = diagonal.size();
+
+    std::vector<Matx44d> preconditioner(num_cameras);
+    for (size_t i = 0; i < num_cameras; ++i) {
+        preconditioner[i] = diagonal[i].inv(DECOMP_CHOLESKY);
+    }
+
+    auto multiply = [&](const std::vector<Vec4d> &x, std::vector<Vec4d> &y) {
+        for (size_t i = 0; i < num_cameras; ++i) {
+            y[i] = diagonal[i] * x[i];
+        }
+        for (size_t e = 0; e < _pairs.size(); ++e) {
+            y[_pairs[e].from] += off_diagonal[e] * x[_pairs[e].to];
+            y[_pairs[e].to] += off_diagonal[e].t() * x[_pairs[e].from];
+        }
+    };
+
+    step.assign(num_cameras, Vec4d::all(0.));
+    std::vector<Vec4d> r(rhs);
+    std::vector<Vec4d> z(num_cameras);
+    std::vector<Vec4d> p(num_cameras);
+    std::vector<Vec4d> q(num_cameras);
+
+    for (size_t i = 0; i < num_cameras; ++i) {
+        z[i] = preconditioner[i] * r[i];
+    }
+    p = z;
+    double rz = dot(r, z);
+    const double threshold = 1e-20 * dot(rhs, rhs);
+    const size_t max_iterations = num_cameras * 4;
+
+    for (size_t iteration = 0; iteration < max_iterations; ++iteration) {
+        if (dot(r, r) <= threshold) {
+            break;
+        }
+
+        multiply(p, q);
+        double pq = dot(p, q);
+        if (pq <= 0.) {
+            break;
+        }
+        double alpha = rz / pq;
+        for (size_t i = 0; i < num_cameras; ++i) {
+            step[i] += alpha * p[i];
+            r[i] -= alpha * q[i];
+            z[i] = preconditioner[i] * r[i];
+        }
+
+        double rz_next = dot(r, z);
+        double beta = rz_next / rz;
+        rz = rz_next;
+        for (size_t i = 0; i < num_cameras; ++i) {
+            p[i] = z[i] + beta * p[i];
+        }
+    }
+}
+
+} // namespace detail
+} // namespace opencv
+} // namespace stitcher
+} // namespace airmap
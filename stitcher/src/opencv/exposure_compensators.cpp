@@ -0,0 +1,476 @@
+#include "airmap/opencv/exposure_compensators.h"
+
+#include <opencv2/core/utility.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace airmap {
+namespace stitcher {
+namespace opencv {
+namespace detail {
+
+namespace {
+
+//! Same regularisation as cv::detail::GainCompensator.
+const double GainAlpha = 0.01;
+const double GainBeta = 100;
+
+//! Rows compensated at a time by apply().
+const int ApplyRows = 16;
+
+/**
+ * @brief BlockGrid
+ * The blocks of an image, laid out as by cv::detail::BlocksCompensator.
+ */
+struct BlockGrid
+{
+    cv::Point corner;
+    cv::Size image_size;
+    cv::Size blocks;
+    cv::Size block_size;
+    //! Index of the first block of the image among the blocks of all images.
+    int first;
+
+    BlockGrid(cv::Point corner, cv::Size image_size, int bl_width, int bl_height,
+              int first)
+        : corner(corner)
+        , image_size(image_size)
+        , blocks((image_size.width + bl_width - 1) / bl_width,
+                 (image_size.height + bl_height - 1) / bl_height)
+        , block_size((image_size.width + blocks.width - 1) / blocks.width,
+                     (image_size.height + blocks.height - 1) / blocks.height)
+        , first(first)
+    {
+    }
+
+    cv::Rect rect() const
+    {
+        return cv::Rect(corner, image_size);
+    }
+
+    //! Block (bx, by), relative to the image.
+    cv::Rect block(int bx, int by) const
+    {
+        cv::Point tl(bx * block_size.width, by * block_size.height);
+        cv::Point br(std::min(tl.x + block_size.width, image_size.width),
+                     std::min(tl.y + block_size.height, image_size.height));
+        return cv::Rect(tl, br);
+    }
+
+    //! Blocks overlapping a non-empty region relative to the image, in block
+    //! units.
+    cv::Rect blocksOf(const cv::Rect &region) const
+    {
+        return cv::Rect(cv::Point(region.x / block_size.width,
+                                  region.y / block_size.height),
+                        cv::Point((region.br().x - 1) / block_size.width + 1,
+                                  (region.br().y - 1) / block_size.height + 1));
+    }
+};
+
+/**
+ * @brief BlockOverlap
+ * Overlap statistics of two blocks, as gathered by
+ * cv::detail::GainCompensator.
+ */
+struct BlockOverlap
+{
+    int from;
+    int to;
+    //! Count of pixels valid in both blocks.
+    int count;
+    //! Mean intensity of the valid pixels, in either block.
+    double intensity_from;
+    double intensity_to;
+};
+
+/**
+ * @brief blockOverlaps
+ * Overlap statistics of the blocks of two images.  The blocks of an image
+ * don't overlap each other, so for an image with itself these are the
+ * counts of valid pixels of each block.
+ */
+std::vector<BlockOverlap> blockOverlaps(const BlockGrid &grid_from, const cv::Mat &image_from,
+                                        const cv::Mat &mask_from, uchar mask_value_from,
+                                        const BlockGrid &grid_to, const cv::Mat &image_to,
+                                        const cv::Mat &mask_to, uchar mask_value_to)
+{
+    std::vector<BlockOverlap> overlaps;
+    cv::Rect overlap = grid_from.rect() & grid_to.rect();
+    if (overlap.empty()) {
+        return overlaps;
+    }
+
+    cv::Rect blocks_from = grid_from.blocksOf(overlap - grid_from.corner);
+    for (int by_from = blocks_from.y; by_from < blocks_from.br().y; ++by_from) {
+        for (int bx_from = blocks_from.x; bx_from < blocks_from.br().x; ++bx_from) {
+            cv::Rect block_from = grid_from.block(bx_from, by_from) + grid_from.corner;
+            cv::Rect region = block_from & overlap;
+            cv::Rect blocks_to = grid_to.blocksOf(region - grid_to.corner);
+
+            for (int by_to = blocks_to.y; by_to < blocks_to.br().y; ++by_to) {
+                for (int bx_to = blocks_to.x; bx_to < blocks_to.br().x; ++bx_to) {
+                    cv::Rect block_to = grid_to.block(bx_to, by_to) + grid_to.corner;
+                    cv::Rect roi = block_from & block_to;
+                    if (roi.empty()) {
+                        continue;
+                    }
+
+                    int count = 0;
+                    double sum_from = 0., sum_to = 0.;
+                    cv::Point offset_from = roi.tl() - grid_from.corner;
+                    cv::Point offset_to = roi.tl() - grid_to.corner;
+                    for (int y = 0; y < roi.height; ++y) {
+                        const cv::Vec3b *row_from =
+                                image_from.ptr<cv::Vec3b>(offset_from.y + y) + offset_from.x;
+                        const cv::Vec3b *row_to =
+                                image_to.ptr<cv::Vec3b>(offset_to.y + y) + offset_to.x;
+                        const uchar *valid_from =
+                                mask_from.ptr<uchar>(offset_from.y + y) + offset_from.x;
+                        const uchar *valid_to =
+                                mask_to.ptr<uchar>(offset_to.y + y) + offset_to.x;
+                        for (int x = 0; x < roi.width; ++x) {
+                            if (valid_from[x] == mask_value_from
+                                && valid_to[x] == mask_value_to) {
+                                ++count;
+                                sum_from += cv::norm(row_from[x]);
+                                sum_to += cv::norm(row_to[x]);
+                            }
+                        }
+                    }
+
+                    BlockOverlap block_overlap;
+                    block_overlap.from = grid_from.first
+                            + by_from * grid_from.blocks.width + bx_from;
+                    block_overlap.to = grid_to.first + by_to * grid_to.blocks.width + bx_to;
+                    block_overlap.count = count;
+                    block_overlap.intensity_from = count > 0 ? sum_from / count : 0.;
+                    block_overlap.intensity_to = count > 0 ? sum_to / count : 0.;
+                    overlaps.push_back(block_overlap);
+                }
+            }
+        }
+    }
+    return overlaps;
+}
+
+/**
+ * @brief solveGains
+ * Solve the normal equations of cv::detail::GainCompensator for the blocks
+ * that overlap another image, by conjugate gradients.  The others keep a
+ * gain of 1.
+ */
+std::vector<double> solveGains(const std::vector<BlockOverlap> &overlaps,
+                               const std::vector<bool> &skip,
+                               const std::vector<double> &previous_gains)
+{
+    size_t block_count = skip.size();
+    std::vector<double> diagonal(block_count, 0.), b(block_count, 0.);
+    std::vector<std::vector<std::pair<size_t, double>>> off_diagonal(block_count);
+
+    for (const auto &overlap : overlaps) {
+        size_t from = static_cast<size_t>(overlap.from);
+        size_t to = static_cast<size_t>(overlap.to);
+        if (skip[from] || skip[to]) {
+            continue;
+        }
+
+        // Overlapping blocks count as overlapping by at least a pixel.
+        double n = std::max(1, overlap.count);
+        if (from == to) {
+            diagonal[from] += GainBeta * n;
+            b[from] += GainBeta * n;
+            continue;
+        }
+
+        double intensity_from = overlap.intensity_from * previous_gains[from];
+        double intensity_to = overlap.intensity_to * previous_gains[to];
+        diagonal[from] += GainBeta * n + 2 * GainAlpha * intensity_from * intensity_from * n;
+        diagonal[to] += GainBeta * n + 2 * GainAlpha * intensity_to * intensity_to * n;
+        b[from] += GainBeta * n;
+        b[to] += GainBeta * n;
+        double coupling = -2 * GainAlpha * intensity_from * intensity_to * n;
+        off_diagonal[from].push_back(std::make_pair(to, coupling));
+        off_diagonal[to].push_back(std::make_pair(from, coupling));
+    }
+
+    auto multiply = [&](const std::vector<double> &x, std::vector<double> &y) {
+        for (size_t k = 0; k < block_count; ++k) {
+            double sum = diagonal[k] * x[k];
+            for (const auto &entry : off_diagonal[k]) {
+                sum += entry.second * x[entry.first];
+            }
+            y[k] = sum;
+        }
+    };
+    auto dot = [&](const std::vector<double> &x, const std::vector<double> &y) {
+        double sum = 0.;
+        for (size_t k = 0; k < block_count; ++k) {
+            sum += x[k] * y[k];
+        }
+        return sum;
+    };
+
+    // Skipped blocks have empty rows, and are left at 1.
+    std::vector<double> gains(block_count, 1.);
+    std::vector<double> r(block_count), z(block_count), p(block_count), q(block_count);
+    multiply(gains, q);
+    for (size_t k = 0; k < block_count; ++k) {
+        r[k] = skip[k] ? 0. : b[k] - q[k];
+        z[k] = skip[k] ? 0. : r[k] / diagonal[k];
+    }
+    p = z;
+    double rz = dot(r, z);
+    double threshold = 1e-24 * std::max(dot(b, b), 1.);
+
+    for (size_t iteration = 0; iteration < block_count && dot(r, r) > threshold;
+         ++iteration) {
+        multiply(p, q);
+        double pq = dot(p, q);
+        if (pq <= 0.) {
+            break;
+        }
+        double step = rz / pq;
+        for (size_t k = 0; k < block_count; ++k) {
+            gains[k] += step * p[k];
+            r[k] -= step * q[k];
+            z[k] = skip[k] ? 0. : r[k] / diagonal[k];
+        }
+        double next_rz = dot(r, z);
+        for (size_t k = 0; k < block_count; ++k) {
+            p[k] = z[k] + next_rz / rz * p[k];
+        }
+        rz = next_rz;
+    }
+
+    return gains;
+}
+
+} // namespace
+
+ParallelBlocksGainCompensator::ParallelBlocksGainCompensator(int bl_width, int bl_height,
+                                                             int nr_feeds)
+    : _bl_width(bl_width)
+    , _bl_height(bl_height)
+    , _nr_feeds(nr_feeds)
+    , _nr_gain_filtering_iterations(2)
+{
+}
+
+void ParallelBlocksGainCompensator::feed(
+        const std::vector<cv::Point> &corners, const std::vector<cv::UMat> &images,
+        const std::vector<std::pair<cv::UMat, uchar>> &masks)
+{
+    CV_Assert(corners.size() == images.size() && images.size() == masks.size());
+    if (!getUpdateGain() && !_gain_maps.empty()) {
+        return;
+    }
+
+    size_t num_images = images.size();
+    std::vector<BlockGrid> grids;
+    std::vector<cv::Mat> image_mats, mask_mats;
+    int block_count = 0;
+    for (size_t i = 0; i < num_images; ++i) {
+        CV_Assert(images[i].type() == CV_8UC3);
+        grids.push_back(BlockGrid(corners[i], images[i].size(), _bl_width, _bl_height,
+                                  block_count));
+        block_count += grids.back().blocks.area();
+        image_mats.push_back(images[i].getMat(cv::ACCESS_READ));
+        mask_mats.push_back(masks[i].first.getMat(cv::ACCESS_READ));
+    }
+
+    // Gather overlap statistics per pair of overlapping images, including
+    // each image with itself.
+    std::vector<std::pair<size_t, size_t>> image_pairs;
+    for (size_t i = 0; i < num_images; ++i) {
+        for (size_t j = i; j < num_images; ++j) {
+            if (!(grids[i].rect() & grids[j].rect()).empty()) {
+                image_pairs.push_back(std::make_pair(i, j));
+            }
+        }
+    }
+
+    std::vector<std::vector<BlockOverlap>> pair_overlaps(image_pairs.size());
+    cv::parallel_for_(cv::Range(0, static_cast<int>(image_pairs.size())),
+                      [&](const cv::Range &range) {
+        for (int p = range.start; p < range.end; ++p) {
+            size_t i = image_pairs[static_cast<size_t>(p)].first;
+            size_t j = image_pairs[static_cast<size_t>(p)].second;
+            pair_overlaps[static_cast<size_t>(p)] =
+                    blockOverlaps(grids[i], image_mats[i], mask_mats[i], masks[i].second,
+                                  grids[j], image_mats[j], mask_mats[j], masks[j].second);
+        }
+    });
+
+    std::vector<BlockOverlap> overlaps;
+    std::vector<bool> skip(static_cast<size_t>(block_count), true);
+    for (const auto &block_overlaps : pair_overlaps) {
+        for (const auto &overlap : block_overlaps) {
+            // Blocks are solved for if they overlap a block of another image.
+            if (overlap.from != overlap.to && overlap.count > 0) {
+                skip[static_cast<size_t>(overlap.from)] = false;
+                skip[static_cast<size_t>(overlap.to)] = false;
+            }
+            overlaps.push_back(overlap);
+        }
+    }
+    pair_overlaps.clear();
+
+    std::vector<double> gains(static_cast<size_t>(block_count), 1.);
+    for (int n = 0; n < _nr_feeds; ++n) {
+        std::vector<double> feed_gains = solveGains(overlaps, skip, gains);
+        for (size_t k = 0; k < gains.size(); ++k) {
+            gains[k] *= feed_gains[k];
+        }
+    }
+
+    // Same smoothing as cv::detail::BlocksCompensator.
+    cv::Mat_<float> kernel(1, 3);
+    kernel(0, 0) = 0.25f;
+    kernel(0, 1) = 0.5f;
+    kernel(0, 2) = 0.25f;
+
+    _gain_maps.clear();
+    for (const auto &grid : grids) {
+        cv::Mat_<float> gain_map(grid.blocks);
+        for (int by = 0; by < grid.blocks.height; ++by) {
+            for (int bx = 0; bx < grid.blocks.width; ++bx) {
+                gain_map(by, bx) = static_cast<float>(
+                        gains[static_cast<size_t>(grid.first + by * grid.blocks.width + bx)]);
+            }
+        }
+        for (int i = 0; i < _nr_gain_filtering_iterations; ++i) {
+            cv::sepFilter2D(gain_map, gain_map, CV_32F, kernel, kernel);
+        }
+        _gain_maps.push_back(gain_map);
+    }
+}
+
+void ParallelBlocksGainCompensator::apply(int index, cv::Point /*corner*/,
+                                          cv::InputOutputArray image,
+                                          cv::InputArray /*mask*/)
+{
+    CV_Assert(image.type() == CV_8UC3);
+
+    cv::UMat image_umat;
+    cv::Mat image_mat;
+    if (image.isUMat()) {
+        image_umat = image.getUMat();
+        image_mat = image_umat.getMat(cv::ACCESS_RW);
+    } else {
+        image_mat = image.getMat();
+    }
+
+    int strips = (image_mat.rows + ApplyRows - 1) / ApplyRows;
+    cv::parallel_for_(cv::Range(0, strips), [&](const cv::Range &range) {
+        for (int strip = range.start; strip < range.end; ++strip) {
+            int first_row = strip * ApplyRows;
+            cv::Mat rows = image_mat.rowRange(first_row,
+                                              std::min(first_row + ApplyRows, image_mat.rows));
+            applyRows(index, image_mat.size(), first_row, rows);
+        }
+    });
+}
+
+void ParallelBlocksGainCompensator::applyRows(int index, cv::Size image_size,
+                                              int first_row, cv::Mat &rows) const
+{
+    CV_Assert(rows.type() == CV_8UC3 && rows.cols == image_size.width);
+    const cv::Mat &gain_map = _gain_maps.at(static_cast<size_t>(index));
+
+    // Bilinear interpolation of the gain map, with the sampling and borders
+    // of cv::resize with INTER_LINEAR.
+    auto sample = [](int dst, int dst_size, int src_size, int &src0, int &src1,
+                     float &weight) {
+        float src = (static_cast<float>(dst) + 0.5f) * src_size / dst_size - 0.5f;
+        src0 = cvFloor(src);
+        weight = src - static_cast<float>(src0);
+        if (src0 < 0) {
+            src0 = 0;
+            weight = 0.f;
+        }
+        if (src0 >= src_size - 1) {
+            src0 = src_size - 1;
+            weight = 0.f;
+        }
+        src1 = std::min(src0 + 1, src_size - 1);
+    };
+
+    int width = image_size.width;
+    std::vector<int> x0(static_cast<size_t>(width)), x1(static_cast<size_t>(width));
+    std::vector<float> wx(static_cast<size_t>(width));
+    for (int x = 0; x < width; ++x) {
+        sample(x, width, gain_map.cols, x0[x], x1[x], wx[x]);
+    }
+
+    std::vector<float> row_gains(static_cast<size_t>(gain_map.cols));
+    for (int r = 0; r < rows.rows; ++r) {
+        int y0, y1;
+        float wy;
+        sample(first_row + r, image_size.height, gain_map.rows, y0, y1, wy);
+        const float *gains0 = gain_map.ptr<float>(y0);
+        const float *gains1 = gain_map.ptr<float>(y1);
+        for (int bx = 0; bx < gain_map.cols; ++bx) {
+            row_gains[bx] = gains0[bx] * (1.f - wy) + gains1[bx] * wy;
+        }
+
+        uchar *pixels = rows.ptr<uchar>(r);
+        for (int x = 0; x < width; ++x) {
+            float gain = row_gains[x0[x]] * (1.f - wx[x]) + row_gains[x1[x]] * wx[x];
+            for (int c = 0; c < 3; ++c) {
+                pixels[3 * x + c] = cv::saturate_cast<uchar>(pixels[3 * x + c] * gain);
+            }
+        }
+    }
+}
+
+void ParallelBlocksGainCompensator::getMatGains(std::vector<cv::Mat> &umv)
+{
+    umv.clear();
+    for (const auto &gain_map : _gain_maps) {
+        umv.push_back(gain_map.clone());
+    }
+}
+
+void ParallelBlocksGainCompensator::setMatGains(std::vector<cv::Mat> &umv)
+{
+    _gain_maps.clear();
+    for (const auto &gain_map : umv) {
+        cv::Mat gain_map_f;
+        gain_map.convertTo(gain_map_f, CV_32F);
+        _gain_maps.push_back(gain_map_f);
+    }
+}
+
+void ParallelBlocksGainCompensator::setNrFeeds(int nr_feeds)
+{
+    _nr_feeds = nr_feeds;
+}
+
+int ParallelBlocksGainCompensator::getNrFeeds() const
+{
+    return _nr_feeds;
+}
+
+void ParallelBlocksGainCompensator::setBlockSize(int width, int height)
+{
+    _bl_width = width;
+    _bl_height = height;
+}
+
+void ParallelBlocksGainCompensator::setNrGainsFilteringIterations(int nr_iterations)
+{
+    _nr_gain_filtering_iterations = nr_iterations;
+}
+
+int ParallelBlocksGainCompensator::getNrGainsFilteringIterations() const
+{
+    return _nr_gain_filtering_iterations;
+}
+
+} // namespace detail
+} // namespace opencv
+} // namespace stitcher
+} // namespace airmap
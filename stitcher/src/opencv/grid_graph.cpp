@@ -0,0 +1,344 @@
+#include "airmap/opencv/grid_graph.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+namespace airmap {
+namespace stitcher {
+namespace opencv {
+namespace detail {
+
+namespace {
+
+const signed char Terminal = -1;
+const signed char Orphan = -2;
+const int Unqueued = -1;
+
+int opposite(int direction)
+{
+    return 3 - direction;
+}
+
+} // namespace
+
+void GridGraph::create(cv::Size size)
+{
+    CV_Assert(size.width > 0 && size.height > 0);
+    _size = size;
+    _flow = 0.f;
+
+    size_t vertex_count = static_cast<size_t>(size.area());
+    for (auto &capacities : _capacities) {
+        capacities.assign(vertex_count, 0.f);
+    }
+    _weights.assign(vertex_count, 0.f);
+    _parents.resize(vertex_count);
+    _trees.resize(vertex_count);
+    _timestamps.resize(vertex_count);
+    _distances.resize(vertex_count);
+    _next.resize(vertex_count + 1);
+    _orphans.clear();
+}
+
+void GridGraph::addTermWeights(int v, float source_weight, float sink_weight)
+{
+    float dw = _weights[v];
+    if (dw > 0) {
+        source_weight += dw;
+    } else {
+        sink_weight -= dw;
+    }
+    _flow += (source_weight < sink_weight) ? source_weight : sink_weight;
+    _weights[v] = source_weight - sink_weight;
+}
+
+void GridGraph::setEdgeWeights(const cv::Mat &horizontal, const cv::Mat &vertical)
+{
+    CV_Assert(horizontal.type() == CV_32F && vertical.type() == CV_32F);
+    CV_Assert(horizontal.size() == _size && vertical.size() == _size);
+
+    const int width = _size.width;
+    for (int y = 0; y < _size.height; ++y) {
+        const float *horizontal_row = horizontal.ptr<float>(y);
+        const float *vertical_row = vertical.ptr<float>(y);
+        int row = y * width;
+        for (int x = 0; x < width - 1; ++x) {
+            _capacities[Right][row + x] = horizontal_row[x];
+            _capacities[Left][row + x + 1] = horizontal_row[x];
+        }
+        if (y < _size.height - 1) {
+            std::copy(vertical_row, vertical_row + width, &_capacities[Down][row]);
+            std::copy(vertical_row, vertical_row + width, &_capacities[Up][row + width]);
+        }
+    }
+}
+
+int GridGraph::neighbour(int v, int direction) const
+{
+    switch (direction) {
+    case Down:
+        return v + _size.width;
+    case Right:
+        return v + 1;
+    case Left:
+        return v - 1;
+    default:
+        return v - _size.width;
+    }
+}
+
+bool GridGraph::hasNeighbour(int v, int direction) const
+{
+    switch (direction) {
+    case Down:
+        return v < (_size.height - 1) * _size.width;
+    case Right:
+        return v % _size.width < _size.width - 1;
+    case Left:
+        return v % _size.width > 0;
+    default:
+        return v >= _size.width;
+    }
+}
+
+float GridGraph::maxFlow()
+{
+    // Edges from a vertex are visited down, right, left and up: the order of
+    // the adjacency list of a GCGraph built row by row, right then down.
+    const int vertex_count = _size.area();
+    const int nil = vertex_count;
+    int first = nil, last = nil;
+    int curr_ts = 0;
+    _next[nil] = nil;
+
+    // initialize the active queue and the graph vertices
+    for (int i = 0; i < vertex_count; ++i) {
+        _timestamps[i] = 0;
+        _trees[i] = 0;
+        _distances[i] = 0;
+        _next[i] = Unqueued;
+        if (_weights[i] != 0) {
+            _next[last] = i;
+            last = i;
+            _distances[i] = 1;
+            _parents[i] = Terminal;
+            _trees[i] = _weights[i] < 0;
+        } else {
+            _parents[i] = 0;
+        }
+    }
+    first = _next[nil];
+    _next[last] = nil;
+    _next[nil] = Unqueued;
+
+    // residual capacity of the edge from v in direction d, away from the
+    // root of the tree t
+    auto residual = [this](int v, int d, int u, unsigned char t) {
+        return t == 0 ? _capacities[d][v] : _capacities[opposite(d)][u];
+    };
+    auto enqueue = [&](int u) {
+        _next[u] = nil;
+        _next[last] = u;
+        last = u;
+    };
+
+    // run the search-path -> augment-graph -> restore-trees loop
+    for (;;) {
+        // edge from the source tree to the sink tree
+        int e0_from = -1, e0_dir = -1;
+
+        // grow S & T search trees, find an edge connecting them
+        while (first != nil) {
+            int v = first;
+            if (_parents[v]) {
+                unsigned char vt = _trees[v];
+                for (int d = 0; d < Directions; ++d) {
+                    if (!hasNeighbour(v, d)) {
+                        continue;
+                    }
+                    int u = neighbour(v, d);
+                    if (residual(v, d, u, vt) == 0) {
+                        continue;
+                    }
+                    if (!_parents[u]) {
+                        _trees[u] = vt;
+                        _parents[u] = static_cast<signed char>(opposite(d) + 1);
+                        _timestamps[u] = _timestamps[v];
+                        _distances[u] = _distances[v] + 1;
+                        if (_next[u] == Unqueued) {
+                            enqueue(u);
+                        }
+                        continue;
+                    }
+
+                    if (_trees[u] != vt) {
+                        e0_from = vt == 0 ? v : u;
+                        e0_dir = vt == 0 ? d : opposite(d);
+                        break;
+                    }
+
+                    if (_distances[u] > _distances[v] + 1 && _timestamps[u] <= _timestamps[v]) {
+                        // reassign the parent
+                        _parents[u] = static_cast<signed char>(opposite(d) + 1);
+                        _timestamps[u] = _timestamps[v];
+                        _distances[u] = _distances[v] + 1;
+                    }
+                }
+                if (e0_from >= 0) {
+                    break;
+                }
+            }
+            // exclude the vertex from the active list
+            first = _next[v];
+            _next[v] = Unqueued;
+        }
+
+        if (e0_from < 0) {
+            break;
+        }
+        int e0_to = neighbour(e0_from, e0_dir);
+
+        // find the minimum edge weight along the path
+        float min_weight = _capacities[e0_dir][e0_from];
+        CV_Assert(min_weight > 0);
+        // k = 1: source tree, k = 0: destination tree
+        for (int k = 1; k >= 0; --k) {
+            int v = k ? e0_from : e0_to;
+            while (_parents[v] > 0) {
+                int d = _parents[v] - 1;
+                int p = neighbour(v, d);
+                float weight = k ? _capacities[opposite(d)][p] : _capacities[d][v];
+                min_weight = std::min(min_weight, weight);
+                CV_Assert(min_weight > 0);
+                v = p;
+            }
+            min_weight = std::min(min_weight, std::fabs(_weights[v]));
+            CV_Assert(min_weight > 0);
+        }
+
+        // modify weights of the edges along the path and collect orphans
+        _capacities[e0_dir][e0_from] -= min_weight;
+        _capacities[opposite(e0_dir)][e0_to] += min_weight;
+        _flow += min_weight;
+
+        // k = 1: source tree, k = 0: destination tree
+        for (int k = 1; k >= 0; --k) {
+            int v = k ? e0_from : e0_to;
+            while (_parents[v] > 0) {
+                int d = _parents[v] - 1;
+                int p = neighbour(v, d);
+                float &towards_root = k ? _capacities[d][v] : _capacities[opposite(d)][p];
+                float &from_root = k ? _capacities[opposite(d)][p] : _capacities[d][v];
+                towards_root += min_weight;
+                if ((from_root -= min_weight) == 0) {
+                    _orphans.push_back(v);
+                    _parents[v] = Orphan;
+                }
+                v = p;
+            }
+
+            _weights[v] = _weights[v] + min_weight * (1 - k * 2);
+            if (_weights[v] == 0) {
+                _orphans.push_back(v);
+                _parents[v] = Orphan;
+            }
+        }
+
+        // restore the search trees by finding new parents for the orphans
+        curr_ts++;
+        while (!_orphans.empty()) {
+            int v2 = _orphans.back();
+            _orphans.pop_back();
+
+            int min_dist = INT_MAX;
+            int e0 = -1;
+            unsigned char vt = _trees[v2];
+
+            for (int d = 0; d < Directions; ++d) {
+                if (!hasNeighbour(v2, d)) {
+                    continue;
+                }
+                int u = neighbour(v2, d);
+                if (residual(u, opposite(d), v2, vt) == 0) {
+                    continue;
+                }
+                if (_trees[u] != vt || _parents[u] == 0) {
+                    continue;
+                }
+                // compute the distance to the tree root
+                int dist = 0;
+                for (int w = u;;) {
+                    if (_timestamps[w] == curr_ts) {
+                        dist += _distances[w];
+                        break;
+                    }
+                    int ej = _parents[w];
+                    dist++;
+                    if (ej < 0) {
+                        if (ej == Orphan) {
+                            dist = INT_MAX - 1;
+                        } else {
+                            _timestamps[w] = curr_ts;
+                            _distances[w] = 1;
+                        }
+                        break;
+                    }
+                    w = neighbour(w, ej - 1);
+                }
+
+                // update the distance
+                if (++dist < INT_MAX) {
+                    if (dist < min_dist) {
+                        min_dist = dist;
+                        e0 = d;
+                    }
+                    for (int w = u; _timestamps[w] != curr_ts;
+                         w = neighbour(w, _parents[w] - 1)) {
+                        _timestamps[w] = curr_ts;
+                        _distances[w] = --dist;
+                    }
+                }
+            }
+
+            if (e0 >= 0) {
+                _parents[v2] = static_cast<signed char>(e0 + 1);
+                _timestamps[v2] = curr_ts;
+                _distances[v2] = min_dist;
+                continue;
+            }
+
+            /* no parent is found */
+            _parents[v2] = 0;
+            _timestamps[v2] = 0;
+            for (int d = 0; d < Directions; ++d) {
+                if (!hasNeighbour(v2, d)) {
+                    continue;
+                }
+                int u = neighbour(v2, d);
+                int ej = _parents[u];
+                if (_trees[u] != vt || !ej) {
+                    continue;
+                }
+                if (residual(u, opposite(d), v2, vt) && _next[u] == Unqueued) {
+                    enqueue(u);
+                }
+                if (ej > 0 && neighbour(u, ej - 1) == v2) {
+                    _orphans.push_back(u);
+                    _parents[u] = Orphan;
+                }
+            }
+        }
+    }
+    return _flow;
+}
+
+bool GridGraph::inSourceSegment(int v) const
+{
+    return _trees[v] == 0;
+}
+
+} // namespace detail
+} // namespace opencv
+} // namespace stitcher
+} // namespace airmap
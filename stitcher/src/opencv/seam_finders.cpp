@@ -1,6 +1,12 @@
 #include "airmap/opencv/seam_finders.h"
 
-#include <opencv2/imgproc/detail/gcgraph.hpp>
+#include "airmap/opencv/grid_graph.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+
+#include <opencv2/imgproc.hpp>
 #include <opencv2/stitching.hpp>
 
 using namespace cv;
@@ -11,263 +17,792 @@ namespace stitcher {
 namespace opencv {
 namespace detail {
 
-class MonitoredGraphCutSeamFinder::Impl
-    : public cv::detail::PairwiseSeamFinder {
+namespace {
+
+/**
+ * @brief cutWindow
+ * Cut a window of an image, with zeros outside of the image.
+ * @param img Image.
+ * @param offset Top left corner of the window in the image.
+ * @param size Size of the window.
+ * @param depth Depth of the window, converted from the depth of the image.
+ * @param window Window.
+ */
+void cutWindow(const Mat &img, Point offset, Size size, int depth, Mat &window)
+{
+    window.create(size, CV_MAKETYPE(depth, img.channels()));
+    window.setTo(Scalar::all(0));
+    Rect inside = Rect(offset, size) & Rect(Point(), img.size());
+    if (inside.empty()) {
+        return;
+    }
+    Mat window_inside = window(inside - offset);
+    img(inside).convertTo(window_inside, depth);
+}
+
+/**
+ * @brief colorDifferences
+ * Squared distances between the colors of two images, as normL2.
+ * @param img1 CV_32FC3 image.
+ * @param img2 CV_32FC3 image.
+ * @return CV_32F distances.
+ */
+Mat colorDifferences(const Mat &img1, const Mat &img2)
+{
+    Mat differences(img1.size(), CV_32F);
+    for (int y = 0; y < img1.rows; ++y) {
+        const float *row1 = img1.ptr<float>(y);
+        const float *row2 = img2.ptr<float>(y);
+        float *differences_row = differences.ptr<float>(y);
+        for (int x = 0; x < img1.cols; ++x) {
+            float d0 = row1[3 * x] - row2[3 * x];
+            float d1 = row1[3 * x + 1] - row2[3 * x + 1];
+            float d2 = row1[3 * x + 2] - row2[3 * x + 2];
+            differences_row[x] = d0 * d0 + d1 * d1 + d2 * d2;
+        }
+    }
+    return differences;
+}
+
+/**
+ * @brief addTerminalWeights
+ * Tie the vertex of each pixel to the source where the first mask is set,
+ * and to the sink where the second one is.
+ */
+void addTerminalWeights(const Mat &mask1, const Mat &mask2, float terminal_cost,
+                        GridGraph &graph)
+{
+    for (int y = 0; y < mask1.rows; ++y) {
+        const uchar *mask1_row = mask1.ptr<uchar>(y);
+        const uchar *mask2_row = mask2.ptr<uchar>(y);
+        int v = y * mask1.cols;
+        for (int x = 0; x < mask1.cols; ++x, ++v) {
+            graph.addTermWeights(v, mask1_row[x] ? terminal_cost : 0.f,
+                                 mask2_row[x] ? terminal_cost : 0.f);
+        }
+    }
+}
+
+/**
+ * @brief colorEdgeWeights
+ * Weights of n edges between pixels a and b, where a and b are consecutive
+ * pixels of a row, or pixels of consecutive rows.
+ * @param diff_a Color differences at a.
+ * @param diff_b Color differences at b.
+ * @param valid_a Whether both masks are set at a.
+ * @param valid_b Whether both masks are set at b.
+ * @param weights Weights of the edges.
+ */
+void colorEdgeWeights(const float *diff_a, const float *diff_b, const uchar *valid_a,
+                      const uchar *valid_b, int n, float weight_eps,
+                      float bad_region_penalty, float *weights)
+{
+    for (int x = 0; x < n; ++x) {
+        float penalty = (valid_a[x] & valid_b[x]) ? 0.f : bad_region_penalty;
+        weights[x] = diff_a[x] + diff_b[x] + weight_eps + penalty;
+    }
+}
+
+/**
+ * @brief colorGradEdgeWeights
+ * Weights of n edges between pixels a and b, as colorEdgeWeights, with
+ * color differences divided by the gradients of both images.
+ */
+void colorGradEdgeWeights(const float *diff_a, const float *diff_b,
+                          const float *grad1_a, const float *grad1_b,
+                          const float *grad2_a, const float *grad2_b,
+                          const uchar *valid_a, const uchar *valid_b, int n,
+                          float weight_eps, float bad_region_penalty, float *weights)
+{
+    for (int x = 0; x < n; ++x) {
+        float grad = grad1_a[x] + grad1_b[x] + grad2_a[x] + grad2_b[x] + weight_eps;
+        float penalty = (valid_a[x] & valid_b[x]) ? 0.f : bad_region_penalty;
+        weights[x] = (diff_a[x] + diff_b[x]) / grad + weight_eps + penalty;
+    }
+}
+
+//! Rows of an image whose gradients are computed at a time.
+const int GradientRows = 32;
+
+/**
+ * @brief gradientRows
+ * Squared magnitudes of the horizontal and vertical 3x3 Sobel gradients of
+ * some rows of a 3 channel image, as normL2, with the default border of
+ * Sobel.
+ * @param src CV_8UC3 or CV_32FC3 image.
+ * @param rows Rows to compute the gradients of.
+ * @param dx CV_32F horizontal gradients of the image.
+ * @param dy CV_32F vertical gradients of the image.
+ */
+template <typename T>
+void gradientRows(const Mat &src, Range rows, Mat &dx, Mat &dy)
+{
+    const int width = src.cols;
+    auto border = [](int i, int size) {
+        return size == 1 ? 0 : i < 0 ? 1 : i >= size ? size - 2 : i;
+    };
+
+    for (int y = rows.start; y < rows.end; ++y) {
+        const T *r0 = src.ptr<T>(border(y - 1, src.rows));
+        const T *r1 = src.ptr<T>(y);
+        const T *r2 = src.ptr<T>(border(y + 1, src.rows));
+        float *dx_row = dx.ptr<float>(y);
+        float *dy_row = dy.ptr<float>(y);
+
+        auto gradient = [&](int xl, int x, int xr) {
+            float dx_norm = 0.f, dy_norm = 0.f;
+            for (int c = 0; c < 3; ++c) {
+                int l = 3 * xl + c, m = 3 * x + c, r = 3 * xr + c;
+                float gx = static_cast<float>(r0[r]) - static_cast<float>(r0[l])
+                           + 2.f * (static_cast<float>(r1[r]) - static_cast<float>(r1[l]))
+                           + static_cast<float>(r2[r]) - static_cast<float>(r2[l]);
+                float gy = static_cast<float>(r2[l]) + 2.f * static_cast<float>(r2[m])
+                           + static_cast<float>(r2[r])
+                           - (static_cast<float>(r0[l]) + 2.f * static_cast<float>(r0[m])
+                              + static_cast<float>(r0[r]));
+                dx_norm += gx * gx;
+                dy_norm += gy * gy;
+            }
+            dx_row[x] = dx_norm;
+            dy_row[x] = dy_norm;
+        };
+
+        gradient(border(-1, width), 0, border(1, width));
+        for (int x = 1; x < width - 1; ++x) {
+            gradient(x - 1, x, x + 1);
+        }
+        if (width > 1) {
+            gradient(width - 2, width - 1, border(width, width));
+        }
+    }
+}
+
+/**
+ * @brief halfCorner
+ * Corner of an image at half the scale, such that the pixels of the image
+ * map to the pixels of the half image covering them.
+ */
+Point halfCorner(Point corner)
+{
+    return Point(cvFloor(corner.x * 0.5), cvFloor(corner.y * 0.5));
+}
+
+/**
+ * @brief halfSize
+ * Size of an image at half the scale, from its corner at both scales.
+ */
+Size halfSize(Point corner, Point half_corner, Size size)
+{
+    Point offset = corner - 2 * half_corner;
+    return Size((offset.x + size.width + 1) / 2, (offset.y + size.height + 1) / 2);
+}
+
+/**
+ * @brief upscaleSeam
+ * Upscale the seam mask of an image found at half the scale, dilated by the
+ * radius of the band to refine, to the valid pixels of the image.  Images
+ * next to each other then both keep the band around their upscaled seam.
+ * @param half_seam Seam mask at half the scale.
+ * @param corner Corner of the image.
+ * @param half_corner Corner of the image at half the scale.
+ * @param mask Valid pixels of the image.
+ * @param band_radius Radius of the band, in pixels.
+ * @param seam Seam mask.
+ */
+void upscaleSeam(const UMat &half_seam, Point corner, Point half_corner, const UMat &mask,
+                 int band_radius, UMat &seam)
+{
+    Mat upscaled;
+    resize(half_seam, upscaled, Size(2 * half_seam.cols, 2 * half_seam.rows), 0, 0,
+           INTER_NEAREST);
+    Mat dilated;
+    dilate(upscaled(Rect(corner - 2 * half_corner, mask.size())), dilated,
+           getStructuringElement(MORPH_RECT,
+                                 Size(2 * band_radius + 1, 2 * band_radius + 1)));
+    bitwise_and(dilated, mask, seam);
+}
+
+/**
+ * @brief voronoiInPair
+ * Split the overlap of a pair of masks between the closest of their
+ * pixels not overlapping, as cv::detail::VoronoiSeamFinder.
+ * @param mask1 Mask of the first image.
+ * @param mask2 Mask of the second image.
+ * @param tl1 Corner of the first image.
+ * @param tl2 Corner of the second image.
+ * @param roi Intersection of the images.
+ */
+void voronoiInPair(Mat &mask1, Mat &mask2, Point tl1, Point tl2, Rect roi)
+{
+    // Cut submasks with some gap
+    const int gap = 10;
+    Size window_size(roi.width + 2 * gap, roi.height + 2 * gap);
+    Mat submask1, submask2;
+    cutWindow(mask1, roi.tl() - tl1 - Point(gap, gap), window_size, CV_8U, submask1);
+    cutWindow(mask2, roi.tl() - tl2 - Point(gap, gap), window_size, CV_8U, submask2);
+
+    Mat collision = (submask1 != 0) & (submask2 != 0);
+    Mat unique1 = submask1.clone();
+    unique1.setTo(0, collision);
+    Mat unique2 = submask2.clone();
+    unique2.setTo(0, collision);
+
+    Mat dist1, dist2;
+    distanceTransform(unique1 == 0, dist1, DIST_L1, 3);
+    distanceTransform(unique2 == 0, dist2, DIST_L1, 3);
+
+    Mat seam = dist1 < dist2;
+
+    for (int y = 0; y < roi.height; ++y) {
+        const uchar *seam_row = seam.ptr<uchar>(y + gap) + gap;
+        uchar *mask1_row = mask1.ptr<uchar>(roi.y - tl1.y + y) + (roi.x - tl1.x);
+        uchar *mask2_row = mask2.ptr<uchar>(roi.y - tl2.y + y) + (roi.x - tl2.x);
+        for (int x = 0; x < roi.width; ++x) {
+            if (seam_row[x])
+                mask2_row[x] = 0;
+            else
+                mask1_row[x] = 0;
+        }
+    }
+}
+
+} // namespace
+
+void gradientMagnitudes(const std::vector<UMat> &src, std::vector<Mat> &dx,
+                        std::vector<Mat> &dy)
+{
+    std::vector<Mat> images(src.size());
+    std::vector<std::pair<size_t, Range>> strips;
+    dx.resize(src.size());
+    dy.resize(src.size());
+    for (size_t i = 0; i < src.size(); ++i) {
+        CV_Assert(src[i].type() == CV_8UC3 || src[i].type() == CV_32FC3);
+        images[i] = src[i].getMat(ACCESS_READ);
+        dx[i].create(src[i].size(), CV_32F);
+        dy[i].create(src[i].size(), CV_32F);
+        for (int y = 0; y < src[i].rows; y += GradientRows) {
+            strips.emplace_back(i, Range(y, std::min(y + GradientRows, src[i].rows)));
+        }
+    }
+
+    parallel_for_(Range(0, static_cast<int>(strips.size())), [&](const Range &range) {
+        for (int k = range.start; k < range.end; ++k) {
+            size_t i = strips[static_cast<size_t>(k)].first;
+            Range rows = strips[static_cast<size_t>(k)].second;
+            if (images[i].depth() == CV_8U) {
+                gradientRows<uchar>(images[i], rows, dx[i], dy[i]);
+            } else {
+                gradientRows<float>(images[i], rows, dx[i], dy[i]);
+            }
+        }
+    });
+}
+
+std::vector<std::vector<SeamPair>> scheduleSeamPairs(const std::vector<Point> &corners,
+                                                     const std::vector<Size> &sizes)
+{
+    CV_Assert(corners.size() == sizes.size());
+
+    std::vector<std::vector<SeamPair>> batches;
+    // First batch each image is free in, after the pairs changing its mask.
+    std::vector<size_t> free_batch(sizes.size(), 0);
+    for (size_t i = 0; i + 1 < sizes.size(); ++i) {
+        for (size_t j = i + 1; j < sizes.size(); ++j) {
+            Rect roi;
+            if (!overlapRoi(corners[i], corners[j], sizes[i], sizes[j], roi)) {
+                continue;
+            }
+            size_t batch = std::max(free_batch[i], free_batch[j]);
+            if (batch == batches.size()) {
+                batches.emplace_back();
+            }
+            batches[batch].push_back({ i, j, roi });
+            free_batch[i] = free_batch[j] = batch + 1;
+        }
+    }
+    return batches;
+}
+
+void ParallelPairwiseSeamFinder::find(const std::vector<UMat> &src,
+                                      const std::vector<Point> &corners,
+                                      std::vector<UMat> &masks)
+{
+    if (src.empty()) {
+        return;
+    }
+
+    images_ = src;
+    sizes_.resize(src.size());
+    for (size_t i = 0; i < src.size(); ++i) {
+        sizes_[i] = src[i].size();
+    }
+    corners_ = corners;
+    masks_ = masks;
+
+    std::vector<std::vector<SeamPair>> batches = scheduleSeamPairs(corners_, sizes_);
+    size_t pair_count = 0;
+    for (const auto &batch : batches) {
+        pair_count += batch.size();
+    }
+
+    size_t pairs_done = 0;
+    for (const auto &batch : batches) {
+        parallel_for_(Range(0, static_cast<int>(batch.size())), [&](const Range &range) {
+            for (int k = range.start; k < range.end; ++k) {
+                const SeamPair &pair = batch[static_cast<size_t>(k)];
+                findInPair(pair.first, pair.second, pair.roi);
+            }
+        });
+        pairs_done += batch.size();
+        if (_progressCb) {
+            _progressCb(static_cast<double>(pairs_done) / static_cast<double>(pair_count));
+        }
+    }
+}
+
+void ParallelPairwiseSeamFinder::setProgressCallback(ProgressCb progressCb)
+{
+    _progressCb = progressCb;
+}
+
+void ParallelVoronoiSeamFinder::findInPair(size_t first, size_t second, Rect roi)
+{
+    Mat mask1 = masks_[first].getMat(ACCESS_RW),
+        mask2 = masks_[second].getMat(ACCESS_RW);
+    voronoiInPair(mask1, mask2, corners_[first], corners_[second], roi);
+}
+
+class MonitoredGraphCutSeamFinder::Impl : public ParallelPairwiseSeamFinder {
 public:
     Impl(Monitor::SharedPtr monitor, int cost_type, float terminal_cost,
          float bad_region_penalty)
         : cost_type_(cost_type)
         , terminal_cost_(terminal_cost)
         , bad_region_penalty_(bad_region_penalty)
+        , levels_(0)
+        , band_radius_(4)
+        , min_overlap_pixels_(0)
+        , level_min_overlap_pixels_(0)
+        , refine_(false)
         , _monitor(monitor)
     {
     }
 
     ~Impl() {}
 
+    void setLevels(int levels, int band_radius);
+    void setMinOverlapPixels(int min_overlap_pixels);
+
     void find(const std::vector<UMat> &src, const std::vector<Point> &corners,
               std::vector<UMat> &masks) CV_OVERRIDE;
 
     void findInPair(size_t first, size_t second, Rect roi) CV_OVERRIDE;
 
 private:
-    void setGraphWeightsColor(const Mat &img1, const Mat &img2,
-                              const Mat &mask1, const Mat &mask2,
-                              GCGraph<float> &graph);
+    /**
+     * @brief findLevel
+     * Find or refine the seams of one level, reporting progress within
+     * [first_progress, last_progress].
+     */
+    void findLevel(const std::vector<UMat> &src, const std::vector<Point> &corners,
+                   std::vector<UMat> &masks, double first_progress,
+                   double last_progress);
 
-    void setGraphWeightsColorGrad(const Mat &img1, const Mat &img2,
-                                  const Mat &dx1, const Mat &dx2,
-                                  const Mat &dy1, const Mat &dy2,
-                                  const Mat &mask1, const Mat &mask2,
-                                  GCGraph<float> &graph);
+    /**
+     * @brief refineInPair
+     * Re-cut the seam between a pair of images within the band both images
+     * keep around the seam upscaled from the coarser level.  Pixels next to
+     * the band that only one image keeps tie the band to it.  Band pixels
+     * are cleared from the image on the other side of the cut.
+     */
+    void refineInPair(size_t first, size_t second, Rect roi);
+
+    /**
+     * @brief edgeWeights
+     * Weights of the edges to the right of and below each pixel of a window.
+     * @param offset1 Top left corner of the window in the first image.
+     * @param offset2 Top left corner of the window in the second image.
+     * @param size Size of the window.
+     * @param valid Whether both images are valid at each pixel of the window.
+     * @param horizontal CV_32F weights of the edges to the right.
+     * @param vertical CV_32F weights of the edges below.
+     */
+    void edgeWeights(size_t first, size_t second, Point offset1, Point offset2,
+                     Size size, const Mat &valid, Mat &horizontal, Mat &vertical);
+
+    /**
+     * @brief acquireGraph
+     * Take a graph from the graphs kept for reuse, or a new one.
+     */
+    std::unique_ptr<GridGraph> acquireGraph();
+    void releaseGraph(std::unique_ptr<GridGraph> graph);
 
     std::vector<Mat> dx_, dy_;
+    //! Graphs kept for reuse by the pairs of a level.
+    std::vector<std::unique_ptr<GridGraph>> graphs_;
+    std::mutex graphs_mutex_;
     int cost_type_;
     float terminal_cost_;
     float bad_region_penalty_;
+    int levels_;
+    int band_radius_;
+    int min_overlap_pixels_;
+    //! Minimum overlap at the level being cut.
+    int level_min_overlap_pixels_;
+    bool refine_;
     Monitor::SharedPtr _monitor;
 };
 
+void MonitoredGraphCutSeamFinder::Impl::setLevels(int levels, int band_radius)
+{
+    levels_ = levels;
+    band_radius_ = band_radius;
+}
+
+void MonitoredGraphCutSeamFinder::Impl::setMinOverlapPixels(int min_overlap_pixels)
+{
+    min_overlap_pixels_ = min_overlap_pixels;
+}
+
 void MonitoredGraphCutSeamFinder::Impl::find(const std::vector<UMat> &src,
                                              const std::vector<Point> &corners,
                                              std::vector<UMat> &masks)
 {
-    // Compute gradients
-    dx_.resize(src.size());
-    dy_.resize(src.size());
-    Mat dx, dy;
-    for (size_t i = 0; i < src.size(); ++i) {
-        CV_Assert(src[i].channels() == 3);
-        Sobel(src[i], dx, CV_32F, 1, 0);
-        Sobel(src[i], dy, CV_32F, 0, 1);
-        dx_[i].create(src[i].size(), CV_32F);
-        dy_[i].create(src[i].size(), CV_32F);
-        for (int y = 0; y < src[i].rows; ++y) {
-            const Point3f *dx_row = dx.ptr<Point3f>(y);
-            const Point3f *dy_row = dy.ptr<Point3f>(y);
-            float *dx_row_ = dx_[i].ptr<float>(y);
-            float *dy_row_ = dy_[i].ptr<float>(y);
-            for (int x = 0; x < src[i].cols; ++x) {
-                dx_row_[x] = normL2(dx_row[x]);
-                dy_row_[x] = normL2(dy_row[x]);
-            }
+    if (levels_ <= 0 || src.empty()) {
+        refine_ = false;
+        level_min_overlap_pixels_ = min_overlap_pixels_;
+        findLevel(src, corners, masks, 0., 1.);
+        return;
+    }
+
+    // Halve the images, their masks and their corners down to the coarsest
+    // level.  A half pixel is valid wherever any of its pixels is.
+    std::vector<std::vector<UMat>> images(levels_ + 1), valid_masks(levels_ + 1);
+    std::vector<std::vector<Point>> level_corners(levels_ + 1);
+    images[0] = src;
+    level_corners[0] = corners;
+    for (const auto &mask : masks) {
+        valid_masks[0].push_back(mask.clone());
+    }
+    for (int level = 1; level <= levels_; ++level) {
+        for (size_t i = 0; i < src.size(); ++i) {
+            const UMat &image = images[level - 1][i];
+            Point corner = level_corners[level - 1][i];
+            Point half_corner = halfCorner(corner);
+            Size half_size = halfSize(corner, half_corner, image.size());
+
+            UMat half_image, half_mask;
+            resize(image, half_image, half_size, 0, 0, INTER_AREA);
+            resize(valid_masks[level - 1][i], half_mask, half_size, 0, 0, INTER_AREA);
+            compare(half_mask, Scalar::all(0), half_mask, CMP_GT);
+
+            images[level].push_back(half_image);
+            valid_masks[level].push_back(half_mask);
+            level_corners[level].push_back(half_corner);
+        }
+    }
+
+    // Cut the whole overlaps at the coarsest level.
+    double level_progress = 1. / (levels_ + 1);
+    std::vector<UMat> seams;
+    for (const auto &mask : valid_masks[levels_]) {
+        seams.push_back(mask.clone());
+    }
+    refine_ = false;
+    level_min_overlap_pixels_ = min_overlap_pixels_ >> (2 * levels_);
+    findLevel(images[levels_], level_corners[levels_], seams, 0., level_progress);
+
+    // Refine the seams around the upscaled seams of each coarser level.
+    refine_ = true;
+    for (int level = levels_ - 1; level >= 0; --level) {
+        std::vector<UMat> level_seams(src.size());
+        for (size_t i = 0; i < src.size(); ++i) {
+            upscaleSeam(seams[i], level_corners[level][i], level_corners[level + 1][i],
+                        valid_masks[level][i], band_radius_, level_seams[i]);
         }
+        seams = level_seams;
+        images[level + 1].clear();
+
+        double first_progress = (levels_ - level) * level_progress;
+        findLevel(images[level], level_corners[level], seams, first_progress,
+                  first_progress + level_progress);
+    }
+
+    for (size_t i = 0; i < masks.size(); ++i) {
+        seams[i].copyTo(masks[i]);
     }
-    PairwiseSeamFinder::find(src, corners, masks);
 }
 
-void MonitoredGraphCutSeamFinder::Impl::setGraphWeightsColor(
-    const Mat &img1, const Mat &img2, const Mat &mask1, const Mat &mask2,
-    GCGraph<float> &graph)
+void MonitoredGraphCutSeamFinder::Impl::findLevel(const std::vector<UMat> &src,
+                                                  const std::vector<Point> &corners,
+                                                  std::vector<UMat> &masks,
+                                                  double first_progress,
+                                                  double last_progress)
 {
-    const Size img_size = img1.size();
-
-    // Set terminal weights
-    for (int y = 0; y < img_size.height; ++y) {
-        for (int x = 0; x < img_size.width; ++x) {
-            int v = graph.addVtx();
-            graph.addTermWeights(v,
-                                 mask1.at<uchar>(y, x) ? terminal_cost_ : 0.f,
-                                 mask2.at<uchar>(y, x) ? terminal_cost_ : 0.f);
-        }
+    if (cost_type_ == GraphCutSeamFinder::COST_COLOR_GRAD) {
+        gradientMagnitudes(src, dx_, dy_);
     }
 
-    // Set regular edge weights
-    const float weight_eps = 1.f;
-    for (int y = 0; y < img_size.height; ++y) {
-        for (int x = 0; x < img_size.width; ++x) {
-            int v = y * img_size.width + x;
-            if (x < img_size.width - 1) {
-                float weight =
-                    normL2(img1.at<Point3f>(y, x), img2.at<Point3f>(y, x)) +
-                    normL2(img1.at<Point3f>(y, x + 1),
-                           img2.at<Point3f>(y, x + 1)) +
-                    weight_eps;
-                if (!mask1.at<uchar>(y, x) || !mask1.at<uchar>(y, x + 1) ||
-                    !mask2.at<uchar>(y, x) || !mask2.at<uchar>(y, x + 1))
-                    weight += bad_region_penalty_;
-                graph.addEdges(v, v + 1, weight, weight);
-            }
-            if (y < img_size.height - 1) {
-                float weight =
-                    normL2(img1.at<Point3f>(y, x), img2.at<Point3f>(y, x)) +
-                    normL2(img1.at<Point3f>(y + 1, x),
-                           img2.at<Point3f>(y + 1, x)) +
-                    weight_eps;
-                if (!mask1.at<uchar>(y, x) || !mask1.at<uchar>(y + 1, x) ||
-                    !mask2.at<uchar>(y, x) || !mask2.at<uchar>(y + 1, x))
-                    weight += bad_region_penalty_;
-                graph.addEdges(v, v + img_size.width, weight, weight);
-            }
-        }
+    Monitor::SharedPtr monitor = _monitor;
+    setProgressCallback([monitor, first_progress, last_progress](double progress) {
+        monitor->updateCurrentOperation(first_progress
+                                        + progress * (last_progress - first_progress));
+    });
+    ParallelPairwiseSeamFinder::find(src, corners, masks);
+    graphs_.clear();
+}
+
+std::unique_ptr<GridGraph> MonitoredGraphCutSeamFinder::Impl::acquireGraph()
+{
+    std::lock_guard<std::mutex> lock(graphs_mutex_);
+    if (graphs_.empty()) {
+        return std::unique_ptr<GridGraph>(new GridGraph());
     }
+    std::unique_ptr<GridGraph> graph = std::move(graphs_.back());
+    graphs_.pop_back();
+    return graph;
 }
 
-void MonitoredGraphCutSeamFinder::Impl::setGraphWeightsColorGrad(
-    const Mat &img1, const Mat &img2, const Mat &dx1, const Mat &dx2,
-    const Mat &dy1, const Mat &dy2, const Mat &mask1, const Mat &mask2,
-    GCGraph<float> &graph)
+void MonitoredGraphCutSeamFinder::Impl::releaseGraph(std::unique_ptr<GridGraph> graph)
 {
-    const Size img_size = img1.size();
-
-    // Set terminal weights
-    for (int y = 0; y < img_size.height; ++y) {
-        for (int x = 0; x < img_size.width; ++x) {
-            int v = graph.addVtx();
-            graph.addTermWeights(v,
-                                 mask1.at<uchar>(y, x) ? terminal_cost_ : 0.f,
-                                 mask2.at<uchar>(y, x) ? terminal_cost_ : 0.f);
-        }
+    std::lock_guard<std::mutex> lock(graphs_mutex_);
+    graphs_.push_back(std::move(graph));
+}
+
+void MonitoredGraphCutSeamFinder::Impl::edgeWeights(size_t first, size_t second,
+                                                    Point offset1, Point offset2,
+                                                    Size size, const Mat &valid,
+                                                    Mat &horizontal, Mat &vertical)
+{
+    // Only the windows are converted to float.
+    Mat subimg1, subimg2;
+    cutWindow(images_[first].getMat(ACCESS_READ), offset1, size, CV_32F, subimg1);
+    cutWindow(images_[second].getMat(ACCESS_READ), offset2, size, CV_32F, subimg2);
+    Mat differences = colorDifferences(subimg1, subimg2);
+
+    Mat subdx1, subdy1, subdx2, subdy2;
+    switch (cost_type_) {
+    case GraphCutSeamFinder::COST_COLOR:
+        break;
+    case GraphCutSeamFinder::COST_COLOR_GRAD:
+        cutWindow(dx_[first], offset1, size, CV_32F, subdx1);
+        cutWindow(dy_[first], offset1, size, CV_32F, subdy1);
+        cutWindow(dx_[second], offset2, size, CV_32F, subdx2);
+        cutWindow(dy_[second], offset2, size, CV_32F, subdy2);
+        break;
+    default:
+        CV_Error(Error::StsBadArg, "unsupported pixel similarity measure");
     }
 
-    // Set regular edge weights
+    // Weights are computed a row at a time.  The last column of horizontal
+    // and the last row of vertical weights are unused.
     const float weight_eps = 1.f;
-    for (int y = 0; y < img_size.height; ++y) {
-        for (int x = 0; x < img_size.width; ++x) {
-            int v = y * img_size.width + x;
-            if (x < img_size.width - 1) {
-                float grad = dx1.at<float>(y, x) + dx1.at<float>(y, x + 1) +
-                             dx2.at<float>(y, x) + dx2.at<float>(y, x + 1) +
-                             weight_eps;
-                float weight =
-                    (normL2(img1.at<Point3f>(y, x), img2.at<Point3f>(y, x)) +
-                     normL2(img1.at<Point3f>(y, x + 1),
-                            img2.at<Point3f>(y, x + 1))) /
-                        grad +
-                    weight_eps;
-                if (!mask1.at<uchar>(y, x) || !mask1.at<uchar>(y, x + 1) ||
-                    !mask2.at<uchar>(y, x) || !mask2.at<uchar>(y, x + 1))
-                    weight += bad_region_penalty_;
-                graph.addEdges(v, v + 1, weight, weight);
+    horizontal.create(size, CV_32F);
+    vertical.create(size, CV_32F);
+    for (int y = 0; y < size.height; ++y) {
+        bool last_row = y == size.height - 1;
+        const float *diff = differences.ptr<float>(y);
+        const float *next_diff = differences.ptr<float>(last_row ? y : y + 1);
+        const uchar *valid_row = valid.ptr<uchar>(y);
+        const uchar *next_valid_row = valid.ptr<uchar>(last_row ? y : y + 1);
+        float *horizontal_row = horizontal.ptr<float>(y);
+        float *vertical_row = vertical.ptr<float>(y);
+        horizontal_row[size.width - 1] = 0.f;
+
+        if (subdx1.empty()) {
+            colorEdgeWeights(diff, diff + 1, valid_row, valid_row + 1, size.width - 1,
+                             weight_eps, bad_region_penalty_, horizontal_row);
+            if (!last_row) {
+                colorEdgeWeights(diff, next_diff, valid_row, next_valid_row, size.width,
+                                 weight_eps, bad_region_penalty_, vertical_row);
             }
-            if (y < img_size.height - 1) {
-                float grad = dy1.at<float>(y, x) + dy1.at<float>(y + 1, x) +
-                             dy2.at<float>(y, x) + dy2.at<float>(y + 1, x) +
-                             weight_eps;
-                float weight =
-                    (normL2(img1.at<Point3f>(y, x), img2.at<Point3f>(y, x)) +
-                     normL2(img1.at<Point3f>(y + 1, x),
-                            img2.at<Point3f>(y + 1, x))) /
-                        grad +
-                    weight_eps;
-                if (!mask1.at<uchar>(y, x) || !mask1.at<uchar>(y + 1, x) ||
-                    !mask2.at<uchar>(y, x) || !mask2.at<uchar>(y + 1, x))
-                    weight += bad_region_penalty_;
-                graph.addEdges(v, v + img_size.width, weight, weight);
+        } else {
+            const float *dx1_row = subdx1.ptr<float>(y);
+            const float *dx2_row = subdx2.ptr<float>(y);
+            colorGradEdgeWeights(diff, diff + 1, dx1_row, dx1_row + 1, dx2_row,
+                                 dx2_row + 1, valid_row, valid_row + 1, size.width - 1,
+                                 weight_eps, bad_region_penalty_, horizontal_row);
+            if (!last_row) {
+                colorGradEdgeWeights(diff, next_diff, subdy1.ptr<float>(y),
+                                     subdy1.ptr<float>(y + 1), subdy2.ptr<float>(y),
+                                     subdy2.ptr<float>(y + 1), valid_row,
+                                     next_valid_row, size.width, weight_eps,
+                                     bad_region_penalty_, vertical_row);
             }
         }
+        if (last_row) {
+            std::fill(vertical_row, vertical_row + size.width, 0.f);
+        }
     }
 }
 
 void MonitoredGraphCutSeamFinder::Impl::findInPair(size_t first, size_t second,
                                                    Rect roi)
 {
-    _monitor->updateCurrentOperation(static_cast<double>(first) /
-                                     static_cast<double>(dx_.size()));
-    Mat img1 = images_[first].getMat(ACCESS_READ),
-        img2 = images_[second].getMat(ACCESS_READ);
-    Mat dx1 = dx_[first], dx2 = dx_[second];
-    Mat dy1 = dy_[first], dy2 = dy_[second];
+    if (refine_) {
+        refineInPair(first, second, roi);
+        return;
+    }
+
     Mat mask1 = masks_[first].getMat(ACCESS_RW),
         mask2 = masks_[second].getMat(ACCESS_RW);
     Point tl1 = corners_[first], tl2 = corners_[second];
 
+    // Only pixels kept by both images can change, and near the poles of
+    // spherical warps they may only cover a sliver of the intersection of
+    // the images.  The graph is cut around them, and small overlaps are
+    // split as by the Voronoi seam finder.
+    Mat overlap = (mask1(Rect(roi.tl() - tl1, roi.size())) != 0)
+                  & (mask2(Rect(roi.tl() - tl2, roi.size())) != 0);
+    int overlap_pixels = countNonZero(overlap);
+    if (overlap_pixels == 0) {
+        return;
+    }
+    if (overlap_pixels < level_min_overlap_pixels_) {
+        voronoiInPair(mask1, mask2, tl1, tl2, roi);
+        return;
+    }
+    Rect overlap_box = boundingRect(overlap);
+    roi = Rect(roi.tl() + overlap_box.tl(), overlap_box.size());
+
+    // Cut windows around the overlap with some gap
     const int gap = 10;
-    Mat subimg1(roi.height + 2 * gap, roi.width + 2 * gap, CV_32FC3);
-    Mat subimg2(roi.height + 2 * gap, roi.width + 2 * gap, CV_32FC3);
-    Mat submask1(roi.height + 2 * gap, roi.width + 2 * gap, CV_8U);
-    Mat submask2(roi.height + 2 * gap, roi.width + 2 * gap, CV_8U);
-    Mat subdx1(roi.height + 2 * gap, roi.width + 2 * gap, CV_32F);
-    Mat subdy1(roi.height + 2 * gap, roi.width + 2 * gap, CV_32F);
-    Mat subdx2(roi.height + 2 * gap, roi.width + 2 * gap, CV_32F);
-    Mat subdy2(roi.height + 2 * gap, roi.width + 2 * gap, CV_32F);
-
-    // Cut subimages and submasks with some gap
-    for (int y = -gap; y < roi.height + gap; ++y) {
-        for (int x = -gap; x < roi.width + gap; ++x) {
-            int y1 = roi.y - tl1.y + y;
-            int x1 = roi.x - tl1.x + x;
-            if (y1 >= 0 && x1 >= 0 && y1 < img1.rows && x1 < img1.cols) {
-                subimg1.at<Point3f>(y + gap, x + gap) =
-                    img1.at<Point3f>(y1, x1);
-                submask1.at<uchar>(y + gap, x + gap) = mask1.at<uchar>(y1, x1);
-                subdx1.at<float>(y + gap, x + gap) = dx1.at<float>(y1, x1);
-                subdy1.at<float>(y + gap, x + gap) = dy1.at<float>(y1, x1);
-            } else {
-                subimg1.at<Point3f>(y + gap, x + gap) = Point3f(0, 0, 0);
-                submask1.at<uchar>(y + gap, x + gap) = 0;
-                subdx1.at<float>(y + gap, x + gap) = 0.f;
-                subdy1.at<float>(y + gap, x + gap) = 0.f;
-            }
+    Size window_size(roi.width + 2 * gap, roi.height + 2 * gap);
+    Point offset1 = roi.tl() - tl1 - Point(gap, gap);
+    Point offset2 = roi.tl() - tl2 - Point(gap, gap);
+    Mat submask1, submask2;
+    cutWindow(mask1, offset1, window_size, CV_8U, submask1);
+    cutWindow(mask2, offset2, window_size, CV_8U, submask2);
 
-            int y2 = roi.y - tl2.y + y;
-            int x2 = roi.x - tl2.x + x;
-            if (y2 >= 0 && x2 >= 0 && y2 < img2.rows && x2 < img2.cols) {
-                subimg2.at<Point3f>(y + gap, x + gap) =
-                    img2.at<Point3f>(y2, x2);
-                submask2.at<uchar>(y + gap, x + gap) = mask2.at<uchar>(y2, x2);
-                subdx2.at<float>(y + gap, x + gap) = dx2.at<float>(y2, x2);
-                subdy2.at<float>(y + gap, x + gap) = dy2.at<float>(y2, x2);
+    Mat horizontal, vertical;
+    edgeWeights(first, second, offset1, offset2, window_size,
+                (submask1 != 0) & (submask2 != 0), horizontal, vertical);
+
+    std::unique_ptr<GridGraph> graph = acquireGraph();
+    graph->create(window_size);
+    addTerminalWeights(submask1, submask2, terminal_cost_, *graph);
+    graph->setEdgeWeights(horizontal, vertical);
+
+    graph->maxFlow();
+
+    for (int y = 0; y < roi.height; ++y) {
+        uchar *mask1_row = mask1.ptr<uchar>(roi.y - tl1.y + y) + (roi.x - tl1.x);
+        uchar *mask2_row = mask2.ptr<uchar>(roi.y - tl2.y + y) + (roi.x - tl2.x);
+        int v = (y + gap) * window_size.width + gap;
+        for (int x = 0; x < roi.width; ++x, ++v) {
+            if (graph->inSourceSegment(v)) {
+                if (mask1_row[x])
+                    mask2_row[x] = 0;
             } else {
-                subimg2.at<Point3f>(y + gap, x + gap) = Point3f(0, 0, 0);
-                submask2.at<uchar>(y + gap, x + gap) = 0;
-                subdx2.at<float>(y + gap, x + gap) = 0.f;
-                subdy2.at<float>(y + gap, x + gap) = 0.f;
+                if (mask2_row[x])
+                    mask1_row[x] = 0;
             }
         }
     }
+    releaseGraph(std::move(graph));
+}
 
-    const int vertex_count = (roi.height + 2 * gap) * (roi.width + 2 * gap);
-    const int edge_count = (roi.height - 1 + 2 * gap) * (roi.width + 2 * gap) +
-                           (roi.width - 1 + 2 * gap) * (roi.height + 2 * gap);
-    GCGraph<float> graph(vertex_count, edge_count);
+void MonitoredGraphCutSeamFinder::Impl::refineInPair(size_t first, size_t second,
+                                                     Rect roi)
+{
+    Mat seam1 = masks_[first].getMat(ACCESS_RW),
+        seam2 = masks_[second].getMat(ACCESS_RW);
+    Point tl1 = corners_[first], tl2 = corners_[second];
 
-    switch (cost_type_) {
-    case GraphCutSeamFinder::COST_COLOR:
-        setGraphWeightsColor(subimg1, subimg2, submask1, submask2, graph);
-        break;
-    case GraphCutSeamFinder::COST_COLOR_GRAD:
-        setGraphWeightsColorGrad(subimg1, subimg2, subdx1, subdx2, subdy1,
-                                 subdy2, submask1, submask2, graph);
-        break;
-    default:
-        CV_Error(Error::StsBadArg, "unsupported pixel similarity measure");
+    // Cut the overlap with a pixel of margin, for the pixels tying the band.
+    Size window_size(roi.width + 2, roi.height + 2);
+    Point offset1 = roi.tl() - tl1 - Point(1, 1);
+    Point offset2 = roi.tl() - tl2 - Point(1, 1);
+    Mat subseam1, subseam2;
+    cutWindow(seam1, offset1, window_size, CV_8U, subseam1);
+    cutWindow(seam2, offset2, window_size, CV_8U, subseam2);
+    Mat own1 = subseam1 != 0;
+    Mat own2 = subseam2 != 0;
+
+    // Only pixels kept by both images can change, and upscaled seam masks
+    // keep a band of band_radius_ pixels on either side of the coarser seam.
+    // Both images are valid over the band.
+    Mat band = own1 & own2;
+    if (countNonZero(band) == 0) {
+        return;
     }
 
-    graph.maxFlow();
+    // Only the bounding box of the band, and the pixels tying it, is cut.
+    Rect box = boundingRect(band);
+    box = Rect(box.x - 1, box.y - 1, box.width + 2, box.height + 2)
+          & Rect(Point(), window_size);
+    Mat box_band = band(box);
+    Mat box_own1 = own1(box);
+    Mat box_own2 = own2(box);
+    Mat horizontal, vertical;
+    edgeWeights(first, second, offset1 + box.tl(), offset2 + box.tl(), box.size(),
+                box_band, horizontal, vertical);
 
-    for (int y = 0; y < roi.height; ++y) {
-        for (int x = 0; x < roi.width; ++x) {
-            if (graph.inSourceSegment((y + gap) * (roi.width + 2 * gap) + x +
-                                      gap)) {
-                if (mask1.at<uchar>(roi.y - tl1.y + y, roi.x - tl1.x + x))
-                    mask2.at<uchar>(roi.y - tl2.y + y, roi.x - tl2.x + x) = 0;
+    // Band pixels are the vertices of the graph.  Pixels next to the band,
+    // kept by one image only, tie their neighbours in the band to their
+    // image, the first one being the source as in findInPair, instead of
+    // sharing an edge with them.
+    std::unique_ptr<GridGraph> graph = acquireGraph();
+    graph->create(box.size());
+    auto tie = [&](int v, Point fixed, float weight) {
+        bool fixed1 = box_own1.at<uchar>(fixed) != 0;
+        bool fixed2 = box_own2.at<uchar>(fixed) != 0;
+        if (fixed1 && !fixed2) {
+            graph->addTermWeights(v, weight, 0.f);
+        } else if (fixed2 && !fixed1) {
+            graph->addTermWeights(v, 0.f, weight);
+        }
+    };
+    auto cut = [&](Point p, Point q, float &weight) {
+        bool in_p = box_band.at<uchar>(p) != 0;
+        bool in_q = box_band.at<uchar>(q) != 0;
+        if (in_p && !in_q) {
+            tie(p.y * box.width + p.x, q, weight);
+        } else if (in_q && !in_p) {
+            tie(q.y * box.width + q.x, p, weight);
+        }
+        if (!in_p || !in_q) {
+            weight = 0.f;
+        }
+    };
+    for (int y = 0; y < box.height; ++y) {
+        float *horizontal_row = horizontal.ptr<float>(y);
+        float *vertical_row = vertical.ptr<float>(y);
+        for (int x = 0; x < box.width; ++x) {
+            if (x < box.width - 1) {
+                cut(Point(x, y), Point(x + 1, y), horizontal_row[x]);
+            }
+            if (y < box.height - 1) {
+                cut(Point(x, y), Point(x, y + 1), vertical_row[x]);
+            }
+        }
+    }
+    graph->setEdgeWeights(horizontal, vertical);
+
+    graph->maxFlow();
+
+    // Band pixels go to the side of the cut they are in, as in findInPair.
+    // Pixels are only ever cleared, never set, so that pixels another pair
+    // took from one of the images aren't given back.
+    for (int y = 0; y < box.height; ++y) {
+        const uchar *band_row = box_band.ptr<uchar>(y);
+        int window_y = box.y + y;
+        uchar *seam1_row = seam1.ptr<uchar>(offset1.y + window_y) + offset1.x + box.x;
+        uchar *seam2_row = seam2.ptr<uchar>(offset2.y + window_y) + offset2.x + box.x;
+        for (int x = 0; x < box.width; ++x) {
+            if (!band_row[x]) {
+                continue;
+            }
+            if (graph->inSourceSegment(y * box.width + x)) {
+                if (seam1_row[x])
+                    seam2_row[x] = 0;
             } else {
-                if (mask2.at<uchar>(roi.y - tl2.y + y, roi.x - tl2.x + x))
-                    mask1.at<uchar>(roi.y - tl1.y + y, roi.x - tl1.x + x) = 0;
+                if (seam2_row[x])
+                    seam1_row[x] = 0;
             }
         }
     }
+    releaseGraph(std::move(graph));
 }
 
 MonitoredGraphCutSeamFinder::MonitoredGraphCutSeamFinder(
@@ -279,6 +814,16 @@ MonitoredGraphCutSeamFinder::MonitoredGraphCutSeamFinder(
 
 MonitoredGraphCutSeamFinder::~MonitoredGraphCutSeamFinder() {}
 
+void MonitoredGraphCutSeamFinder::setLevels(int levels, int band_radius)
+{
+    _impl->setLevels(levels, band_radius);
+}
+
+void MonitoredGraphCutSeamFinder::setMinOverlapPixels(int min_overlap_pixels)
+{
+    _impl->setMinOverlapPixels(min_overlap_pixels);
+}
+
 void MonitoredGraphCutSeamFinder::find(const std::vector<cv::UMat> &src,
                                        const std::vector<cv::Point> &corners,
                                        std::vector<cv::UMat> &masks)
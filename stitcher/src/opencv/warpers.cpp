@@ -0,0 +1,241 @@
+#include "airmap/opencv/warpers.h"
+
+#include <opencv2/core/utility.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace airmap {
+namespace stitcher {
+namespace opencv {
+namespace detail {
+
+namespace {
+
+//! Rows per tile of the tiled warps.
+const int TiledWarpRows = 16;
+
+/**
+ * @brief warpedRows
+ * Rows of a warped image of the given ROI and height that are in dst_rows,
+ * relative to its top.
+ */
+cv::Range warpedRows(const cv::Rect &dst_roi, int height, const cv::Range &dst_rows)
+{
+    if (dst_rows == cv::Range::all()) {
+        return cv::Range(0, height);
+    }
+    int begin = std::max(dst_rows.start - dst_roi.y, 0);
+    int end = std::max(std::min(dst_rows.end - dst_roi.y, height), begin);
+    return cv::Range(begin, end);
+}
+
+/**
+ * @brief SphericalProjection
+ * Row terms of the backward mapping of cv::detail::SphericalProjector.  The
+ * ray of warped pixel (u, v) is (sin(pi - v) * sin(u), cos(pi - v),
+ * sin(pi - v) * cos(u)).
+ */
+struct SphericalProjection
+{
+    static inline void rowTerms(float v, float &row_scale, float &row_y)
+    {
+        row_scale = sinf(static_cast<float>(CV_PI) - v);
+        row_y = cosf(static_cast<float>(CV_PI) - v);
+    }
+};
+
+/**
+ * @brief CylindricalProjection
+ * Row terms of the backward mapping of cv::detail::CylindricalProjector.
+ * The ray of warped pixel (u, v) is (sin(u), v, cos(u)).
+ */
+struct CylindricalProjection
+{
+    static inline void rowTerms(float v, float &row_scale, float &row_y)
+    {
+        row_scale = 1.f;
+        row_y = v;
+    }
+};
+
+/**
+ * @brief warpImageAndMaskTiled
+ * Warp in tiles of TiledWarpRows rows, computing the maps of each tile on
+ * the fly.  The backward mapping of both projections is separable: sin(u)
+ * and cos(u) only depend on the column and are computed once per warp, the
+ * remaining terms once per row.  The per pixel work is then a handful of
+ * multiply-adds and a division, in a loop the compiler can vectorise.
+ */
+template <typename Projection>
+cv::Point warpImageAndMaskTiled(cv::detail::RotationWarper &warper,
+                                cv::InputArray src, cv::InputArray K,
+                                cv::InputArray R, int interp_mode, int border_mode,
+                                cv::OutputArray dst, cv::OutputArray mask_warped,
+                                const WarpedRowsCallback &on_rows,
+                                const cv::Range &dst_rows)
+{
+    // Same ROI as the OpenCV warper, so that corners and sizes line up with
+    // RotationWarper::warpRoi.
+    cv::Rect dst_roi = warper.warpRoi(src.size(), K, R);
+    float scale = warper.getScale();
+    cv::Range rows_warped = warpedRows(dst_roi, dst_roi.height, dst_rows);
+
+    // Same as cv::detail::ProjectorBase::setCameraParams.
+    cv::Mat_<float> K_Rinv = K.getMat() * R.getMat().t();
+    const float k_rinv[9] = { K_Rinv(0, 0), K_Rinv(0, 1), K_Rinv(0, 2),
+                              K_Rinv(1, 0), K_Rinv(1, 1), K_Rinv(1, 2),
+                              K_Rinv(2, 0), K_Rinv(2, 1), K_Rinv(2, 2) };
+
+    cv::Mat src_mat = src.getMat();
+    const int width = dst_roi.width;
+    const int height = rows_warped.size();
+    dst.create(height, width, src.type());
+    mask_warped.create(height, width, CV_8U);
+    cv::Mat dst_mat = dst.getMat();
+    cv::Mat mask_mat = mask_warped.getMat();
+    const float max_x = static_cast<float>(src_mat.cols) - 0.5f;
+    const float max_y = static_cast<float>(src_mat.rows) - 0.5f;
+
+    std::vector<float> sin_u(static_cast<size_t>(width));
+    std::vector<float> cos_u(static_cast<size_t>(width));
+    for (int c = 0; c < width; ++c) {
+        float u = static_cast<float>(dst_roi.x + c) / scale;
+        sin_u[c] = sinf(u);
+        cos_u[c] = cosf(u);
+    }
+
+    int tile_count = (height + TiledWarpRows - 1) / TiledWarpRows;
+    cv::parallel_for_(cv::Range(0, tile_count), [&](const cv::Range &range) {
+        cv::Mat_<float> xmap(TiledWarpRows, width), ymap(TiledWarpRows, width);
+
+        for (int tile = range.start; tile < range.end; ++tile) {
+            int first_row = tile * TiledWarpRows;
+            int rows = std::min(TiledWarpRows, height - first_row);
+
+            for (int r = 0; r < rows; ++r) {
+                float v = static_cast<float>(dst_roi.y + rows_warped.start + first_row + r)
+                        / scale;
+                float row_scale, row_y;
+                Projection::rowTerms(v, row_scale, row_y);
+
+                // Row constant parts of the rotation.
+                const float x_y = k_rinv[1] * row_y;
+                const float y_y = k_rinv[4] * row_y;
+                const float z_y = k_rinv[7] * row_y;
+
+                float *x_row = xmap[r];
+                float *y_row = ymap[r];
+                uchar *mask_row = mask_mat.ptr<uchar>(first_row + r);
+                for (int c = 0; c < width; ++c) {
+                    float x_ = row_scale * sin_u[c];
+                    float z_ = row_scale * cos_u[c];
+                    float x = k_rinv[0] * x_ + x_y + k_rinv[2] * z_;
+                    float y = k_rinv[3] * x_ + y_y + k_rinv[5] * z_;
+                    float z = k_rinv[6] * x_ + z_y + k_rinv[8] * z_;
+                    bool in_front = z > 0;
+                    x = in_front ? x / z : -1.f;
+                    y = in_front ? y / z : -1.f;
+                    x_row[c] = x;
+                    y_row[c] = y;
+
+                    // Nearest neighbour sampling rounds the map, so a pixel
+                    // is inside the source image if its map is within half
+                    // a pixel of it.
+                    mask_row[c] = (x >= -0.5f && x <= max_x && y >= -0.5f && y <= max_y)
+                            ? 255
+                            : 0;
+                }
+            }
+
+            cv::Mat dst_tile = dst_mat.rowRange(first_row, first_row + rows);
+            cv::remap(src_mat, dst_tile, xmap.rowRange(0, rows), ymap.rowRange(0, rows),
+                      interp_mode, border_mode);
+            if (on_rows) {
+                on_rows(dst_tile, rows_warped.start + first_row);
+            }
+        }
+    });
+
+    return cv::Point(dst_roi.x, dst_roi.y + rows_warped.start);
+}
+
+/**
+ * @brief warpImageAndMaskWithMaps
+ * Keep the maps in the same kind of storage as the results, so that the
+ * OpenCL path is only taken for UMat results.
+ */
+template <typename MapType>
+cv::Point warpImageAndMaskWithMaps(cv::detail::RotationWarper &warper,
+                                   cv::InputArray src, cv::InputArray K,
+                                   cv::InputArray R, int interp_mode,
+                                   int border_mode, cv::OutputArray dst,
+                                   cv::OutputArray mask_warped,
+                                   const WarpedRowsCallback &on_rows,
+                                   const cv::Range &dst_rows)
+{
+    MapType full_xmap, full_ymap;
+    cv::Rect dst_roi = warper.buildMaps(src.size(), K, R, full_xmap, full_ymap);
+    cv::Range rows_warped = warpedRows(dst_roi, full_xmap.rows, dst_rows);
+    MapType xmap = full_xmap.rowRange(rows_warped);
+    MapType ymap = full_ymap.rowRange(rows_warped);
+
+    dst.create(xmap.size(), src.type());
+    cv::remap(src, dst, xmap, ymap, interp_mode, border_mode);
+    if (on_rows) {
+        if (dst.isUMat()) {
+            cv::UMat dst_umat = dst.getUMat();
+            cv::Mat dst_mat = dst_umat.getMat(cv::ACCESS_RW);
+            on_rows(dst_mat, rows_warped.start);
+        } else {
+            cv::Mat dst_mat = dst.getMat();
+            on_rows(dst_mat, rows_warped.start);
+        }
+    }
+
+    // Nearest neighbour sampling rounds the map, so a pixel is inside the
+    // source image if its map is within half a pixel of it.
+    cv::Size src_size = src.size();
+    MapType x_valid, y_valid;
+    cv::inRange(xmap, cv::Scalar(-0.5), cv::Scalar(src_size.width - 0.5), x_valid);
+    cv::inRange(ymap, cv::Scalar(-0.5), cv::Scalar(src_size.height - 0.5), y_valid);
+    cv::bitwise_and(x_valid, y_valid, mask_warped);
+
+    return cv::Point(dst_roi.x, dst_roi.y + rows_warped.start);
+}
+
+} // namespace
+
+cv::Point warpImageAndMask(cv::detail::RotationWarper &warper, cv::InputArray src,
+                           cv::InputArray K, cv::InputArray R, int interp_mode,
+                           int border_mode, cv::OutputArray dst,
+                           cv::OutputArray mask_warped, const WarpedRowsCallback &on_rows,
+                           const cv::Range &dst_rows)
+{
+    if (dynamic_cast<cv::detail::SphericalWarper *>(&warper)) {
+        return warpImageAndMaskTiled<SphericalProjection>(
+                warper, src, K, R, interp_mode, border_mode, dst, mask_warped, on_rows,
+                dst_rows);
+    }
+    if (dynamic_cast<cv::detail::CylindricalWarper *>(&warper)) {
+        return warpImageAndMaskTiled<CylindricalProjection>(
+                warper, src, K, R, interp_mode, border_mode, dst, mask_warped, on_rows,
+                dst_rows);
+    }
+
+    if (dst.isUMat()) {
+        return warpImageAndMaskWithMaps<cv::UMat>(warper, src, K, R, interp_mode,
+                                                  border_mode, dst, mask_warped, on_rows,
+                                                  dst_rows);
+    }
+    return warpImageAndMaskWithMaps<cv::Mat>(warper, src, K, R, interp_mode,
+                                             border_mode, dst, mask_warped, on_rows,
+                                             dst_rows);
+}
+
+} // namespace detail
+} // namespace opencv
+} // namespace stitcher
+} // namespace airmap
@@ -0,0 +1,350 @@
+#include "airmap/stitch_templates.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+
+#include <opencv2/imgcodecs.hpp>
+
+#include <cctype>
+#include <cmath>
+#include <limits>
+#include <sstream>
+
+using boost::filesystem::path;
+
+namespace airmap {
+namespace stitcher {
+
+namespace {
+
+const char *template_file_name = "template.yml";
+
+/**
+ * @brief angleDifference
+ * Signed difference between two angles in degrees, in [-180, 180).
+ */
+double angleDifference(double from, double to)
+{
+    double difference = std::fmod(to - from + 540., 360.);
+    if (difference < 0.) {
+        difference += 360.;
+    }
+    return difference - 180.;
+}
+
+std::string seamMaskFileName(size_t index)
+{
+    return (boost::format("seam_%03d.png") % index).str();
+}
+
+} // namespace
+
+//
+//
+// StitchTemplate
+//
+//
+StitchTemplate StitchTemplate::fromPanorama(const Panorama &panorama)
+{
+    StitchTemplate stitch_template;
+    if (panorama.empty()) {
+        return stitch_template;
+    }
+
+    const GeoImage &first = panorama.front();
+    stitch_template.centre = panorama.centre();
+    stitch_template.camera = first.cameraMake + " " + first.cameraModel;
+    for (const auto &image : panorama) {
+        stitch_template.capture_pattern.push_back(cv::Point2d(
+                angleDifference(first.cameraYawDeg, image.cameraYawDeg),
+                image.cameraPitchDeg));
+    }
+    return stitch_template;
+}
+
+bool StitchTemplate::matches(const Panorama &panorama) const
+{
+    StitchTemplate other = fromPanorama(panorama);
+    if (other.camera != camera
+        || other.capture_pattern.size() != capture_pattern.size()) {
+        return false;
+    }
+
+    if (centre.distance_metres(other.centre) > Panorama::MaxSpatialDistanceMts) {
+        return false;
+    }
+
+    for (size_t i = 0; i < capture_pattern.size(); ++i) {
+        if (std::abs(angleDifference(capture_pattern[i].x, other.capture_pattern[i].x))
+                    > MaxCapturePatternDeviationDeg
+            || std::abs(capture_pattern[i].y - other.capture_pattern[i].y)
+                    > MaxCapturePatternDeviationDeg) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::vector<cv::detail::CameraParams> StitchTemplate::scaleCameras(int width) const
+{
+    double scale = work_width > 0
+            ? static_cast<double>(width) / static_cast<double>(work_width)
+            : 1.;
+    std::vector<cv::detail::CameraParams> scaled_cameras;
+    for (const auto &camera : cameras) {
+        cv::detail::CameraParams scaled_camera(camera);
+        scaled_camera.R = camera.R.clone();
+        scaled_camera.t = camera.t.clone();
+        scaled_camera.focal *= scale;
+        scaled_camera.ppx *= scale;
+        scaled_camera.ppy *= scale;
+        scaled_cameras.push_back(scaled_camera);
+    }
+    return scaled_cameras;
+}
+
+//
+//
+// StitchTemplates
+//
+//
+StitchTemplates::StitchTemplates(const std::string &directory,
+                                 std::shared_ptr<airmap::logging::Logger> logger)
+    : _directory(directory)
+    , _logger(logger)
+{
+}
+
+bool StitchTemplates::find(const Panorama &panorama,
+                           StitchTemplate &stitch_template) const
+{
+    if (!boost::filesystem::is_directory(_directory)) {
+        return false;
+    }
+
+    // Pick the nearest of the matching templates.
+    std::string nearest_directory;
+    float nearest_distance = std::numeric_limits<float>::max();
+    for (const auto &entry : boost::filesystem::directory_iterator(_directory)) {
+        if (!boost::filesystem::is_directory(entry.path())) {
+            continue;
+        }
+
+        StitchTemplate candidate;
+        try {
+            if (!load(entry.path().string(), candidate, false)
+                || !candidate.matches(panorama)) {
+                continue;
+            }
+        } catch (const cv::Exception &e) {
+            std::stringstream message;
+            message << "Ignoring invalid stitch template " << entry.path().string()
+                    << ": " << e.what();
+            _logger->log(logging::Logger::Severity::error, message, "stitcher");
+            continue;
+        }
+
+        float distance = candidate.centre.distance_metres(panorama.centre());
+        if (distance < nearest_distance) {
+            nearest_distance = distance;
+            nearest_directory = entry.path().string();
+        }
+    }
+
+    if (nearest_directory.empty()) {
+        return false;
+    }
+
+    try {
+        if (!load(nearest_directory, stitch_template, true)) {
+            return false;
+        }
+    } catch (const cv::Exception &e) {
+        std::stringstream message;
+        message << "Failed to load stitch template " << nearest_directory << ": "
+                << e.what();
+        _logger->log(logging::Logger::Severity::error, message, "stitcher");
+        return false;
+    }
+
+    std::stringstream message;
+    message << "Found stitch template " << nearest_directory << ".";
+    _logger->log(logging::Logger::Severity::info, message, "stitcher");
+    return true;
+}
+
+void StitchTemplates::save(const StitchTemplate &stitch_template) const
+{
+    path directory = stitch_template.directory.empty()
+            ? path(siteDirectory(stitch_template))
+            : path(stitch_template.directory);
+    boost::filesystem::create_directories(directory);
+
+    // Write the seam masks first, so that an interrupted save leaves no
+    // template file behind.
+    boost::filesystem::remove(directory / template_file_name);
+    for (size_t i = 0; i < stitch_template.seam_masks.size(); ++i) {
+        cv::imwrite((directory / seamMaskFileName(i)).string(),
+                    stitch_template.seam_masks[i]);
+    }
+
+    cv::FileStorage fs((directory / template_file_name).string(),
+                       cv::FileStorage::WRITE);
+    fs << "centre_lng" << stitch_template.centre.lng();
+    fs << "centre_lat" << stitch_template.centre.lat();
+    fs << "camera" << stitch_template.camera;
+    fs << "capture_pattern" << stitch_template.capture_pattern;
+    fs << "work_width" << stitch_template.work_width;
+    fs << "cameras" << "[";
+    for (const auto &camera_params : stitch_template.cameras) {
+        fs << "{";
+        fs << "focal" << camera_params.focal;
+        fs << "aspect" << camera_params.aspect;
+        fs << "ppx" << camera_params.ppx;
+        fs << "ppy" << camera_params.ppy;
+        fs << "R" << camera_params.R;
+        fs << "t" << camera_params.t;
+        fs << "}";
+    }
+    fs << "]";
+    fs << "corners" << stitch_template.corners;
+    fs << "gains" << "[";
+    for (const auto &gain : stitch_template.gains) {
+        fs << gain;
+    }
+    fs << "]";
+    fs << "exposure_compensator_type"
+       << static_cast<int>(stitch_template.exposure_compensator_type);
+    fs << "exposure_compensation_block_size"
+       << stitch_template.exposure_compensation_block_size;
+    fs.release();
+
+    std::stringstream message;
+    message << "Saved stitch template " << directory.string() << ".";
+    _logger->log(logging::Logger::Severity::info, message, "stitcher");
+}
+
+std::string StitchTemplates::siteDirectory(const StitchTemplate &stitch_template) const
+{
+    // Replace the nearest template of the site, if there is one.
+    std::string nearest_directory;
+    float nearest_distance = std::numeric_limits<float>::max();
+    if (boost::filesystem::is_directory(_directory)) {
+        for (const auto &entry : boost::filesystem::directory_iterator(_directory)) {
+            if (!boost::filesystem::is_directory(entry.path())) {
+                continue;
+            }
+
+            StitchTemplate candidate;
+            try {
+                if (!load(entry.path().string(), candidate, false)
+                    || candidate.camera != stitch_template.camera
+                    || candidate.capture_pattern.size()
+                            != stitch_template.capture_pattern.size()) {
+                    continue;
+                }
+            } catch (const cv::Exception &) {
+                continue;
+            }
+
+            float distance = candidate.centre.distance_metres(stitch_template.centre);
+            if (distance <= Panorama::MaxSpatialDistanceMts
+                && distance < nearest_distance) {
+                nearest_distance = distance;
+                nearest_directory = entry.path().string();
+            }
+        }
+    }
+    if (!nearest_directory.empty()) {
+        return nearest_directory;
+    }
+
+    std::string camera = stitch_template.camera;
+    for (auto &c : camera) {
+        if (!std::isalnum(static_cast<unsigned char>(c))) {
+            c = '_';
+        }
+    }
+    return (path(_directory)
+            / (boost::format("%1$.6f_%2$.6f_%3%_%4%") % stitch_template.centre.lat()
+               % stitch_template.centre.lng() % camera
+               % stitch_template.capture_pattern.size())
+                      .str())
+            .string();
+}
+
+bool StitchTemplates::load(const std::string &directory,
+                           StitchTemplate &stitch_template,
+                           bool load_seam_masks) const
+{
+    cv::FileStorage fs((path(directory) / template_file_name).string(),
+                       cv::FileStorage::READ);
+    if (!fs.isOpened()) {
+        return false;
+    }
+
+    double lng, lat;
+    fs["centre_lng"] >> lng;
+    fs["centre_lat"] >> lat;
+    stitch_template.centre = geocoordinate_t { lng, lat };
+    fs["camera"] >> stitch_template.camera;
+    fs["capture_pattern"] >> stitch_template.capture_pattern;
+    fs["work_width"] >> stitch_template.work_width;
+    stitch_template.directory = directory;
+
+    // The key is all that is needed to find a matching template.
+    if (!load_seam_masks) {
+        return true;
+    }
+
+    stitch_template.cameras.clear();
+    cv::FileNode cameras = fs["cameras"];
+    for (auto it = cameras.begin(); it != cameras.end(); ++it) {
+        cv::detail::CameraParams camera_params;
+        (*it)["focal"] >> camera_params.focal;
+        (*it)["aspect"] >> camera_params.aspect;
+        (*it)["ppx"] >> camera_params.ppx;
+        (*it)["ppy"] >> camera_params.ppy;
+        (*it)["R"] >> camera_params.R;
+        (*it)["t"] >> camera_params.t;
+        stitch_template.cameras.push_back(camera_params);
+    }
+
+    fs["corners"] >> stitch_template.corners;
+
+    stitch_template.gains.clear();
+    cv::FileNode gains = fs["gains"];
+    for (auto it = gains.begin(); it != gains.end(); ++it) {
+        cv::Mat gain;
+        *it >> gain;
+        stitch_template.gains.push_back(gain);
+    }
+
+    // Gains of templates that don't say which compensator they are from
+    // aren't reused.
+    int exposure_compensator_type;
+    cv::read(fs["exposure_compensator_type"], exposure_compensator_type, -1);
+    if (exposure_compensator_type < 0) {
+        stitch_template.gains.clear();
+    }
+    stitch_template.exposure_compensator_type =
+            static_cast<ExposureCompensatorType>(exposure_compensator_type);
+    fs["exposure_compensation_block_size"] >> stitch_template.exposure_compensation_block_size;
+
+    stitch_template.seam_masks.clear();
+    for (size_t i = 0; i < stitch_template.cameras.size(); ++i) {
+        cv::Mat seam_mask = cv::imread((path(directory) / seamMaskFileName(i)).string(),
+                                       cv::IMREAD_GRAYSCALE);
+        if (seam_mask.empty()) {
+            return false;
+        }
+        stitch_template.seam_masks.push_back(seam_mask);
+    }
+
+    return stitch_template.cameras.size() == stitch_template.capture_pattern.size()
+            && stitch_template.corners.size() == stitch_template.cameras.size();
+}
+
+} // namespace stitcher
+} // namespace airmap
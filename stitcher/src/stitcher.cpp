@@ -1,9 +1,18 @@
 #include "airmap/opencv_stitcher.h"
 #include "cropper.h"
 #include "cubemap.h"
+#include "tile_pyramid.h"
 
 #include "airmap/camera_models.h"
 
+#include <algorithm>
+#include <cfloat>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <numeric>
+#include <thread>
+
 #include <opencv2/core/ocl.hpp>
 #include <opencv2/core/utility.hpp>
 #include <opencv2/highgui.hpp>
@@ -21,8 +30,20 @@
 #include <opencv2/stitching/detail/warpers.hpp>
 #include <opencv2/stitching/warpers.hpp>
 
+using FixedPointMultiBandBlender =
+    airmap::stitcher::opencv::detail::FixedPointMultiBandBlender;
 using MonitoredGraphCutSeamFinder =
     airmap::stitcher::opencv::detail::MonitoredGraphCutSeamFinder;
+using ParallelBlocksGainCompensator =
+    airmap::stitcher::opencv::detail::ParallelBlocksGainCompensator;
+using ParallelVoronoiSeamFinder =
+    airmap::stitcher::opencv::detail::ParallelVoronoiSeamFinder;
+using SeamBandBlender = airmap::stitcher::opencv::detail::SeamBandBlender;
+using SparseBundleAdjusterRay =
+    airmap::stitcher::opencv::detail::SparseBundleAdjusterRay;
+using airmap::stitcher::opencv::detail::findSeamRegions;
+using airmap::stitcher::opencv::detail::warpImageAndMask;
+using airmap::stitcher::opencv::detail::WarpedRowsCallback;
 
 namespace airmap {
 namespace stitcher {
@@ -108,27 +129,34 @@ Stitcher::Report OpenCVStitcher::stitch()
 
 void OpenCVStitcher::cancel() { }
 
-void OpenCVStitcher::postprocess(cv::Mat &&result)
+void OpenCVStitcher::postprocess(cv::Mat &&result, cv::Mat &&result_mask,
+                                 bool full_sphere)
 {
     // Crop any null regions from the sides or bottoms.
     // This will also crop null regions from the sky too, but that will be added back in
-    // below.
-    if (_parameters.maximumCropRatio < 1.0) {
-        result = Cropper {}.cropNullEdges(result, _parameters.maximumCropRatio);
+    // below.  The null regions are those outside of the result mask of the blender when
+    // there is one, rather than all black pixels.  A full sphere panorama is already
+    // where it belongs in the equirectangular frame, and is kept as is.
+    if (!full_sphere && _parameters.maximumCropRatio < 1.0) {
+        result = Cropper {}.cropNullEdges(result, result_mask,
+                                          _parameters.maximumCropRatio);
     }
+    result_mask.release();
 
     // force the image to 2x1 aspect ratio (consistent with a full equirectangular-ly
     // projected sphere) by adding artificial sky.
-    int leftPadding = result.cols % 2;
-    int topPadding = (result.cols + leftPadding) / 2 - result.rows;
-    if (topPadding >= 0) { // pad
-        cv::copyMakeBorder(result, result, topPadding, 0, leftPadding, 0,
-                           cv::BORDER_REPLICATE);
-    } else { // crop
-        int cols = result.cols - leftPadding;
-        int rows = cols / 2;
-        assert(result.rows > rows);
-        result = result(cv::Rect { 0, result.rows - rows, cols, rows });
+    if (!full_sphere) {
+        int leftPadding = result.cols % 2;
+        int topPadding = (result.cols + leftPadding) / 2 - result.rows;
+        if (topPadding >= 0) { // pad
+            cv::copyMakeBorder(result, result, topPadding, 0, leftPadding, 0,
+                               cv::BORDER_REPLICATE);
+        } else { // crop
+            int cols = result.cols - leftPadding;
+            int rows = cols / 2;
+            assert(result.rows > rows);
+            result = result(cv::Rect { 0, result.rows - rows, cols, rows });
+        }
     }
     assert(result.rows == result.cols / 2);
 
@@ -136,6 +164,12 @@ void OpenCVStitcher::postprocess(cv::Mat &&result)
     std::stringstream message;
     message << "Written stitched image to " << _outputPath << std::endl;
     _logger->log(logging::Logger::Severity::info, message, "stitcher");
+
+    // Face maps are kept for the next panoramas, within a share of the memory
+    // budget.
+    if (_parameters.alsoCreateCubeMap || !_parameters.tilePyramidPath.empty()) {
+        CubeMap::setFaceMapsCacheLimit(_parameters.memoryBudgetMB * 1024 * 1024 / 8);
+    }
     if (_parameters.alsoCreateCubeMap) {
         std::string base_path = (path(_outputPath).parent_path()
                                  / path(_outputPath).stem())
@@ -153,6 +187,14 @@ void OpenCVStitcher::postprocess(cv::Mat &&result)
                 << std::endl;
         _logger->log(logging::Logger::Severity::info, message, "stitcher");
     }
+    if (!_parameters.tilePyramidPath.empty()) {
+        TilePyramid::write(result, _parameters.tilePyramidPath,
+                           _parameters.tilePyramidTileSize);
+        std::stringstream message;
+        message << "Written tile pyramid of the stitched image to "
+                << _parameters.tilePyramidPath << std::endl;
+        _logger->log(logging::Logger::Severity::info, message, "stitcher");
+    }
 }
 
 //! stitcher::stitcher class
@@ -166,18 +208,27 @@ LowLevelOpenCVStitcher::LowLevelOpenCVStitcher(
                      debugPath)
     , _config(_camera ? _camera->configuration(config, config.stitch_type)
                       : config)
+    , _stitchTemplates(parameters.stitchTemplatesPath.empty()
+                               ? nullptr
+                               : std::make_shared<StitchTemplates>(
+                                       parameters.stitchTemplatesPath, logger))
 {
 }
 
 void LowLevelOpenCVStitcher::adjustCameraParameters(
         std::vector<cv::detail::ImageFeatures> &features,
         std::vector<cv::detail::MatchesInfo> &matches,
-        std::vector<cv::detail::CameraParams> &cameras)
+        std::vector<cv::detail::CameraParams> &cameras, int max_iterations)
 {
     _monitor->changeOperation(monitor::Operation::AdjustCameraParameters());
 
     _logger->log(logging::Logger::Severity::info, "Adjusting camera parameters.", "stitcher");
     auto bundle_adjuster = getBundleAdjuster();
+    if (max_iterations > 0) {
+        bundle_adjuster->setTermCriteria(
+                cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS,
+                                 max_iterations, DBL_EPSILON));
+    }
     if (!(*bundle_adjuster)(features, matches, cameras)) {
         std::string message = "Failed to adjust camera parameters.";
         _logger->log(logging::Logger::Severity::error, message.c_str(), "stitcher");
@@ -186,11 +237,144 @@ void LowLevelOpenCVStitcher::adjustCameraParameters(
     _logger->log(logging::Logger::Severity::info, "Finished adjusting camera parameters.", "stitcher");
 }
 
+bool LowLevelOpenCVStitcher::adjustTemplateCameraParameters(
+        const StitchTemplate &stitch_template, SourceImages &source_images,
+        std::vector<cv::detail::ImageFeatures> &features,
+        std::vector<cv::detail::CameraParams> &cameras, bool &unchanged)
+{
+    // Iterations of the bundle adjustment refining the template cameras.
+    constexpr int max_iterations = 20;
+    // Maximum rotation of any camera away from the template, beyond which
+    // the capture is considered not to match the template.
+    constexpr double max_deviation_deg = 2.;
+    // Maximum deviation in pixels at work scale, under which the template
+    // cameras are reused as they are, along with the template seams.
+    constexpr double max_unchanged_deviation_px = 1.;
+
+    const int image_count = static_cast<int>(features.size());
+    if (static_cast<int>(stitch_template.cameras.size()) != image_count) {
+        return false;
+    }
+
+    _logger->log(logging::Logger::Severity::info,
+                 "Verifying capture against stitch template.", "stitcher");
+    auto template_cameras =
+            stitch_template.scaleCameras(features[0].img_size.width);
+    std::vector<cv::Mat> template_rotations;
+    for (const auto &camera : template_cameras) {
+        cv::Mat R;
+        camera.R.convertTo(R, CV_64F);
+        template_rotations.push_back(R);
+    }
+
+    // Only match pairs of images whose fields of view overlap in the template.
+    cv::Mat_<uchar> match_mask(image_count, image_count, uchar(0));
+    for (int i = 0; i < image_count; ++i) {
+        double fov_i = std::atan2(
+                std::hypot(template_cameras[i].ppx, template_cameras[i].ppy),
+                template_cameras[i].focal);
+        for (int j = i + 1; j < image_count; ++j) {
+            double fov_j = std::atan2(
+                    std::hypot(template_cameras[j].ppx, template_cameras[j].ppy),
+                    template_cameras[j].focal);
+            double cos_angle =
+                    template_rotations[i].col(2).dot(template_rotations[j].col(2));
+            if (std::acos(std::max(-1., std::min(1., cos_angle))) < fov_i + fov_j) {
+                match_mask(i, j) = 1;
+            }
+        }
+    }
+
+    auto matches = matchFeatures(features, match_mask.getUMat(cv::ACCESS_READ));
+    debugMatches(source_images.images_scaled, features, matches,
+                 _config.match_conf_thresh, _debugPath / "matches");
+
+    // All images must remain connected.
+    cv::detail::DisjointSets components(image_count);
+    for (int i = 0; i < image_count; ++i) {
+        for (int j = i + 1; j < image_count; ++j) {
+            if (matches[i * image_count + j].confidence < _config.match_conf_thresh) {
+                continue;
+            }
+            int component_i = components.findSetByElem(i);
+            int component_j = components.findSetByElem(j);
+            if (component_i != component_j) {
+                components.mergeSets(component_i, component_j);
+            }
+        }
+    }
+    if (components.size[components.findSetByElem(0)] != image_count) {
+        _logger->log(logging::Logger::Severity::info,
+                     "Capture doesn't match stitch template, not all images matched.",
+                     "stitcher");
+        return false;
+    }
+
+    // Refine the template cameras.
+    cameras = stitch_template.scaleCameras(features[0].img_size.width);
+    try {
+        adjustCameraParameters(features, matches, cameras, max_iterations);
+    } catch (const std::invalid_argument &) {
+        return false;
+    }
+
+    // Bundle adjustment normalizes rotations to a camera of its choosing.
+    // Bring them back into the frame of the template, which is already wave
+    // corrected and oriented, by the rotation that best aligns them.
+    cv::Mat correlation = cv::Mat::zeros(3, 3, CV_64F);
+    std::vector<cv::Mat> rotations;
+    for (int i = 0; i < image_count; ++i) {
+        cv::Mat R;
+        cameras[i].R.convertTo(R, CV_64F);
+        rotations.push_back(R);
+        correlation += template_rotations[i] * R.t();
+    }
+    cv::SVD svd(correlation);
+    cv::Mat u = svd.u.clone();
+    if (cv::determinant(u * svd.vt) < 0) {
+        u.col(2) *= -1.;
+    }
+    cv::Mat alignment = u * svd.vt;
+
+    double deviation_deg = 0.;
+    double deviation_px = 0.;
+    for (int i = 0; i < image_count; ++i) {
+        rotations[i] = alignment * rotations[i];
+        rotations[i].convertTo(cameras[i].R, CV_32F);
+
+        cv::Mat difference = template_rotations[i].t() * rotations[i];
+        double angle = std::acos(std::max(
+                -1., std::min(1., (cv::trace(difference)[0] - 1.) / 2.)));
+        double radius = std::hypot(template_cameras[i].ppx, template_cameras[i].ppy);
+        deviation_deg = std::max(deviation_deg, angle * 180. / M_PI);
+        deviation_px = std::max(
+                deviation_px,
+                angle * cameras[i].focal
+                        + std::abs(cameras[i].focal - template_cameras[i].focal)
+                                * radius / template_cameras[i].focal);
+    }
+
+    std::stringstream message;
+    message << "Cameras deviate from stitch template by up to " << deviation_deg
+            << " degrees.";
+    _logger->log(logging::Logger::Severity::info, message, "stitcher");
+    if (deviation_deg > max_deviation_deg) {
+        return false;
+    }
+
+    unchanged = deviation_px < max_unchanged_deviation_px;
+    if (unchanged) {
+        cameras = template_cameras;
+    }
+    return true;
+}
+
 void LowLevelOpenCVStitcher::compose(
         SourceImages &source_images, std::vector<cv::detail::CameraParams> &cameras,
         cv::Ptr<cv::detail::ExposureCompensator> &exposure_compensator,
         LowLevelOpenCVStitcher::WarpResults &warp_results, double work_scale,
-        double compose_scale, float warped_image_scale, cv::Mat &result)
+        double compose_scale, float warped_image_scale, cv::Mat &result,
+        cv::Mat &result_mask)
 {
     _monitor->changeOperation(monitor::Operation::Compose());
     _logger->log(logging::Logger::Severity::info, "Composing stitched image.", "stitcher");
@@ -198,12 +382,15 @@ void LowLevelOpenCVStitcher::compose(
     // compute relative scales
     float compose_work_aspect =
             static_cast<float>(compose_scale / static_cast<double>(work_scale));
-    // update warped image scale
-    float compose_work_scale = warped_image_scale * compose_work_aspect;
+    // update warped image scale, or map the sphere onto the compose canvas
+    float compose_work_scale = getComposeWorkScale(warped_image_scale, compose_work_aspect);
 
     auto warp_creator = getWarperCreator();
     auto warper = warp_creator->create(compose_work_scale);
 
+    // seam scale corners, to locate the seams at compose scale
+    std::vector<cv::Point> seam_corners = warp_results.corners;
+
     // update corners and sizes
     for (size_t i = 0; i < source_images.images_scaled.size(); ++i) {
         // update intrinsics
@@ -221,62 +408,240 @@ void LowLevelOpenCVStitcher::compose(
         warp_results.corners[i] = roi.tl();
         warp_results.sizes[i] = roi.size();
     }
-
-    auto blender = prepareBlender(warp_results);
-    warp_results.masks.clear();
     warp_results.images_warped.clear();
 
-    cv::Mat image_warped, image_warped_s;
-    cv::Mat dilated_mask, seam_mask, mask, mask_warped;
+    std::vector<cv::Rect> seams;
+    if (_config.blender_type == SeamBandBlender::SEAM_BAND) {
+        seams = findSeamRegions(warp_results.masks_warped, seam_corners,
+                                warp_results.corners, warp_results.sizes);
+    }
 
-    for (size_t i = 0; i < source_images.images_scaled.size(); ++i) {
-        cv::Size image_size = source_images.images_scaled[i].size();
+    if (_config.compose_tile_size > 0) {
+        composeTiles(source_images, cameras, exposure_compensator, warp_results,
+                     compose_work_scale, seams, result, result_mask);
+    } else {
+        size_t image_count = source_images.images_scaled.size();
+        std::vector<size_t> indices(image_count);
+        std::iota(indices.begin(), indices.end(), 0);
+
+        auto blender = prepareBlender(warp_results);
+        if (auto *seam_band_blender = dynamic_cast<SeamBandBlender *>(blender.get())) {
+            std::vector<cv::Rect> images;
+            for (size_t i = 0; i < image_count; ++i) {
+                images.push_back(cv::Rect(warp_results.corners[i], warp_results.sizes[i]));
+            }
+            seam_band_blender->setSeams(seams, images);
+        }
+        feedBlender(source_images, cameras, exposure_compensator, warp_results,
+                    compose_work_scale, indices, composeRoi(warp_results),
+                    std::vector<bool>(image_count, true), *blender, 0., 1.);
 
-        cv::Mat K;
-        cameras[i].K().convertTo(K, CV_32F);
+        blender->blend(result, result_mask);
+    }
 
-        // warp the current image
-        warper->warp(source_images.images_scaled[i], K, cameras[i].R, cv::INTER_LINEAR, cv::BORDER_REFLECT,
-                     image_warped);
-        source_images.images_scaled[i].release();
-
-        // warp the current image mask
-        mask.create(image_size, CV_8U);
-        mask.setTo(cv::Scalar::all(255));
-        warper->warp(mask, K, cameras[i].R, cv::INTER_NEAREST, cv::BORDER_CONSTANT,
-                     mask_warped);
-
-        // compensate exposure
-        exposure_compensator->apply(static_cast<int>(i), warp_results.corners[i],
-                                    image_warped, mask_warped);
-
-        image_warped.convertTo(image_warped_s, CV_16S);
-        image_warped.release();
-        mask.release();
-
-        cv::dilate(warp_results.masks_warped[i], dilated_mask, cv::Mat());
-        warp_results.masks_warped[i].release();
-        cv::resize(dilated_mask, seam_mask, mask_warped.size(), 0, 0,
-                   cv::INTER_LINEAR_EXACT);
-        dilated_mask.release();
-        mask_warped = seam_mask & mask_warped;
-        seam_mask.release();
-
-        // blend the current image
-        blender->feed(image_warped_s, mask_warped, warp_results.corners[i]);
-        image_warped_s.release();
-        mask_warped.release();
-
-        _monitor->updateCurrentOperation(
-            static_cast<double>(i) /
-            static_cast<double>(source_images.images_scaled.size()));
-    }
-
-    cv::Mat result_mask;
-    blender->blend(result, result_mask);
     _logger->log(logging::Logger::Severity::info, "Finished composing stitched image.", "stitcher");
 }
 
+cv::Rect LowLevelOpenCVStitcher::composeRoi(const WarpResults &warp_results)
+{
+    cv::Rect canvas = getComposeCanvas();
+    return canvas.empty() ? cv::detail::resultRoi(warp_results.corners, warp_results.sizes)
+                          : canvas;
+}
+
+void LowLevelOpenCVStitcher::composeTiles(
+        SourceImages &source_images, std::vector<cv::detail::CameraParams> &cameras,
+        cv::Ptr<cv::detail::ExposureCompensator> &exposure_compensator,
+        WarpResults &warp_results, float compose_work_scale,
+        const std::vector<cv::Rect> &seams, cv::Mat &result, cv::Mat &result_mask)
+{
+    size_t image_count = source_images.images_scaled.size();
+    cv::Rect dst_roi = composeRoi(warp_results);
+
+    // Strips are blended with the same settings as the whole panorama.  The
+    // halo around each strip has to cover the reach of the blend: about
+    // 2^(bands + 2) pixels for the multi-band pyramid, the blend width for
+    // feathering.  Keeping strips aligned to the coarsest pyramid level puts
+    // their pyramids on the same grid as that of the whole panorama.
+    auto blender = createBlender(dst_roi.size());
+    int alignment = 1;
+    int halo = 0;
+    if (auto *multiband_blender =
+                dynamic_cast<cv::detail::MultiBandBlender *>(blender.get())) {
+        alignment = 1 << multiband_blender->numBands();
+        halo = 4 * alignment;
+    } else if (auto *fixed_point_blender =
+                       dynamic_cast<FixedPointMultiBandBlender *>(blender.get())) {
+        alignment = 1 << fixed_point_blender->numBands();
+        halo = 4 * alignment;
+    } else if (auto *seam_band_blender = dynamic_cast<SeamBandBlender *>(blender.get())) {
+        alignment = 1 << seam_band_blender->numBands();
+        halo = 4 * alignment;
+    } else if (auto *feather_blender =
+                       dynamic_cast<cv::detail::FeatherBlender *>(blender.get())) {
+        halo = static_cast<int>(std::ceil(1.f / feather_blender->sharpness()));
+    }
+    int tile_rows = (_config.compose_tile_size + alignment - 1) / alignment * alignment;
+
+    std::vector<cv::Rect> tiles, halo_tiles;
+    for (int y = dst_roi.y; y < dst_roi.br().y; y += tile_rows) {
+        cv::Rect tile(dst_roi.x, y, dst_roi.width, tile_rows);
+        tiles.push_back(tile & dst_roi);
+        halo_tiles.push_back(cv::Rect(dst_roi.x, y - halo, dst_roi.width,
+                                      tile_rows + 2 * halo)
+                             & dst_roi);
+    }
+
+    // Images are only kept until the last strip they overlap.
+    std::vector<int> last_tile(image_count, -1);
+    for (size_t t = 0; t < tiles.size(); ++t) {
+        for (size_t i = 0; i < image_count; ++i) {
+            cv::Rect image_roi(warp_results.corners[i], warp_results.sizes[i]);
+            if ((image_roi & halo_tiles[t]).area() > 0) {
+                last_tile[i] = static_cast<int>(t);
+            }
+        }
+    }
+
+    std::stringstream message;
+    message << "Composing " << tiles.size() << " strips of " << tile_rows
+            << " rows, with a halo of " << halo << " rows.";
+    _logger->log(logging::Logger::Severity::info, message, "stitcher");
+
+    for (size_t t = 0; t < tiles.size(); ++t) {
+        std::vector<size_t> indices;
+        std::vector<bool> last_use(image_count, false);
+        for (size_t i = 0; i < image_count; ++i) {
+            cv::Rect image_roi(warp_results.corners[i], warp_results.sizes[i]);
+            if ((image_roi & halo_tiles[t]).area() > 0) {
+                indices.push_back(i);
+                last_use[i] = last_tile[i] == static_cast<int>(t);
+            }
+        }
+        if (indices.empty()) {
+            continue;
+        }
+
+        auto tile_blender = createBlender(dst_roi.size(), false);
+        tile_blender->prepare(halo_tiles[t]);
+        if (auto *seam_band_blender = dynamic_cast<SeamBandBlender *>(tile_blender.get())) {
+            std::vector<cv::Rect> images;
+            for (size_t i : indices) {
+                images.push_back(cv::Rect(warp_results.corners[i], warp_results.sizes[i]));
+            }
+            seam_band_blender->setSeams(seams, images);
+        }
+        feedBlender(source_images, cameras, exposure_compensator, warp_results,
+                    compose_work_scale, indices, halo_tiles[t], last_use,
+                    *tile_blender, static_cast<double>(t) / tiles.size(),
+                    static_cast<double>(t + 1) / tiles.size());
+
+        cv::Mat tile_result, tile_result_mask;
+        tile_blender->blend(tile_result, tile_result_mask);
+        tile_blender.release();
+
+        // Keep the strip without its halo.
+        if (result.empty()) {
+            result.create(dst_roi.size(), tile_result.type());
+            result.setTo(cv::Scalar::all(0));
+            result_mask.create(dst_roi.size(), CV_8U);
+            result_mask.setTo(cv::Scalar::all(0));
+        }
+        cv::Rect tile_in_halo_tile = tiles[t] - halo_tiles[t].tl();
+        tile_result(tile_in_halo_tile).copyTo(result(tiles[t] - dst_roi.tl()));
+        tile_result_mask(tile_in_halo_tile).copyTo(result_mask(tiles[t] - dst_roi.tl()));
+    }
+}
+
+cv::Ptr<cv::detail::Blender>
+LowLevelOpenCVStitcher::createBlender(const cv::Size &destination_size, bool log_settings)
+{
+    cv::Ptr<cv::detail::Blender> blender;
+    if (_config.blender_type == FixedPointMultiBandBlender::FIXED_POINT_MULTI_BAND) {
+        blender = cv::makePtr<FixedPointMultiBandBlender>();
+    } else if (_config.blender_type == SeamBandBlender::SEAM_BAND) {
+        blender = cv::makePtr<SeamBandBlender>();
+    } else {
+        blender = cv::detail::Blender::createDefault(_config.blender_type,
+                                                     _config.try_cuda);
+    }
+    float blend_width = cv::sqrt(static_cast<float>(destination_size.area()))
+            * _config.blend_strength / 100.f;
+    int num_bands = blend_width < 1.f
+            ? 0
+            : static_cast<int>(ceil(log(static_cast<double>(blend_width)) / log(2.)) - 1.);
+
+    if (blend_width < 1.f) {
+        blender = cv::detail::Blender::createDefault(cv::detail::Blender::NO,
+                                                     _config.try_cuda);
+    } else if (_config.blender_type == cv::detail::Blender::MULTI_BAND) {
+        auto *multiband_blender =
+                dynamic_cast<cv::detail::MultiBandBlender *>(blender.get());
+        multiband_blender->setNumBands(num_bands);
+        if (log_settings) {
+            std::stringstream message;
+            message << "Multi-band blender prepared with "
+                    << multiband_blender->numBands() << " bands.";
+            _logger->log(logging::Logger::Severity::info, message, "stitcher");
+        }
+    } else if (_config.blender_type == FixedPointMultiBandBlender::FIXED_POINT_MULTI_BAND) {
+        auto *multiband_blender = dynamic_cast<FixedPointMultiBandBlender *>(blender.get());
+        multiband_blender->setNumBands(num_bands);
+        if (log_settings) {
+            std::stringstream message;
+            message << "Fixed-point multi-band blender prepared with "
+                    << multiband_blender->numBands() << " bands.";
+            _logger->log(logging::Logger::Severity::info, message, "stitcher");
+        }
+    } else if (_config.blender_type == SeamBandBlender::SEAM_BAND) {
+        auto *seam_band_blender = dynamic_cast<SeamBandBlender *>(blender.get());
+        seam_band_blender->setNumBands(num_bands);
+        if (log_settings) {
+            std::stringstream message;
+            message << "Seam band blender prepared with " << seam_band_blender->numBands()
+                    << " bands.";
+            _logger->log(logging::Logger::Severity::info, message, "stitcher");
+        }
+    } else if (_config.blender_type == cv::detail::Blender::FEATHER) {
+        auto *feather_blender = dynamic_cast<cv::detail::FeatherBlender *>(blender.get());
+        feather_blender->setSharpness(1.f / blend_width);
+        if (log_settings) {
+            std::stringstream message;
+            message << "Feather blender prepared with " << feather_blender->sharpness()
+                    << " sharpness.";
+            _logger->log(logging::Logger::Severity::info, message, "stitcher");
+        }
+    }
+
+    return blender;
+}
+
+StitchTemplate LowLevelOpenCVStitcher::createStitchTemplate(
+        const std::vector<cv::detail::CameraParams> &cameras,
+        WarpResults &warp_results,
+        cv::Ptr<cv::detail::ExposureCompensator> &exposure_compensator,
+        int work_width)
+{
+    StitchTemplate stitch_template = StitchTemplate::fromPanorama(_panorama);
+    stitch_template.work_width = work_width;
+    for (const auto &camera : cameras) {
+        cv::detail::CameraParams template_camera(camera);
+        template_camera.R = camera.R.clone();
+        template_camera.t = camera.t.clone();
+        stitch_template.cameras.push_back(template_camera);
+    }
+    stitch_template.corners = warp_results.corners;
+    stitch_template.seam_masks.resize(warp_results.masks_warped.size());
+    for (size_t i = 0; i < warp_results.masks_warped.size(); ++i) {
+        warp_results.masks_warped[i].copyTo(stitch_template.seam_masks[i]);
+    }
+    exposure_compensator->getMatGains(stitch_template.gains);
+    stitch_template.exposure_compensator_type = _config.exposure_compensator_type;
+    stitch_template.exposure_compensation_block_size =
+            _config.exposure_compensation_block_size;
+    return stitch_template;
+}
+
 void LowLevelOpenCVStitcher::debugFeatures(SourceImages &source_images,
         std::vector<cv::detail::ImageFeatures> &features,
         cv::DrawMatchesFlags flags)
@@ -397,6 +762,239 @@ std::vector<cv::detail::CameraParams> LowLevelOpenCVStitcher::estimateCameraPara
     return cameras;
 }
 
+std::vector<cv::detail::CameraParams>
+LowLevelOpenCVStitcher::estimateCameraParametersFromPose(SourceImages &source_images)
+{
+    _monitor->changeOperation(monitor::Operation::EstimateCameraParameters());
+
+    _logger->log(logging::Logger::Severity::info,
+                 "Estimating camera parameters from gimbal orientations.", "stitcher");
+
+    // Intrinsics of the camera model are for the full sensor resolution.
+    double scale = static_cast<double>(source_images.images_scaled[0].cols)
+            / _camera->sensorDimensionsPixels().x;
+    cv::Mat K = _camera->K(scale);
+
+    std::vector<cv::detail::CameraParams> cameras(source_images.images_scaled.size());
+    for (size_t i = 0; i < cameras.size(); ++i) {
+        cameras[i].focal = K.at<double>(0, 0);
+        cameras[i].aspect = K.at<double>(1, 1) / K.at<double>(0, 0);
+        cameras[i].ppx = K.at<double>(0, 2);
+        cameras[i].ppy = K.at<double>(1, 2);
+        source_images.gimbal_orientations[i].cameraRotation().convertTo(cameras[i].R,
+                                                                        CV_32F);
+    }
+
+    _logger->log(logging::Logger::Severity::info,
+                 "Finished camera parameters estimation.", "stitcher");
+    return cameras;
+}
+
+std::vector<cv::detail::CameraParams>
+LowLevelOpenCVStitcher::estimateCameraParametersFromMatches(
+        SourceImages &source_images, std::vector<cv::detail::ImageFeatures> &features,
+        std::vector<cv::detail::MatchesInfo> &matches)
+{
+    debugMatches(source_images.images_scaled, features, matches,
+                 _config.match_conf_thresh, _debugPath / "matches");
+
+    // Filter images with poor matching.
+    auto keep_indices = cv::detail::leaveBiggestComponent(
+            features, matches, static_cast<float>(_config.match_conf_thresh));
+    source_images.filter(keep_indices);
+
+    // Estimate and refine camera parameters.
+    auto cameras = estimateCameraParameters(features, matches);
+    adjustCameraParameters(features, matches, cameras);
+
+    // Perform wave correction.
+    waveCorrect(cameras);
+
+    return cameras;
+}
+
+void LowLevelOpenCVStitcher::feedBlender(
+        SourceImages &source_images, std::vector<cv::detail::CameraParams> &cameras,
+        cv::Ptr<cv::detail::ExposureCompensator> &exposure_compensator,
+        WarpResults &warp_results, float compose_work_scale,
+        const std::vector<size_t> &indices, const cv::Rect &roi,
+        const std::vector<bool> &last_use, cv::detail::Blender &blender,
+        double progress_start, double progress_end)
+{
+    // Images are warped, compensated and masked ahead of time by a pool of
+    // workers, while they are fed to the blender in order, which is the only
+    // step that has to be serialised.  Prepared images waiting to be fed are
+    // bounded by a share of the memory budget, except for the next image to
+    // feed, which is always prepared.
+    //
+    // Only the rows of the images in the region are warped.  OpenCV's block
+    // compensators scale their gain maps to the size of the image they
+    // compensate, so images are warped in full for them.
+    auto warp_creator = getWarperCreator();
+    auto *gain_compensator =
+            dynamic_cast<ParallelBlocksGainCompensator *>(exposure_compensator.get());
+    bool warp_rows = gain_compensator
+            || !dynamic_cast<cv::detail::BlocksCompensator *>(exposure_compensator.get());
+    cv::Range dst_rows = warp_rows ? cv::Range(roi.y, roi.br().y) : cv::Range::all();
+    size_t image_count = indices.size();
+    size_t budget_bytes = _parameters.memoryBudgetMB * 1024 * 1024 / 4;
+    auto prepared_bytes = [&warp_results, &indices, &roi](size_t k) {
+        // CV_16SC3 image and CV_8U mask.
+        size_t i = indices[k];
+        cv::Rect image_roi(warp_results.corners[i], warp_results.sizes[i]);
+        return static_cast<size_t>((image_roi & roi).area()) * 7;
+    };
+
+    struct PreparedImage
+    {
+        cv::Mat image;
+        cv::Mat mask;
+        cv::Point corner;
+        bool ready = false;
+    };
+    std::vector<PreparedImage> prepared(image_count);
+    std::mutex mutex;
+    std::condition_variable condition;
+    size_t next_to_prepare = 0;
+    size_t next_to_feed = 0;
+    size_t in_flight_bytes = 0;
+    std::exception_ptr error;
+
+    auto prepare = [&]() {
+        auto worker_warper = warp_creator->create(compose_work_scale);
+        cv::Mat image_warped, image_warped_s;
+        cv::Mat dilated_mask, seam_mask, mask_warped;
+
+        while (true) {
+            size_t k;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [&]() {
+                    return error || next_to_prepare == image_count
+                            || next_to_prepare == next_to_feed
+                            || in_flight_bytes + prepared_bytes(next_to_prepare)
+                            <= budget_bytes;
+                });
+                if (error || next_to_prepare == image_count) {
+                    return;
+                }
+                k = next_to_prepare++;
+                in_flight_bytes += prepared_bytes(k);
+            }
+
+            try {
+                size_t i = indices[k];
+                cv::Mat K;
+                cameras[i].K().convertTo(K, CV_32F);
+
+                // warp the current image and its mask, compensating exposure
+                // of the warped rows right away if possible
+                WarpedRowsCallback compensate;
+                if (gain_compensator) {
+                    cv::Size size = warp_results.sizes[i];
+                    compensate = [gain_compensator, i, size](cv::Mat &rows, int first_row) {
+                        gain_compensator->applyRows(static_cast<int>(i), size, first_row,
+                                                    rows);
+                    };
+                }
+                cv::Point corner = warpImageAndMask(
+                        *worker_warper, source_images.images_scaled[i], K, cameras[i].R,
+                        cv::INTER_LINEAR, cv::BORDER_REFLECT, image_warped, mask_warped,
+                        compensate, dst_rows);
+                if (last_use[i]) {
+                    source_images.images_scaled[i].release();
+                }
+
+                // compensate exposure
+                if (!gain_compensator) {
+                    exposure_compensator->apply(static_cast<int>(i), corner, image_warped,
+                                                mask_warped);
+                }
+
+                image_warped.convertTo(image_warped_s, CV_16S);
+                image_warped.release();
+
+                cv::dilate(warp_results.masks_warped[i], dilated_mask, cv::Mat());
+                if (last_use[i]) {
+                    warp_results.masks_warped[i].release();
+                }
+                cv::resize(dilated_mask, seam_mask, warp_results.sizes[i], 0, 0,
+                           cv::INTER_LINEAR_EXACT);
+                dilated_mask.release();
+                mask_warped = seam_mask(cv::Rect(corner - warp_results.corners[i],
+                                                 mask_warped.size()))
+                        & mask_warped;
+                seam_mask.release();
+
+                // clip to the region being blended
+                cv::Rect clipped = cv::Rect(corner, image_warped_s.size()) & roi;
+
+                std::lock_guard<std::mutex> lock(mutex);
+                prepared[k].image = image_warped_s(clipped - corner);
+                prepared[k].mask = mask_warped(clipped - corner);
+                prepared[k].corner = clipped.tl();
+                prepared[k].ready = true;
+                image_warped_s.release();
+                mask_warped.release();
+                condition.notify_all();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                error = std::current_exception();
+                condition.notify_all();
+                return;
+            }
+        }
+    };
+
+    size_t worker_count = std::min(
+            image_count, static_cast<size_t>(std::max(1, cv::getNumThreads())));
+    std::vector<std::thread> workers;
+    for (size_t w = 0; w < worker_count; ++w) {
+        workers.emplace_back(prepare);
+    }
+
+    try {
+        for (size_t k = 0; k < image_count; ++k) {
+            PreparedImage prepared_image;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [&]() { return error || prepared[k].ready; });
+                if (error) {
+                    break;
+                }
+                std::swap(prepared_image, prepared[k]);
+            }
+
+            // blend the current image
+            blender.feed(prepared_image.image, prepared_image.mask, prepared_image.corner);
+            prepared_image = PreparedImage();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                in_flight_bytes -= prepared_bytes(k);
+                next_to_feed = k + 1;
+                condition.notify_all();
+            }
+
+            _monitor->updateCurrentOperation(
+                    progress_start
+                    + (progress_end - progress_start) * static_cast<double>(k)
+                            / static_cast<double>(image_count));
+        }
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        error = std::current_exception();
+        condition.notify_all();
+    }
+
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
 std::vector<cv::detail::ImageFeatures> LowLevelOpenCVStitcher::findFeatures(
     const std::vector<cv::Mat> &source_images) const
 {
@@ -439,7 +1037,7 @@ void LowLevelOpenCVStitcher::findSeams(LowLevelOpenCVStitcher::WarpResults &warp
 
     _logger->log(logging::Logger::Severity::info, "Finding seams.", "stitcher");
     auto seam_finder = getSeamFinder();
-    seam_finder->find(warp_results.images_warped_f, warp_results.corners,
+    seam_finder->find(warp_results.images_warped, warp_results.corners,
                       warp_results.masks_warped);
     _logger->log(logging::Logger::Severity::info, "Finished finding seams.", "stitcher");
 }
@@ -455,6 +1053,15 @@ cv::Ptr<cv::detail::BundleAdjusterBase> LowLevelOpenCVStitcher::getBundleAdjuste
     case BundleAdjusterType::Ray:
         bundle_adjuster = cv::makePtr<cv::detail::BundleAdjusterRay>();
         break;
+    case BundleAdjusterType::SparseRay: {
+        auto sparse_bundle_adjuster =
+                cv::makePtr<SparseBundleAdjusterRay>();
+        sparse_bundle_adjuster->setProgressCallback([this](double progress) {
+            _monitor->updateCurrentOperation(progress);
+        });
+        bundle_adjuster = sparse_bundle_adjuster;
+        break;
+    }
     case BundleAdjusterType::AffinePartial:
         bundle_adjuster = cv::makePtr<cv::detail::BundleAdjusterAffinePartial>();
         break;
@@ -472,6 +1079,18 @@ cv::Ptr<cv::detail::BundleAdjusterBase> LowLevelOpenCVStitcher::getBundleAdjuste
     return bundle_adjuster;
 }
 
+cv::Rect LowLevelOpenCVStitcher::getComposeCanvas()
+{
+    if (_config.output_width <= 0 || _config.warper_type != WarperType::Spherical) {
+        return cv::Rect();
+    }
+
+    // The spherical warper maps longitudes to [-pi, pi] and colatitudes to
+    // [0, pi], times its scale.
+    int width = _config.output_width;
+    return cv::Rect(-width / 2, 0, width, width / 2);
+}
+
 double LowLevelOpenCVStitcher::getComposeScale(SourceImages &source_images)
 {
     if (_config.compose_megapix < 0) {
@@ -483,6 +1102,18 @@ double LowLevelOpenCVStitcher::getComposeScale(SourceImages &source_images)
             sqrt(_config.compose_megapix * 1e6 / source_images.images[0].size().area()));
 }
 
+float LowLevelOpenCVStitcher::getComposeWorkScale(float warped_image_scale,
+                                                  float compose_work_aspect)
+{
+    cv::Rect canvas = getComposeCanvas();
+    if (canvas.empty()) {
+        return warped_image_scale * compose_work_aspect;
+    }
+
+    // 2 pi radians of longitude span the width of the canvas.
+    return static_cast<float>(canvas.width / (2. * M_PI));
+}
+
 cv::Ptr<cv::detail::Estimator> LowLevelOpenCVStitcher::getEstimator()
 {
     cv::Ptr<cv::detail::Estimator> estimator;
@@ -517,8 +1148,7 @@ cv::Ptr<cv::detail::ExposureCompensator> LowLevelOpenCVStitcher::getExposureComp
                 cv::detail::ExposureCompensator::GAIN);
         break;
     case ExposureCompensatorType::GainBlocks:
-        compensator = cv::detail::ExposureCompensator::createDefault(
-                cv::detail::ExposureCompensator::GAIN_BLOCKS);
+        compensator = cv::makePtr<ParallelBlocksGainCompensator>();
         break;
     case ExposureCompensatorType::No:
         compensator = cv::detail::ExposureCompensator::createDefault(
@@ -548,6 +1178,15 @@ cv::Ptr<cv::detail::ExposureCompensator> LowLevelOpenCVStitcher::getExposureComp
                                          _config.exposure_compensation_block_size);
     }
 
+    if (auto *blocks_compensator =
+                dynamic_cast<ParallelBlocksGainCompensator *>(compensator.get())) {
+        blocks_compensator->setNrFeeds(_config.exposure_compensation_nr_feeds);
+        blocks_compensator->setNrGainsFilteringIterations(
+                _config.exposure_compensation_nr_filtering);
+        blocks_compensator->setBlockSize(_config.exposure_compensation_block_size,
+                                         _config.exposure_compensation_block_size);
+    }
+
     return compensator;
 }
 
@@ -609,18 +1248,28 @@ cv::Ptr<cv::detail::SeamFinder> LowLevelOpenCVStitcher::getSeamFinder()
         seam_finder = cv::makePtr<cv::detail::DpSeamFinder>(
                 cv::detail::DpSeamFinder::COLOR_GRAD);
         break;
-    case SeamFinderType::GraphCutColor: // TODO(bkd): optional GPU support
-        seam_finder = cv::makePtr<cv::detail::GraphCutSeamFinder>(
-            cv::detail::GraphCutSeamFinder::COST_COLOR);
+    case SeamFinderType::GraphCutColor: { // TODO(bkd): optional GPU support
+        auto graph_cut_seam_finder = cv::makePtr<MonitoredGraphCutSeamFinder>(
+            _monitor, cv::detail::GraphCutSeamFinder::COST_COLOR,
+            _config.seam_finder_graph_cut_terminal_cost,
+            _config.seam_finder_graph_cut_bad_region_penalty);
+        graph_cut_seam_finder->setLevels(_config.seam_finder_graph_cut_levels);
+        graph_cut_seam_finder->setMinOverlapPixels(_config.seam_finder_min_overlap_pixels);
+        seam_finder = graph_cut_seam_finder;
         break;
-    case SeamFinderType::GraphCutColorGrad: // TODO(bkd): optional GPU support
-        seam_finder = cv::makePtr<MonitoredGraphCutSeamFinder>(
+    }
+    case SeamFinderType::GraphCutColorGrad: { // TODO(bkd): optional GPU support
+        auto graph_cut_seam_finder = cv::makePtr<MonitoredGraphCutSeamFinder>(
             _monitor, cv::detail::GraphCutSeamFinder::COST_COLOR_GRAD,
             _config.seam_finder_graph_cut_terminal_cost,
             _config.seam_finder_graph_cut_bad_region_penalty);
+        graph_cut_seam_finder->setLevels(_config.seam_finder_graph_cut_levels);
+        graph_cut_seam_finder->setMinOverlapPixels(_config.seam_finder_min_overlap_pixels);
+        seam_finder = graph_cut_seam_finder;
         break;
+    }
     case SeamFinderType::Voronoi:
-        seam_finder = cv::makePtr<cv::detail::VoronoiSeamFinder>();
+        seam_finder = cv::makePtr<ParallelVoronoiSeamFinder>();
         break;
     case SeamFinderType::No:
         seam_finder = cv::makePtr<cv::detail::NoSeamFinder>();
@@ -726,14 +1375,15 @@ double LowLevelOpenCVStitcher::getWorkScale(SourceImages &source_images)
 }
 
 std::vector<cv::detail::MatchesInfo>
-LowLevelOpenCVStitcher::matchFeatures(std::vector<cv::detail::ImageFeatures> &features)
+LowLevelOpenCVStitcher::matchFeatures(std::vector<cv::detail::ImageFeatures> &features,
+                                      const cv::UMat &mask)
 {
     _monitor->changeOperation(monitor::Operation::MatchFeatures());
 
     _logger->log(logging::Logger::Severity::info, "Matching features.", "stitcher");
     std::vector<cv::detail::MatchesInfo> matches;
     cv::Ptr<cv::detail::FeaturesMatcher> matcher = getFeaturesMatcher();
-    (*matcher)(features, matches);
+    (*matcher)(features, matches, mask);
     matcher->collectGarbage();
     _logger->log(logging::Logger::Severity::info, "Finished matching features.", "stitcher");
     return matches;
@@ -742,35 +1392,9 @@ LowLevelOpenCVStitcher::matchFeatures(std::vector<cv::detail::ImageFeatures> &fe
 cv::Ptr<cv::detail::Blender>
 LowLevelOpenCVStitcher::prepareBlender(WarpResults &warp_results)
 {
-    cv::Ptr<cv::detail::Blender> blender =
-            cv::detail::Blender::createDefault(_config.blender_type, _config.try_cuda);
-    cv::Size destination_size =
-            cv::detail::resultRoi(warp_results.corners, warp_results.sizes).size();
-    float blend_width = cv::sqrt(static_cast<float>(destination_size.area()))
-            * _config.blend_strength / 100.f;
-
-    if (blend_width < 1.f) {
-        blender = cv::detail::Blender::createDefault(cv::detail::Blender::NO,
-                                                     _config.try_cuda);
-    } else if (_config.blender_type == cv::detail::Blender::MULTI_BAND) {
-        auto *multiband_blender =
-                dynamic_cast<cv::detail::MultiBandBlender *>(blender.get());
-        multiband_blender->setNumBands(static_cast<int>(
-                ceil(log(static_cast<double>(blend_width)) / log(2.)) - 1.));
-        std::stringstream message;
-        message << "Multi-band blender prepared with " << multiband_blender->numBands()
-                << " bands.";
-        _logger->log(logging::Logger::Severity::info, message, "stitcher");
-    } else if (_config.blender_type == cv::detail::Blender::FEATHER) {
-        auto *feather_blender = dynamic_cast<cv::detail::FeatherBlender *>(blender.get());
-        feather_blender->setSharpness(1.f / blend_width);
-        std::stringstream message;
-        message << "Feather blender prepared with " << feather_blender->sharpness()
-                << " sharpness.";
-        _logger->log(logging::Logger::Severity::info, message, "stitcher");
-    }
-
-    blender->prepare(warp_results.corners, warp_results.sizes);
+    cv::Rect dst_roi = composeRoi(warp_results);
+    cv::Ptr<cv::detail::Blender> blender = createBlender(dst_roi.size());
+    blender->prepare(dst_roi);
     return blender;
 }
 
@@ -789,16 +1413,21 @@ LowLevelOpenCVStitcher::prepareExposureCompensation(
     return compensator;
 }
 
-void LowLevelOpenCVStitcher::rotateImage(cv::Mat &image, double angle)
+void LowLevelOpenCVStitcher::rotateCameras(
+        std::vector<cv::detail::CameraParams> &cameras, double angle)
 {
-    cv::Size size = image.size();
-    float x = (size.width - 1) / 2.f;
-    float y = (size.height - 1) / 2.f;
-    cv::Point2f center(x, y);
-    cv::Mat rotation = cv::getRotationMatrix2D(center, angle, 1.);
-    cv::Mat image_rotated;
-    cv::warpAffine(image, image_rotated, rotation, size);
-    image = image_rotated;
+    // The warpers project the world ray R * K^-1 * p, so rotating the world
+    // frame about its z axis rotates the projected panorama in 2D.
+    double radians = angle * M_PI / 180.;
+    float c = static_cast<float>(std::cos(radians));
+    float s = static_cast<float>(std::sin(radians));
+    cv::Mat_<float> rotation = (cv::Mat_<float>(3, 3) << c, -s, 0, s, c, 0, 0, 0, 1);
+
+    for (size_t i = 0; i < cameras.size(); ++i) {
+        cv::Mat R;
+        cameras[i].R.convertTo(R, CV_32F);
+        cameras[i].R = rotation * R;
+    }
 }
 
 bool LowLevelOpenCVStitcher::shouldRotateThreeSixty(
@@ -947,11 +1576,11 @@ bool LowLevelOpenCVStitcher::shouldRotateThreeSixty(
 
 Stitcher::Report LowLevelOpenCVStitcher::stitch()
 {
-    cv::Mat result;
+    cv::Mat result, result_mask;
     Stitcher::Report report;
     
     try {
-        report = stitch(result);
+        report = stitch(result, result_mask);
     } catch (const std::exception &e) {
         // can indeed throw, e.g.:
         //.../OpenCV/modules/flann/src/miniflann.cpp:487: error: (-215:Assertion
@@ -961,13 +1590,13 @@ Stitcher::Report LowLevelOpenCVStitcher::stitch()
         throw RetriableError(e.what());
     }
 
-    postprocess(std::move(result));
+    postprocess(std::move(result), std::move(result_mask), !getComposeCanvas().empty());
     return report;
 }
 
 void LowLevelOpenCVStitcher::cancel() { }
 
-Stitcher::Report LowLevelOpenCVStitcher::stitch(cv::Mat &result)
+Stitcher::Report LowLevelOpenCVStitcher::stitch(cv::Mat &result, cv::Mat &result_mask)
 {
     _monitor->changeOperation(monitor::Operation::Start());
 
@@ -996,24 +1625,63 @@ Stitcher::Report LowLevelOpenCVStitcher::stitch(cv::Mat &result)
     // Scale images down for feature detection and matching.
     source_images.scale(work_scale);
 
-    // Find features and matches.
-    auto features = findFeatures(source_images.images_scaled);
-    debugFeatures(source_images, features);
-    auto matches = matchFeatures(features);
-    debugMatches(source_images.images_scaled, features, matches,
-                 _config.match_conf_thresh, _debugPath / "matches");
+    // In pose only mode, cameras come straight from the gimbal orientations,
+    // which are already in a level, absolute frame.
+    bool pose_only = _config.pose_only && _camera;
+    if (_config.pose_only && !pose_only) {
+        _logger->log(logging::Logger::Severity::info,
+                     "Camera model not identified, can't stitch from gimbal orientations.",
+                     "stitcher");
+    }
 
-    // Filter images with poor matching.
-    auto keep_indices = cv::detail::leaveBiggestComponent(
-            features, matches, static_cast<float>(_config.match_conf_thresh));
-    source_images.filter(keep_indices);
+    std::vector<cv::detail::ImageFeatures> features;
+    std::vector<cv::detail::CameraParams> cameras;
+    StitchTemplate stitch_template;
+    bool template_cameras_unchanged = false;
+    bool warm_start = false;
 
-    // Estimate and refine camera parameters.
-    auto cameras = estimateCameraParameters(features, matches);
-    adjustCameraParameters(features, matches, cameras);
+    if (pose_only) {
+        cameras = estimateCameraParametersFromPose(source_images);
+    } else {
+        // Find features.
+        features = findFeatures(source_images.images_scaled);
+        debugFeatures(source_images, features);
+
+        // Start from a previous stitch of the same site, if there is one that
+        // can be verified against this capture.
+        warm_start = _stitchTemplates
+                && _stitchTemplates->find(_panorama, stitch_template)
+                && adjustTemplateCameraParameters(stitch_template, source_images,
+                                                  features, cameras,
+                                                  template_cameras_unchanged);
+    }
 
-    // Perform wave correction.
-    waveCorrect(cameras);
+    if (!pose_only && !warm_start) {
+        auto matches = matchFeatures(features);
+        cameras = estimateCameraParametersFromMatches(source_images, features, matches);
+    }
+
+    // Template seams and gains can only be reused if the refined cameras
+    // didn't move away from the template.  Template and pose cameras are
+    // already in the orientation of the template or of the gimbal.
+    stitchFromCameras(source_images, cameras, seam_scale, work_scale, compose_scale,
+                      warm_start || pose_only,
+                      warm_start ? &stitch_template : nullptr,
+                      template_cameras_unchanged,
+                      !pose_only, result, result_mask);
+
+    _monitor->changeOperation(monitor::Operation::Complete());
+
+    return report;
+}
+
+void LowLevelOpenCVStitcher::stitchFromCameras(
+        SourceImages &source_images, std::vector<cv::detail::CameraParams> &cameras,
+        double seam_scale, double work_scale, double compose_scale, bool oriented,
+        const StitchTemplate *matched_template, bool template_cameras_unchanged,
+        bool save_template, cv::Mat &result, cv::Mat &result_mask)
+{
+    int work_width = source_images.images_scaled[0].cols;
 
     // Crop images based on the distortion model.
     undistortCropImages(source_images);
@@ -1027,26 +1695,79 @@ Stitcher::Report LowLevelOpenCVStitcher::stitch(cv::Mat &result)
     float warped_image_scale = static_cast<float>(median_focal_length);
     auto warp_results =
             warpImages(source_images, cameras, warped_image_scale, seam_work_aspect);
-    debugWarpResults(warp_results);
 
-    // Prepare exposure compensation.
-    auto exposure_compensator = prepareExposureCompensation(warp_results);
+    // Fold any 180 degree correction into the camera rotations, so that
+    // compose writes the panorama in the correct orientation.  Re-warping at
+    // seam scale keeps the seams and exposure compensation consistent with
+    // the rotated cameras.
+    if (!oriented && _config.stitch_type == StitchType::ThreeSixty
+        && shouldRotateThreeSixty(source_images.images_scaled,
+                                  warp_results.images_warped)) {
+        _logger->log(airmap::logging::Logger::Severity::info,
+                     "Rotating camera parameters.", "stitcher");
+        rotateCameras(cameras, 180.);
+        warp_results = warpImages(source_images, cameras, warped_image_scale,
+                                  seam_work_aspect);
+    }
+    debugWarpResults(warp_results);
 
-    bool should_rotate_result =
-        _config.stitch_type == StitchType::ThreeSixty
-            ? shouldRotateThreeSixty(source_images.images_scaled,
-                                     warp_results.images_warped)
-            : false;
+    // Template seams and gains are only valid if the images warp exactly as
+    // they did for the template.
+    const StitchTemplate *reusable_template =
+            template_cameras_unchanged ? matched_template : nullptr;
+    bool reuse_template_seams = reusable_template
+            && reusable_template->corners == warp_results.corners;
+    for (size_t i = 0; reuse_template_seams && i < warp_results.sizes.size(); ++i) {
+        reuse_template_seams = cv::Size(reusable_template->seam_masks[i].size())
+                == warp_results.sizes[i];
+    }
 
-    // Release memory.
-    warp_results.images_warped.clear();
-    warp_results.masks.clear();
+    // Prepare exposure compensation.  Template gains are only valid for the
+    // compensator they are from.
+    bool reuse_template_gains = reuse_template_seams
+            && !reusable_template->gains.empty()
+            && reusable_template->exposure_compensator_type
+                    == _config.exposure_compensator_type
+            && reusable_template->exposure_compensation_block_size
+                    == _config.exposure_compensation_block_size;
+    cv::Ptr<cv::detail::ExposureCompensator> exposure_compensator;
+    if (reuse_template_gains) {
+        _logger->log(logging::Logger::Severity::info,
+                     "Reusing exposure compensation from stitch template.", "stitcher");
+        exposure_compensator = getExposureCompensator();
+        std::vector<cv::Mat> gains = reusable_template->gains;
+        exposure_compensator->setMatGains(gains);
+    } else {
+        exposure_compensator = prepareExposureCompensation(warp_results);
+    }
 
     // Find seams.
-    findSeams(warp_results);
+    if (reuse_template_seams) {
+        _logger->log(logging::Logger::Severity::info,
+                     "Reusing seams from stitch template.", "stitcher");
+        for (size_t i = 0; i < warp_results.masks_warped.size(); ++i) {
+            reusable_template->seam_masks[i].copyTo(warp_results.masks_warped[i]);
+        }
+    } else {
+        findSeams(warp_results);
+    }
 
     // Release memory.
-    warp_results.images_warped_f.clear();
+    warp_results.images_warped.clear();
+
+    // Keep what a later stitch of the same site can start from.  Templates
+    // are only kept if no images were dropped, so that they correspond
+    // one-to-one with the images of a capture.
+    save_template = save_template && _stitchTemplates
+            && source_images.images_scaled.size() == _panorama.size();
+    StitchTemplate stitch_template;
+    if (save_template) {
+        stitch_template = createStitchTemplate(cameras, warp_results,
+                                               exposure_compensator, work_width);
+        if (matched_template) {
+            stitch_template.directory = matched_template->directory;
+        }
+    }
 
     // Scale images to compose scale.
     source_images.scale(compose_scale);
@@ -1056,17 +1777,17 @@ Stitcher::Report LowLevelOpenCVStitcher::stitch(cv::Mat &result)
 
     // Compose the final panorama.
     compose(source_images, cameras, exposure_compensator, warp_results,
-            work_scale, compose_scale, warped_image_scale, result);
-
-    if (should_rotate_result) {
-        _logger->log(airmap::logging::Logger::Severity::info,
-                     "Rotating panorama result.", "stitcher");
-        rotateImage(result, 180.);
+            work_scale, compose_scale, warped_image_scale, result, result_mask);
+
+    if (save_template) {
+        try {
+            _stitchTemplates->save(stitch_template);
+        } catch (const std::exception &e) {
+            std::stringstream message;
+            message << "Failed to save stitch template: " << e.what();
+            _logger->log(logging::Logger::Severity::error, message, "stitcher");
+        }
     }
-
-    _monitor->changeOperation(monitor::Operation::Complete());
-
-    return report;
 }
 
 void LowLevelOpenCVStitcher::undistortImages(SourceImages &source_images)
@@ -1138,33 +1859,31 @@ LowLevelOpenCVStitcher::warpImages(SourceImages &source_images,
     _logger->log(logging::Logger::Severity::info, "Warping images.", "stitcher");
 
     auto warper_creator = getWarperCreator();
-    auto warper = warper_creator->create(warped_image_scale * seam_work_aspect);
 
     size_t image_count = source_images.images_scaled.size();
     WarpResults warp_results(image_count);
 
-    // Prepare image masks
-    for (size_t i = 0; i < image_count; ++i) {
-        warp_results.masks[i].create(source_images.images_scaled[i].size(), CV_8U);
-        warp_results.masks[i].setTo(cv::Scalar::all(255));
-    }
-
-    for (size_t i = 0; i < image_count; ++i) {
-        cv::Mat_<float> K;
-        cameras[i].K().convertTo(K, CV_32F);
-        K(0, 0) *= seam_work_aspect;
-        K(0, 2) *= seam_work_aspect;
-        K(1, 1) *= seam_work_aspect;
-        K(1, 2) *= seam_work_aspect;
-
-        warp_results.corners[i] =
-                warper->warp(source_images.images_scaled[i], K, cameras[i].R, cv::INTER_LINEAR,
-                             cv::BORDER_REFLECT, warp_results.images_warped[i]);
-        warp_results.sizes[i] = warp_results.images_warped[i].size();
-        warper->warp(warp_results.masks[i], K, cameras[i].R, cv::INTER_NEAREST,
-                     cv::BORDER_CONSTANT, warp_results.masks_warped[i]);
-        warp_results.images_warped[i].convertTo(warp_results.images_warped_f[i], CV_32F);
-    }
+    // Images are warped independently, into their own slots of the warp
+    // results.  Warpers keep per-warp state in their projector, so each
+    // worker creates its own.
+    cv::parallel_for_(cv::Range(0, static_cast<int>(image_count)), [&](const cv::Range &range) {
+        auto warper = warper_creator->create(warped_image_scale * seam_work_aspect);
+
+        for (int i = range.start; i < range.end; ++i) {
+            cv::Mat_<float> K;
+            cameras[i].K().convertTo(K, CV_32F);
+            K(0, 0) *= seam_work_aspect;
+            K(0, 2) *= seam_work_aspect;
+            K(1, 1) *= seam_work_aspect;
+            K(1, 2) *= seam_work_aspect;
+
+            warp_results.corners[i] = warpImageAndMask(
+                    *warper, source_images.images_scaled[i], K, cameras[i].R,
+                    cv::INTER_LINEAR, cv::BORDER_REFLECT, warp_results.images_warped[i],
+                    warp_results.masks_warped[i]);
+            warp_results.sizes[i] = warp_results.images_warped[i].size();
+        }
+    });
 
     _logger->log(logging::Logger::Severity::info, "Finished warping images.", "stitcher");
     return warp_results;
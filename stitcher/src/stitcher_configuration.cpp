@@ -13,21 +13,26 @@ Configuration::Configuration(StitchType stitchType)
         blender_type = cv::detail::Blender::MULTI_BAND;
         bundle_adjuster_type = BundleAdjusterType::Ray;
         compose_megapix = -1;
+        compose_tile_size = 0;
         estimator_type = EstimatorType::Homography;
         exposure_compensator_type = ExposureCompensatorType::GainBlocks;
         exposure_compensation_nr_feeds = 1;
         exposure_compensation_nr_filtering = 2;
-        exposure_compensation_block_size = 32;
+        exposure_compensation_block_size = 64;
         features_finder_type = FeaturesFinderType::Orb;
         features_matcher_type = FeaturesMatcherType::Homography;
         features_maximum = 1000;
         match_conf = 0.3f;
         match_conf_thresh = 1.0;
+        output_width = 0;
+        pose_only = false;
         range_width = -1;
-        seam_megapix = 0.1;
+        seam_megapix = 0.4;
         seam_finder_type = SeamFinderType::GraphCutColorGrad;
         seam_finder_graph_cut_terminal_cost = 10000.f;
         seam_finder_graph_cut_bad_region_penalty = 10000000.f;
+        seam_finder_graph_cut_levels = 1;
+        seam_finder_min_overlap_pixels = 400;
         try_cuda = false;
         warper_type = WarperType::Spherical;
         wave_correct = true;
@@ -55,11 +60,14 @@ Configuration::Configuration(
     float seam_finder_graph_cut_bad_region_penalty, bool try_cuda,
     WarperType warper_type, bool wave_correct,
     WaveCorrectType wave_correct_type, double work_megapix,
-    StitchType stitch_type)
+    StitchType stitch_type, bool pose_only, int compose_tile_size,
+    int seam_finder_graph_cut_levels, int seam_finder_min_overlap_pixels,
+    int output_width)
     : blend_strength(blend_strength)
     , blender_type(blender_type)
     , bundle_adjuster_type(bundle_adjuster_type)
     , compose_megapix(compose_megapix)
+    , compose_tile_size(compose_tile_size)
     , estimator_type(estimator_type)
     , exposure_compensator_type(exposure_compensator_type)
     , exposure_compensation_nr_feeds(exposure_compensation_nr_feeds)
@@ -70,12 +78,16 @@ Configuration::Configuration(
     , features_maximum(features_maximum)
     , match_conf(match_conf)
     , match_conf_thresh(match_conf_thresh)
+    , output_width(output_width)
+    , pose_only(pose_only)
     , range_width(range_width)
     , seam_megapix(seam_megapix)
     , seam_finder_type(seam_finder_type)
     , seam_finder_graph_cut_terminal_cost(seam_finder_graph_cut_terminal_cost)
     , seam_finder_graph_cut_bad_region_penalty(
           seam_finder_graph_cut_bad_region_penalty)
+    , seam_finder_graph_cut_levels(seam_finder_graph_cut_levels)
+    , seam_finder_min_overlap_pixels(seam_finder_min_overlap_pixels)
     , stitch_type(stitch_type)
     , try_cuda(try_cuda)
     , warper_type(warper_type)
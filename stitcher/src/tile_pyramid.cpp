@@ -0,0 +1,87 @@
+#include "tile_pyramid.h"
+
+#include <boost/filesystem.hpp>
+
+namespace {
+
+const char faceNames[] = { 'f', 'r', 'b', 'l', 'u', 'd' };
+
+} // namespace
+
+void TilePyramid::write(const cv::Mat &in, const std::string &directory, int tileSize)
+{
+    CV_Assert(tileSize > 0);
+
+    int faceSize = in.cols / 4;
+    int levelCount = levels(faceSize, tileSize);
+    for (int level = 1; level <= levelCount; ++level) {
+        boost::filesystem::create_directories(boost::filesystem::path(directory)
+                                              / std::to_string(level));
+    }
+
+    // Each face is resampled once, at the finest level, and halved down to the
+    // coarsest.  Faces are processed concurrently.
+    cv::parallel_for_(cv::Range(0, static_cast<int>(CubeMap::Face::NumFaces)),
+                      [&](const cv::Range &range) {
+                          for (int i = range.start; i < range.end; ++i) {
+                              writeFace(in, static_cast<CubeMap::Face>(i), directory,
+                                        faceSize, tileSize, levelCount);
+                          }
+                      });
+
+    // Write the manifest last, so that viewers only find complete pyramids.
+    cv::FileStorage fs((boost::filesystem::path(directory) / "config.json").string(),
+                       cv::FileStorage::WRITE);
+    fs << "type"
+       << "multires";
+    fs << "multiRes"
+       << "{";
+    fs << "path"
+       << "/%l/%s%y_%x";
+    fs << "extension"
+       << "jpg";
+    fs << "tileResolution" << tileSize;
+    fs << "maxLevel" << levelCount;
+    fs << "cubeResolution" << faceSize;
+    fs << "}";
+}
+
+int TilePyramid::levels(int faceSize, int tileSize)
+{
+    int levelCount = 1;
+    for (int size = faceSize; size > tileSize; size = (size + 1) / 2) {
+        ++levelCount;
+    }
+    return levelCount;
+}
+
+void TilePyramid::writeFace(const cv::Mat &in, CubeMap::Face faceId,
+                            const std::string &directory, int faceSize, int tileSize,
+                            int levels)
+{
+    cv::Mat face;
+    CubeMap::createFace(in, face, faceId, faceSize, faceSize,
+                        CubeMap::faceFlipCode(faceId));
+
+    char faceName = faceNames[static_cast<int>(faceId)];
+    for (int level = levels; level >= 1; --level) {
+        boost::filesystem::path levelPath =
+                boost::filesystem::path(directory) / std::to_string(level);
+        for (int y = 0; y * tileSize < face.rows; ++y) {
+            for (int x = 0; x * tileSize < face.cols; ++x) {
+                cv::Rect tile(x * tileSize, y * tileSize, tileSize, tileSize);
+                tile &= cv::Rect(0, 0, face.cols, face.rows);
+                std::string name = faceName + std::to_string(y) + "_" + std::to_string(x)
+                        + ".jpg";
+                cv::imwrite((levelPath / name).string(), face(tile));
+            }
+        }
+
+        if (level > 1) {
+            cv::Mat halved;
+            cv::resize(face, halved, cv::Size((face.cols + 1) / 2, (face.rows + 1) / 2), 0,
+                       0, cv::INTER_AREA);
+            face = halved;
+        }
+    }
+}
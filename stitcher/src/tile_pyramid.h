@@ -0,0 +1,39 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+
+#include "cubemap.h"
+
+/**
+ * @brief The TilePyramid class
+ *  Writes an equirectangular panorama as a multiresolution pyramid of cube face tiles,
+ * in the layout of Pannellum's multires panoramas, so that web viewers only download the
+ * tiles in view:
+ *
+ *  <directory>/config.json
+ *  <directory>/<level>/<face><row>_<column>.jpg
+ *
+ * Level 1 is the coarsest, and each level has twice the resolution of the previous one,
+ * up to faces of a quarter of the width of the panorama, as the cube map.  Faces are
+ * f(ront), r(ight), b(ack), l(eft), u(p) and d(own).
+ */
+class TilePyramid
+{
+public:
+    /**
+     * @brief write creates and writes the tiles and manifest of all levels
+     * @param in - the equirectangular panorama
+     * @param directory - directory to write to, created if missing
+     * @param tileSize - width and height of the tiles, in pixels
+     */
+    static void write(const cv::Mat &in, const std::string &directory, int tileSize);
+
+    /**
+     * @brief levels returns the number of levels needed for the coarsest to fit a tile
+     */
+    static int levels(int faceSize, int tileSize);
+
+private:
+    static void writeFace(const cv::Mat &in, CubeMap::Face faceId,
+                          const std::string &directory, int faceSize, int tileSize,
+                          int levels);
+};
@@ -0,0 +1,210 @@
+#include "gtest/gtest.h"
+#include "airmap/opencv/blenders.h"
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/stitching/detail/blenders.hpp>
+
+using airmap::stitcher::opencv::detail::FixedPointMultiBandBlender;
+using airmap::stitcher::opencv::detail::SeamBandBlender;
+using airmap::stitcher::opencv::detail::findSeamRegions;
+
+namespace {
+
+struct Input
+{
+    cv::Mat image;
+    cv::Mat mask;
+    cv::Point corner;
+};
+
+/**
+ * @brief overlappingInputs
+ * Two smooth, differently exposed images overlapping in the middle of the
+ * destination, with seam masks splitting the overlap and covering the whole
+ * destination.
+ */
+std::vector<Input> overlappingInputs()
+{
+    std::vector<Input> inputs;
+    for (int i = 0; i < 2; ++i) {
+        Input input;
+        cv::Mat noise(300, 400, CV_8UC3);
+        cv::randu(noise, cv::Scalar::all(0), cv::Scalar::all(255));
+        cv::GaussianBlur(noise, noise, cv::Size(9, 9), 3.);
+        cv::add(noise, cv::Scalar::all(i * 40), noise);
+        noise.convertTo(input.image, CV_16S);
+
+        input.corner = cv::Point(i * 250, 10);
+        input.mask = cv::Mat(noise.size(), CV_8U, cv::Scalar::all(0));
+        int seam = 325 - input.corner.x;
+        if (i == 0) {
+            input.mask.colRange(0, seam).setTo(255);
+        } else {
+            input.mask.colRange(seam, input.mask.cols).setTo(255);
+        }
+        inputs.push_back(input);
+    }
+    return inputs;
+}
+
+void blend(cv::detail::Blender &blender, const std::vector<Input> &inputs,
+           cv::Mat &result, cv::Mat &result_mask)
+{
+    std::vector<cv::Point> corners;
+    std::vector<cv::Size> sizes;
+    for (const auto &input : inputs) {
+        corners.push_back(input.corner);
+        sizes.push_back(input.image.size());
+    }
+    blender.prepare(corners, sizes);
+    for (const auto &input : inputs) {
+        blender.feed(input.image, input.mask, input.corner);
+    }
+    blender.blend(result, result_mask);
+}
+
+} // namespace
+
+TEST(fixedPointMultiBandBlender, matchesMultiBandBlender)
+{
+    std::vector<Input> inputs = overlappingInputs();
+    const int num_bands = 5;
+
+    cv::detail::MultiBandBlender expected_blender(false, num_bands);
+    cv::Mat expected, expected_mask;
+    blend(expected_blender, inputs, expected, expected_mask);
+
+    FixedPointMultiBandBlender blender(num_bands);
+    cv::Mat result, result_mask;
+    blend(blender, inputs, result, result_mask);
+
+    ASSERT_EQ(result.type(), CV_16SC3);
+    ASSERT_EQ(cv::Size(result.size()), cv::Size(expected.size()));
+    EXPECT_EQ(cv::norm(result_mask, expected_mask, cv::NORM_INF), 0.);
+
+    // cv::detail::MultiBandBlender truncates weighted bands, where they are
+    // rounded here, so each of the num_bands + 1 levels may be off by one.
+    // Truncation errors of different levels mostly cancel out.
+    cv::Mat difference;
+    cv::absdiff(result, expected, difference);
+    EXPECT_LE(cv::norm(difference, cv::NORM_INF), num_bands + 1.);
+    EXPECT_LE(cv::norm(difference, cv::NORM_L1) / difference.total() / 3., 1.);
+}
+
+TEST(fixedPointMultiBandBlender, keepsSingleImage)
+{
+    cv::Mat image(256, 256, CV_8UC3);
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::Mat mask(image.size(), CV_8U, cv::Scalar::all(255));
+
+    FixedPointMultiBandBlender blender(4);
+    blender.prepare(cv::Rect(cv::Point(-30, 20), image.size()));
+    blender.feed(image, mask, cv::Point(-30, 20));
+    cv::Mat result, result_mask;
+    blender.blend(result, result_mask);
+
+    // A single fully weighted image goes through its own pyramid unchanged.
+    cv::Mat expected;
+    image.convertTo(expected, CV_16S);
+    EXPECT_LE(cv::norm(result, expected, cv::NORM_INF), 1.);
+    EXPECT_EQ(static_cast<size_t>(cv::countNonZero(result_mask)), mask.total());
+}
+
+TEST(seamBandBlender, matchesFixedPointMultiBandBlender)
+{
+    std::vector<Input> inputs = overlappingInputs();
+
+    FixedPointMultiBandBlender expected_blender(2);
+    cv::Mat expected, expected_mask;
+    blend(expected_blender, inputs, expected, expected_mask);
+
+    // Far from the seam, at x = 325, pixels are copied.
+    SeamBandBlender blender(2);
+    blender.setSeams({ cv::Rect(323, 10, 4, 300) });
+    cv::Mat result, result_mask;
+    blend(blender, inputs, result, result_mask);
+
+    ASSERT_EQ(result.type(), CV_16SC3);
+    ASSERT_EQ(cv::Size(result.size()), cv::Size(expected.size()));
+    EXPECT_EQ(cv::norm(result_mask, expected_mask, cv::NORM_INF), 0.);
+    EXPECT_LE(cv::norm(result, expected, cv::NORM_INF), 2.);
+}
+
+TEST(seamBandBlender, onlyBlendsTilesNearSeams)
+{
+    // Two wide images overlapping around x = 1500, in a destination wide
+    // enough for 7 bands.
+    std::vector<Input> inputs;
+    for (int i = 0; i < 2; ++i) {
+        Input input;
+        cv::Mat noise(200, 1600, CV_8UC3);
+        cv::randu(noise, cv::Scalar::all(0), cv::Scalar::all(255));
+        cv::GaussianBlur(noise, noise, cv::Size(9, 9), 3.);
+        cv::add(noise, cv::Scalar::all(i * 40), noise);
+        noise.convertTo(input.image, CV_16S);
+
+        input.corner = cv::Point(i * 1400, 0);
+        input.mask = cv::Mat(noise.size(), CV_8U, cv::Scalar::all(0));
+        int seam = 1500 - input.corner.x;
+        if (i == 0) {
+            input.mask.colRange(0, seam).setTo(255);
+        } else {
+            input.mask.colRange(seam, input.mask.cols).setTo(255);
+        }
+        inputs.push_back(input);
+    }
+
+    FixedPointMultiBandBlender expected_blender(7);
+    cv::Mat expected, expected_mask;
+    blend(expected_blender, inputs, expected, expected_mask);
+
+    SeamBandBlender blender(7);
+    blender.setSeams({ cv::Rect(1498, 0, 4, 200) },
+                     { cv::Rect(inputs[0].corner, inputs[0].image.size()),
+                       cv::Rect(inputs[1].corner, inputs[1].image.size()) });
+    cv::Mat result, result_mask;
+    blender.prepare(cv::Rect(0, 0, 3000, 200));
+    for (const auto &input : inputs) {
+        blender.feed(input.image, input.mask, input.corner);
+    }
+
+    // The reach of 7 bands is 4 * 2^7 = 512 pixels, so band tiles of 32
+    // pixels span x = 960 to 2016, 33 of the 94 columns of 7 rows of tiles.
+    EXPECT_EQ(blender.bandTileCount(), 33u * 7u);
+
+    blender.blend(result, result_mask);
+    ASSERT_EQ(cv::Size(result.size()), cv::Size(expected.size()));
+    EXPECT_EQ(cv::norm(result_mask, expected_mask, cv::NORM_INF), 0.);
+    EXPECT_LE(cv::norm(result, expected, cv::NORM_INF), 2.);
+}
+
+TEST(seamBandBlender, findsSeamRegions)
+{
+    // Two images side by side at seam scale, split at x = 50, twice the size
+    // at blend scale.
+    std::vector<cv::UMat> seam_masks(2);
+    cv::Mat left(40, 60, CV_8U, cv::Scalar::all(0));
+    left.colRange(0, 50).setTo(255);
+    cv::Mat right(40, 60, CV_8U, cv::Scalar::all(0));
+    right.colRange(10, 60).setTo(255);
+    left.copyTo(seam_masks[0]);
+    right.copyTo(seam_masks[1]);
+
+    std::vector<cv::Point> seam_corners { cv::Point(0, 0), cv::Point(40, 0) };
+    std::vector<cv::Point> corners { cv::Point(0, 0), cv::Point(80, 0) };
+    std::vector<cv::Size> sizes { cv::Size(120, 80), cv::Size(120, 80) };
+
+    std::vector<cv::Rect> regions =
+            findSeamRegions(seam_masks, seam_corners, corners, sizes);
+    ASSERT_FALSE(regions.empty());
+
+    cv::Rect bounds = regions.front();
+    for (const auto &region : regions) {
+        bounds |= region;
+    }
+    EXPECT_TRUE(bounds.contains(cv::Point(100, 0)));
+    EXPECT_TRUE(bounds.contains(cv::Point(100, 79)));
+    EXPECT_FALSE(bounds.contains(cv::Point(40, 40)));
+    EXPECT_FALSE(bounds.contains(cv::Point(180, 40)));
+}
@@ -0,0 +1,182 @@
+#include "gtest/gtest.h"
+#include "airmap/opencv/bundle_adjusters.h"
+
+#include <opencv2/calib3d.hpp>
+#include <opencv2/core.hpp>
+
+using airmap::stitcher::opencv::detail::SparseBundleAdjusterRay;
+using cv::detail::CameraParams;
+using cv::detail::ImageFeatures;
+using cv::detail::MatchesInfo;
+
+namespace {
+
+const cv::Size image_size(640, 480);
+const double focal = 500.;
+const int num_cameras = 6;
+
+cv::Mat rotation(double x, double y, double z)
+{
+    cv::Mat R;
+    cv::Rodrigues(cv::Vec3d(x, y, z), R);
+    return R;
+}
+
+bool project(const cv::Mat &R, const cv::Vec3d &ray, cv::Point2f &point)
+{
+    cv::Mat camera_ray = R.t() * cv::Mat(ray);
+    double z = camera_ray.at<double>(2);
+    if (z <= 0.) {
+        return false;
+    }
+    point.x = static_cast<float>(focal * camera_ray.at<double>(0) / z
+                                 + image_size.width * 0.5);
+    point.y = static_cast<float>(focal * camera_ray.at<double>(1) / z
+                                 + image_size.height * 0.5);
+    return point.x >= 0 && point.y >= 0 && point.x < image_size.width
+            && point.y < image_size.height;
+}
+
+/**
+ * @brief synthesize
+ * Create features and matches for cameras rotating around the vertical
+ * axis, from rays that are visible in both cameras of each pair.
+ */
+void synthesize(const std::vector<cv::Mat> &rotations,
+                std::vector<ImageFeatures> &features,
+                std::vector<MatchesInfo> &pairwise_matches)
+{
+    cv::RNG rng(42);
+    const int n = static_cast<int>(rotations.size());
+    features.resize(n);
+    pairwise_matches.resize(n * n);
+    for (int i = 0; i < n; ++i) {
+        features[i].img_idx = i;
+        features[i].img_size = image_size;
+    }
+
+    for (int i = 0; i < n; ++i) {
+        for (int j = i + 1; j < n; ++j) {
+            MatchesInfo &forward = pairwise_matches[i * n + j];
+            MatchesInfo &backward = pairwise_matches[j * n + i];
+            for (int k = 0; k < 2000 && forward.matches.size() < 50; ++k) {
+                cv::Vec3d ray(rng.uniform(-1., 1.), rng.uniform(-0.5, 0.5),
+                              rng.uniform(-1., 1.));
+                cv::Point2f point_i, point_j;
+                if (!project(rotations[i], ray, point_i)
+                    || !project(rotations[j], ray, point_j)) {
+                    continue;
+                }
+                int idx_i = static_cast<int>(features[i].keypoints.size());
+                int idx_j = static_cast<int>(features[j].keypoints.size());
+                features[i].keypoints.push_back(cv::KeyPoint(point_i, 1.f));
+                features[j].keypoints.push_back(cv::KeyPoint(point_j, 1.f));
+                forward.matches.push_back(cv::DMatch(idx_i, idx_j, 0.f));
+                backward.matches.push_back(cv::DMatch(idx_j, idx_i, 0.f));
+            }
+            if (forward.matches.size() < 10) {
+                forward.matches.clear();
+                backward.matches.clear();
+                continue;
+            }
+            for (MatchesInfo *info : { &forward, &backward }) {
+                info->src_img_idx = info == &forward ? i : j;
+                info->dst_img_idx = info == &forward ? j : i;
+                info->inliers_mask.assign(info->matches.size(), 1);
+                info->num_inliers = static_cast<int>(info->matches.size());
+                info->confidence = 2.;
+                info->H = cv::Mat::eye(3, 3, CV_64F);
+            }
+        }
+    }
+}
+
+} // namespace
+
+TEST(bundleAdjusters, sparseRayRecoversRotations)
+{
+    std::vector<cv::Mat> rotations;
+    for (int i = 0; i < num_cameras; ++i) {
+        rotations.push_back(rotation(0., i * 40. * CV_PI / 180., 0.));
+    }
+
+    std::vector<ImageFeatures> features;
+    std::vector<MatchesInfo> pairwise_matches;
+    synthesize(rotations, features, pairwise_matches);
+
+    // Perturb the true camera parameters.
+    std::vector<CameraParams> cameras(num_cameras);
+    for (int i = 0; i < num_cameras; ++i) {
+        cameras[i].focal = focal * 1.05;
+        cameras[i].ppx = image_size.width * 0.5;
+        cameras[i].ppy = image_size.height * 0.5;
+        cv::Mat R = rotation(0.02 * (i % 2), 0.03, -0.01 * i) * rotations[i];
+        R.convertTo(cameras[i].R, CV_32F);
+    }
+
+    std::vector<double> progress;
+    SparseBundleAdjusterRay adjuster;
+    adjuster.setConfThresh(1.);
+    adjuster.setProgressCallback([&progress](double p) { progress.push_back(p); });
+    ASSERT_TRUE(adjuster(features, pairwise_matches, cameras));
+
+    // Relative rotations and focal lengths are recovered.
+    for (int i = 0; i < num_cameras; ++i) {
+        EXPECT_NEAR(cameras[i].focal, focal, 0.5);
+        for (int j = i + 1; j < num_cameras; ++j) {
+            cv::Mat R_i, R_j;
+            cameras[i].R.convertTo(R_i, CV_64F);
+            cameras[j].R.convertTo(R_j, CV_64F);
+            cv::Mat expected = rotations[i].t() * rotations[j];
+            EXPECT_LT(cv::norm(R_i.t() * R_j, expected, cv::NORM_INF), 1e-3);
+        }
+    }
+
+    // Progress is reported, and never goes backwards.
+    ASSERT_FALSE(progress.empty());
+    for (size_t i = 1; i < progress.size(); ++i) {
+        EXPECT_GE(progress[i], progress[i - 1]);
+    }
+    EXPECT_LE(progress.back(), 1.);
+}
+
+TEST(bundleAdjusters, sparseRayMatchesDenseError)
+{
+    std::vector<cv::Mat> rotations;
+    for (int i = 0; i < num_cameras; ++i) {
+        rotations.push_back(rotation(0., i * 40. * CV_PI / 180., 0.));
+    }
+
+    std::vector<ImageFeatures> features;
+    std::vector<MatchesInfo> pairwise_matches;
+    synthesize(rotations, features, pairwise_matches);
+
+    std::vector<CameraParams> sparse_cameras(num_cameras);
+    for (int i = 0; i < num_cameras; ++i) {
+        sparse_cameras[i].focal = focal * 0.97;
+        sparse_cameras[i].ppx = image_size.width * 0.5;
+        sparse_cameras[i].ppy = image_size.height * 0.5;
+        cv::Mat R = rotation(-0.01 * i, 0.02, 0.01 * (i % 3)) * rotations[i];
+        R.convertTo(sparse_cameras[i].R, CV_32F);
+    }
+    std::vector<CameraParams> dense_cameras;
+    for (const auto &camera : sparse_cameras) {
+        dense_cameras.push_back(CameraParams(camera));
+        dense_cameras.back().R = camera.R.clone();
+    }
+
+    SparseBundleAdjusterRay sparse;
+    sparse.setConfThresh(1.);
+    ASSERT_TRUE(sparse(features, pairwise_matches, sparse_cameras));
+
+    cv::detail::BundleAdjusterRay dense;
+    dense.setConfThresh(1.);
+    ASSERT_TRUE(dense(features, pairwise_matches, dense_cameras));
+
+    // Both adjusters converge to the same solution.
+    for (int i = 0; i < num_cameras; ++i) {
+        EXPECT_NEAR(sparse_cameras[i].focal, dense_cameras[i].focal, 0.5);
+        EXPECT_LT(cv::norm(sparse_cameras[i].R, dense_cameras[i].R, cv::NORM_INF),
+                  1e-3);
+    }
+}
@@ -0,0 +1,132 @@
+#include "gtest/gtest.h"
+
+#include "airmap/logging.h"
+#include "airmap/opencv_stitcher.h"
+#include "airmap/panorama.h"
+#include "airmap/stitcher_configuration.h"
+#include "util/images.h"
+
+#include <cmath>
+
+#include <boost/filesystem.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+using airmap::logging::stdoe_logger;
+using util::images::Images;
+
+namespace airmap {
+namespace stitcher {
+
+namespace {
+
+class TestLowLevelOpenCVStitcher : public LowLevelOpenCVStitcher {
+public:
+    TestLowLevelOpenCVStitcher(const Configuration &config,
+                               const std::string &outputPath = "")
+        : LowLevelOpenCVStitcher(
+              config, Panorama{Images::original()},
+              Panorama::Parameters{
+                  Panorama::Parameters::defaultMemoryBudgetMB()},
+              outputPath, std::make_shared<stdoe_logger>())
+    {
+    }
+
+    using LowLevelOpenCVStitcher::composeRoi;
+    using LowLevelOpenCVStitcher::getComposeCanvas;
+    using LowLevelOpenCVStitcher::getComposeWorkScale;
+    using LowLevelOpenCVStitcher::stitch;
+};
+
+/**
+ * @brief stitch
+ * Stitch the fixture images onto a small full sphere canvas, from the
+ * gimbal orientations, so that both compositions start from the same
+ * cameras and seams.
+ */
+void stitch(int compose_tile_size, cv::Mat &result, cv::Mat &result_mask)
+{
+    Configuration config(StitchType::ThreeSixty);
+    config.pose_only = true;
+    config.output_width = 2048;
+    config.compose_tile_size = compose_tile_size;
+    TestLowLevelOpenCVStitcher stitcher(config);
+    stitcher.stitch(result, result_mask);
+}
+
+} // namespace
+
+TEST(compose, stripsMatchWholeCanvas)
+{
+    cv::Mat whole, whole_mask;
+    stitch(0, whole, whole_mask);
+
+    cv::Mat strips, strips_mask;
+    stitch(200, strips, strips_mask);
+
+    ASSERT_EQ(strips.size(), whole.size());
+    ASSERT_EQ(strips.type(), whole.type());
+    EXPECT_EQ(cv::countNonZero(strips_mask != whole_mask), 0);
+
+    // The halo of each strip covers the reach of the blender, and strips are
+    // aligned to its coarsest level, so only rounding may differ.
+    EXPECT_LE(cv::norm(strips, whole, cv::NORM_INF), 2.);
+}
+
+TEST(compose, fullSphereCanvas)
+{
+    LowLevelOpenCVStitcher::WarpResults warp_results(2);
+    warp_results.corners = {cv::Point(-300, 40), cv::Point(100, 20)};
+    warp_results.sizes = {cv::Size(500, 300), cv::Size(400, 200)};
+
+    Configuration config(StitchType::ThreeSixty);
+    config.output_width = 2048;
+    TestLowLevelOpenCVStitcher stitcher(config);
+
+    // Longitudes [-pi, pi] and colatitudes [0, pi] at 2048 / (2 pi) pixels
+    // per radian.
+    EXPECT_EQ(stitcher.getComposeCanvas(), cv::Rect(-1024, 0, 2048, 1024));
+    EXPECT_EQ(stitcher.composeRoi(warp_results), cv::Rect(-1024, 0, 2048, 1024));
+    EXPECT_FLOAT_EQ(stitcher.getComposeWorkScale(1000.f, 0.5f),
+                    static_cast<float>(2048 / (2. * M_PI)));
+
+    // Without an output width, the panorama is composed onto the images.
+    TestLowLevelOpenCVStitcher unbounded(Configuration(StitchType::ThreeSixty));
+    EXPECT_TRUE(unbounded.getComposeCanvas().empty());
+    EXPECT_EQ(unbounded.composeRoi(warp_results), cv::Rect(-300, 20, 800, 320));
+    EXPECT_FLOAT_EQ(unbounded.getComposeWorkScale(1000.f, 0.5f), 500.f);
+}
+
+TEST(compose, fullSphereIsNotCroppedOrPadded)
+{
+    boost::filesystem::path directory =
+        boost::filesystem::temp_directory_path() /
+        boost::filesystem::unique_path("compose-%%%%%%%%");
+    boost::filesystem::create_directories(directory);
+    std::string outputPath = (directory / "panorama.jpg").string();
+
+    Configuration config(StitchType::ThreeSixty);
+    config.output_width = 600;
+    TestLowLevelOpenCVStitcher stitcher(config, outputPath);
+
+    // Null regions at the top and on the left, which would be cropped from
+    // a panorama of the images only.
+    cv::Mat result(300, 600, CV_8UC3, cv::Scalar::all(128));
+    result.rowRange(0, 50).setTo(cv::Scalar::all(0));
+    result.colRange(0, 40).setTo(cv::Scalar::all(0));
+    cv::Mat result_mask(result.size(), CV_8U, cv::Scalar::all(255));
+    result_mask.rowRange(0, 50).setTo(cv::Scalar::all(0));
+    stitcher.postprocess(result.clone(), std::move(result_mask), true);
+
+    cv::Mat written = cv::imread(outputPath);
+    ASSERT_EQ(written.size(), result.size());
+    // Null regions stay where they are, away from the ringing of JPEG at
+    // their edges.
+    EXPECT_LE(cv::mean(written(cv::Rect(0, 0, 600, 40)))[0], 4.);
+    EXPECT_LE(cv::mean(written(cv::Rect(0, 60, 30, 240)))[0], 4.);
+    EXPECT_NEAR(cv::mean(written(cv::Rect(50, 60, 550, 240)))[0], 128., 4.);
+
+    boost::filesystem::remove_all(directory);
+}
+
+} // namespace stitcher
+} // namespace airmap
@@ -0,0 +1,112 @@
+#include "gtest/gtest.h"
+#include "cropper.h"
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+namespace {
+
+class TestCropper : public Cropper
+{
+public:
+    /**
+     * @brief insetBounds
+     * Crop rectangle of an image, as found by cropNullEdges.
+     */
+    cv::Rect insetBounds(const cv::Mat &original)
+    {
+        return Cropper::insetBounds(bestContourRect(buildPanoramaMask(original)),
+                                    original.size());
+    }
+
+    /**
+     * @brief erodedBounds
+     * Crop rectangle of an image, as found before insetBounds: the mask of a
+     * bordered copy of the image is filled with the bounding rectangle of its
+     * contour, eroded until nothing is left outside of the rectangle, and
+     * searched for contours again, less the border.
+     */
+    cv::Rect erodedBounds(const cv::Mat &original)
+    {
+        cv::Mat bordered;
+        cv::copyMakeBorder(original, bordered, borderPixels_, borderPixels_,
+                           borderPixels_, borderPixels_, cv::BORDER_CONSTANT, { 0.f });
+        cv::Mat panorama_mask = buildPanoramaMask(bordered);
+        cv::Rect bounds = bestContourRect(panorama_mask);
+
+        cv::Mat crop_mask(panorama_mask.size(), CV_8U, cv::Scalar::all(0));
+        cv::rectangle(crop_mask, bounds.tl(), bounds.br(), cv::Scalar { 255.f },
+                      cv::FILLED);
+
+        cv::Mat eroded_mask = crop_mask.clone();
+        cv::Mat sub = crop_mask.clone();
+        while (auto nz = cv::countNonZero(sub)) {
+            cv::Mat eroded;
+            cv::erode(eroded_mask, eroded,
+                      cv::getStructuringElement(cv::MORPH_RECT, cv::Size { 3, 3 }));
+            eroded_mask = eroded;
+            cv::subtract(eroded_mask, crop_mask, sub);
+            if (cv::countNonZero(sub) == nz) {
+                break;
+            }
+        }
+
+        return bestContourRect(eroded_mask(
+                cv::Rect { cv::Point { borderPixels_, borderPixels_ },
+                           cv::Point { original.cols, original.rows } }));
+    }
+};
+
+} // namespace
+
+TEST(cropper, insetBoundsMatchesErosion)
+{
+    std::vector<cv::Mat> images;
+
+    // Image data everywhere.
+    images.emplace_back(120, 240, CV_8UC3, cv::Scalar::all(128));
+
+    // Ragged null edges on every side.
+    cv::Mat ragged(120, 240, CV_8UC3, cv::Scalar::all(0));
+    for (int y = 6; y < 110; ++y) {
+        int left = 3 + (y * 7) % 11;
+        int right = 230 - (y * 5) % 13;
+        ragged.row(y).colRange(left, right).setTo(cv::Scalar::all(128));
+    }
+    images.push_back(ragged);
+
+    // A null hole reaching in from the top edge.
+    cv::Mat hole(120, 240, CV_8UC3, cv::Scalar::all(128));
+    hole(cv::Rect(90, 0, 40, 50)).setTo(cv::Scalar::all(0));
+    images.push_back(hole);
+
+    TestCropper cropper;
+    for (size_t i = 0; i < images.size(); ++i) {
+        EXPECT_EQ(cropper.insetBounds(images[i]), cropper.erodedBounds(images[i])) << i;
+    }
+}
+
+TEST(cropper, cropsAlongTheGivenMask)
+{
+    // Image data everywhere, with a black band at the top that is part of the
+    // panorama.
+    cv::Mat image(200, 400, CV_8UC3, cv::Scalar::all(128));
+    image.rowRange(0, 30).setTo(cv::Scalar::all(0));
+    cv::Mat mask(image.size(), CV_8U, cv::Scalar::all(255));
+
+    Cropper cropper;
+    cv::Size whole;
+    cv::Point offset;
+
+    // The band is kept along the mask.
+    cv::Mat cropped = cropper.cropNullEdges(image, mask, 0.5);
+    cropped.locateROI(whole, offset);
+    EXPECT_EQ(offset, cv::Point(1, 1));
+    EXPECT_EQ(cropped.size(), cv::Size(389, 189));
+
+    // It is taken for a null region without one.
+    cropped = cropper.cropNullEdges(image, 0.5);
+    cropped.locateROI(whole, offset);
+    EXPECT_EQ(offset, cv::Point(1, 31));
+    EXPECT_EQ(cropped.size(), cv::Size(389, 159));
+}
@@ -0,0 +1,145 @@
+#include "gtest/gtest.h"
+#include "cubemap.h"
+
+#include <cmath>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+namespace {
+
+/**
+ * @brief baselineFace
+ * A face as written before face maps were cached: resampled with float maps of
+ * width rows and height columns, then transposed and flipped if there is a flip code.
+ */
+cv::Mat baselineFace(const cv::Mat &in, CubeMap::Face faceId, int width, int height,
+                     CubeMap::FlipCode flipCode)
+{
+    const float faceTransform[6][2] = { { 0, 0 },         { M_PI / 2, 0 },
+                                        { M_PI, 0 },      { -M_PI / 2, 0 },
+                                        { 0, -M_PI / 2 }, { 0, M_PI / 2 } };
+    const float inWidth = in.cols;
+    const float inHeight = in.rows;
+
+    cv::Mat mapx(width, height, CV_32F);
+    cv::Mat mapy(width, height, CV_32F);
+
+    const float an = sin(M_PI / 4);
+    const float ak = cos(M_PI / 4);
+    const float ftu = faceTransform[static_cast<int>(faceId)][0];
+    const float ftv = faceTransform[static_cast<int>(faceId)][1];
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            float nx = ((float)y / (float)height - 0.5f) * 2 * an;
+            float ny = ((float)x / (float)width - 0.5f) * 2 * an;
+
+            float u, v;
+            if (ftv == 0) {
+                u = atan2(nx, ak);
+                v = atan2(ny * cos(u), ak);
+                u += ftu;
+            } else if (ftv > 0) {
+                float d = sqrt(nx * nx + ny * ny);
+                v = M_PI / 2 - atan2(d, ak);
+                u = atan2(ny, nx);
+            } else {
+                float d = sqrt(nx * nx + ny * ny);
+                v = -M_PI / 2 + atan2(d, ak);
+                u = atan2(-ny, nx);
+            }
+
+            u = u / (M_PI);
+            v = v / (M_PI / 2);
+            while (v < -1) {
+                v += 2;
+                u += 1;
+            }
+            while (v > 1) {
+                v -= 2;
+                u += 1;
+            }
+            while (u < -1) {
+                u += 2;
+            }
+            while (u > 1) {
+                u -= 2;
+            }
+
+            mapx.at<float>(x, y) = (u / 2.0f + 0.5f) * (inWidth - 1);
+            mapy.at<float>(x, y) = (v / 2.0f + 0.5f) * (inHeight - 1);
+        }
+    }
+
+    cv::Mat face;
+    cv::remap(in, face, mapx, mapy, cv::INTER_CUBIC, cv::BORDER_CONSTANT,
+              cv::Scalar(0, 0, 0));
+    if (flipCode != CubeMap::FlipCode::None) {
+        cv::transpose(face, face);
+        cv::flip(face, face, static_cast<int>(flipCode));
+    }
+    return face;
+}
+
+cv::Mat panorama()
+{
+    cv::Mat in(256, 512, CV_8UC3);
+    cv::randu(in, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::GaussianBlur(in, in, cv::Size(15, 15), 4.);
+    return in;
+}
+
+} // namespace
+
+TEST(cubeMap, matchesBaselineFaces)
+{
+    cv::Mat in = panorama();
+    CubeMap::clearFaceMapsCache();
+
+    // Faces that aren't square catch mixed up rows and columns.
+    for (int i = 0; i < static_cast<int>(CubeMap::Face::NumFaces); ++i) {
+        CubeMap::Face faceId = static_cast<CubeMap::Face>(i);
+        for (CubeMap::FlipCode flipCode :
+             { CubeMap::FlipCode::None, CubeMap::FlipCode::X, CubeMap::FlipCode::Y }) {
+            cv::Mat expected = baselineFace(in, faceId, 96, 80, flipCode);
+            cv::Mat face;
+            CubeMap::createFace(in, face, faceId, 96, 80, flipCode);
+
+            ASSERT_EQ(face.size(), expected.size()) << i;
+            // Fixed-point maps sample at a 32nd of a pixel.
+            cv::Mat difference;
+            cv::absdiff(face, expected, difference);
+            EXPECT_LE(cv::countNonZero(difference.reshape(1) > 2),
+                      static_cast<int>(difference.total() / 1000))
+                    << i << " " << static_cast<int>(flipCode);
+        }
+    }
+}
+
+TEST(cubeMap, boundsFaceMapsCache)
+{
+    cv::Mat in = panorama();
+    cv::Mat face;
+    CubeMap::clearFaceMapsCache();
+
+    // Disabled by default.
+    CubeMap::createFace(in, face, CubeMap::Face::Front, 128, 128);
+    EXPECT_EQ(CubeMap::faceMapsCacheSize(), 0u);
+
+    // CV_16SC2 and CV_16UC1 maps take 6 bytes per pixel of the face.
+    size_t faceBytes = 128 * 128 * 6;
+    CubeMap::setFaceMapsCacheLimit(2 * faceBytes);
+    CubeMap::createFace(in, face, CubeMap::Face::Front, 128, 128);
+    CubeMap::createFace(in, face, CubeMap::Face::Right, 128, 128);
+    EXPECT_EQ(CubeMap::faceMapsCacheSize(), 2 * faceBytes);
+    CubeMap::createFace(in, face, CubeMap::Face::Back, 128, 128);
+    EXPECT_EQ(CubeMap::faceMapsCacheSize(), 2 * faceBytes);
+
+    CubeMap::setFaceMapsCacheLimit(faceBytes);
+    EXPECT_EQ(CubeMap::faceMapsCacheSize(), faceBytes);
+
+    CubeMap::clearFaceMapsCache();
+    EXPECT_EQ(CubeMap::faceMapsCacheSize(), 0u);
+    CubeMap::setFaceMapsCacheLimit(0);
+}
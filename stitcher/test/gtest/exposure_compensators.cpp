@@ -0,0 +1,95 @@
+#include "gtest/gtest.h"
+#include "airmap/opencv/exposure_compensators.h"
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/stitching/detail/exposure_compensate.hpp>
+
+using airmap::stitcher::opencv::detail::ParallelBlocksGainCompensator;
+
+namespace {
+
+struct Inputs
+{
+    std::vector<cv::Point> corners;
+    std::vector<cv::UMat> images;
+    std::vector<std::pair<cv::UMat, uchar>> masks;
+};
+
+/**
+ * @brief scaledCrops
+ * Crops of a scene, half overlapping the next, scaled by 0.8, 1.0 and 1.2,
+ * so that the gains to find are known.
+ */
+Inputs scaledCrops()
+{
+    cv::Mat scene(160, 400, CV_8UC3);
+    cv::randu(scene, cv::Scalar::all(40), cv::Scalar::all(200));
+    cv::GaussianBlur(scene, scene, cv::Size(15, 15), 5.);
+
+    Inputs inputs;
+    for (int i = 0; i < 3; ++i) {
+        cv::Point corner(i * 100, 0);
+        cv::Mat image;
+        scene(cv::Rect(corner, cv::Size(200, 160))).convertTo(image, CV_8U, 0.8 + 0.2 * i);
+        cv::Mat mask(image.size(), CV_8U, cv::Scalar::all(255));
+
+        inputs.corners.push_back(corner);
+        inputs.images.push_back(image.getUMat(cv::ACCESS_READ).clone());
+        inputs.masks.emplace_back(mask.getUMat(cv::ACCESS_READ).clone(), uchar(255));
+    }
+    return inputs;
+}
+
+} // namespace
+
+TEST(parallelBlocksGainCompensator, matchesBlocksGainCompensator)
+{
+    Inputs inputs = scaledCrops();
+
+    cv::detail::BlocksGainCompensator expected_compensator(32, 32);
+    expected_compensator.feed(inputs.corners, inputs.images, inputs.masks);
+    std::vector<cv::Mat> expected_gains;
+    expected_compensator.getMatGains(expected_gains);
+
+    ParallelBlocksGainCompensator compensator(32, 32);
+    compensator.feed(inputs.corners, inputs.images, inputs.masks);
+    std::vector<cv::Mat> gains;
+    compensator.getMatGains(gains);
+
+    ASSERT_EQ(gains.size(), expected_gains.size());
+    for (size_t i = 0; i < gains.size(); ++i) {
+        ASSERT_EQ(gains[i].size(), expected_gains[i].size());
+        EXPECT_LE(cv::norm(gains[i], expected_gains[i], cv::NORM_INF), 1e-3);
+    }
+
+    for (size_t i = 0; i < inputs.images.size(); ++i) {
+        cv::Mat expected = inputs.images[i].getMat(cv::ACCESS_READ).clone();
+        expected_compensator.apply(static_cast<int>(i), inputs.corners[i], expected,
+                                   inputs.masks[i].first);
+        cv::Mat result = inputs.images[i].getMat(cv::ACCESS_READ).clone();
+        compensator.apply(static_cast<int>(i), inputs.corners[i], result,
+                          inputs.masks[i].first);
+        EXPECT_LE(cv::norm(result, expected, cv::NORM_INF), 1.);
+    }
+}
+
+TEST(parallelBlocksGainCompensator, appliesRowsAsWholeImage)
+{
+    Inputs inputs = scaledCrops();
+
+    ParallelBlocksGainCompensator compensator(32, 32);
+    compensator.feed(inputs.corners, inputs.images, inputs.masks);
+
+    cv::Mat image = inputs.images[2].getMat(cv::ACCESS_READ).clone();
+    cv::Mat expected = image.clone();
+    compensator.apply(2, inputs.corners[2], expected, inputs.masks[2].first);
+
+    // Compensate uneven strips of rows, as produced by a tiled warp.
+    cv::Mat result = image.clone();
+    for (int first_row = 0; first_row < result.rows; first_row += 37) {
+        cv::Mat rows = result.rowRange(first_row, std::min(first_row + 37, result.rows));
+        compensator.applyRows(2, result.size(), first_row, rows);
+    }
+    EXPECT_EQ(cv::norm(result, expected, cv::NORM_INF), 0.);
+}
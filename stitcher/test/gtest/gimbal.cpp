@@ -126,3 +126,38 @@ TEST(gimbal, gimbalRotationMatrix)
     EXPECT_DOUBLE_EQ(R.at<double>(2, 1), 0);
     EXPECT_DOUBLE_EQ(R.at<double>(2, 2), cos_negative_angle);
 }
+
+TEST(gimbal, gimbalCameraRotation)
+{
+    cv::Mat forward = (cv::Mat_<double>(3, 1) << 0, 0, 1);
+    cv::Mat right = (cv::Mat_<double>(3, 1) << 1, 0, 0);
+    cv::Mat world;
+
+    // Level camera facing yaw 0.
+    EXPECT_NEAR(cv::norm(GimbalOrientation(0, 0, 0).cameraRotation(),
+                         cv::Mat::eye(3, 3, CV_64F)), 0, 1e-12);
+
+    // Yaw turns forward towards the right.
+    world = GimbalOrientation(0, 0, 90).cameraRotation() * forward;
+    EXPECT_NEAR(world.at<double>(0), 1, 1e-12);
+    EXPECT_NEAR(world.at<double>(1), 0, 1e-12);
+    EXPECT_NEAR(world.at<double>(2), 0, 1e-12);
+
+    // Pitching down by 90 degrees looks at the ground (y is down).
+    world = GimbalOrientation(-90, 0, 0).cameraRotation() * forward;
+    EXPECT_NEAR(world.at<double>(0), 0, 1e-12);
+    EXPECT_NEAR(world.at<double>(1), 1, 1e-12);
+    EXPECT_NEAR(world.at<double>(2), 0, 1e-12);
+
+    // Roll turns right side down.
+    world = GimbalOrientation(0, 90, 0).cameraRotation() * right;
+    EXPECT_NEAR(world.at<double>(0), 0, 1e-12);
+    EXPECT_NEAR(world.at<double>(1), 1, 1e-12);
+    EXPECT_NEAR(world.at<double>(2), 0, 1e-12);
+
+    // Pitch is applied after yaw, so a pitched camera keeps its heading.
+    world = GimbalOrientation(-45, 0, 90).cameraRotation() * forward;
+    EXPECT_NEAR(world.at<double>(0), std::sqrt(0.5), 1e-12);
+    EXPECT_NEAR(world.at<double>(1), std::sqrt(0.5), 1e-12);
+    EXPECT_NEAR(world.at<double>(2), 0, 1e-12);
+}
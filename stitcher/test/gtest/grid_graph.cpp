@@ -0,0 +1,107 @@
+#include "gtest/gtest.h"
+#include "airmap/opencv/grid_graph.h"
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc/detail/gcgraph.hpp>
+
+using airmap::stitcher::opencv::detail::GridGraph;
+
+namespace {
+
+/**
+ * @brief seamLikeGrid
+ * Terminal and edge weights of a seam graph: the left columns are tied to
+ * the source, the right columns to the sink, and edges are random in
+ * between.
+ */
+void seamLikeGrid(cv::Size size, cv::Mat &source, cv::Mat &sink, cv::Mat &horizontal,
+                  cv::Mat &vertical)
+{
+    source = cv::Mat(size, CV_32F, cv::Scalar::all(0));
+    sink = cv::Mat(size, CV_32F, cv::Scalar::all(0));
+    source.colRange(0, 3).setTo(10000.f);
+    sink.colRange(size.width - 3, size.width).setTo(10000.f);
+
+    horizontal.create(size, CV_32F);
+    vertical.create(size, CV_32F);
+    cv::randu(horizontal, cv::Scalar::all(1), cv::Scalar::all(50));
+    cv::randu(vertical, cv::Scalar::all(1), cv::Scalar::all(50));
+}
+
+} // namespace
+
+TEST(gridGraph, matchesGCGraph)
+{
+    cv::Size size(57, 43);
+    cv::Mat source, sink, horizontal, vertical;
+    seamLikeGrid(size, source, sink, horizontal, vertical);
+
+    cv::detail::GCGraph<float> expected_graph(size.area(), 2 * size.area());
+    for (int y = 0; y < size.height; ++y) {
+        for (int x = 0; x < size.width; ++x) {
+            int v = expected_graph.addVtx();
+            expected_graph.addTermWeights(v, source.at<float>(y, x), sink.at<float>(y, x));
+        }
+    }
+    for (int y = 0; y < size.height; ++y) {
+        for (int x = 0; x < size.width; ++x) {
+            int v = y * size.width + x;
+            if (x < size.width - 1) {
+                float weight = horizontal.at<float>(y, x);
+                expected_graph.addEdges(v, v + 1, weight, weight);
+            }
+            if (y < size.height - 1) {
+                float weight = vertical.at<float>(y, x);
+                expected_graph.addEdges(v, v + size.width, weight, weight);
+            }
+        }
+    }
+    float expected_flow = expected_graph.maxFlow();
+
+    GridGraph graph;
+    // Reusing a graph starts from a clean grid.
+    graph.create(cv::Size(5, 5));
+    graph.addTermWeights(3, 1.f, 0.f);
+    graph.create(size);
+    for (int y = 0; y < size.height; ++y) {
+        for (int x = 0; x < size.width; ++x) {
+            graph.addTermWeights(y * size.width + x, source.at<float>(y, x),
+                                 sink.at<float>(y, x));
+        }
+    }
+    graph.setEdgeWeights(horizontal, vertical);
+    float flow = graph.maxFlow();
+
+    EXPECT_EQ(flow, expected_flow);
+    for (int v = 0; v < size.area(); ++v) {
+        EXPECT_EQ(graph.inSourceSegment(v), expected_graph.inSourceSegment(v)) << v;
+    }
+}
+
+TEST(gridGraph, ignoresZeroEdges)
+{
+    // A band down the middle of the grid, separated from the rest, whose
+    // source ties are its minimum cut: the band reaches the sink, and pixels
+    // outside it stay in the source segment, as unconnected vertices of a
+    // GCGraph would.
+    cv::Size size(20, 10);
+    cv::Mat horizontal(size, CV_32F, cv::Scalar::all(0));
+    cv::Mat vertical(size, CV_32F, cv::Scalar::all(0));
+    horizontal.colRange(8, 11).setTo(5.f);
+    vertical.colRange(8, 12).setTo(5.f);
+
+    GridGraph graph;
+    graph.create(size);
+    for (int y = 0; y < size.height; ++y) {
+        graph.addTermWeights(y * size.width + 8, 3.f, 0.f);
+        graph.addTermWeights(y * size.width + 11, 0.f, 10.f);
+    }
+    graph.setEdgeWeights(horizontal, vertical);
+
+    EXPECT_FLOAT_EQ(graph.maxFlow(), 30.f);
+    for (int y = 0; y < size.height; ++y) {
+        EXPECT_FALSE(graph.inSourceSegment(y * size.width + 8));
+        EXPECT_FALSE(graph.inSourceSegment(y * size.width + 11));
+        EXPECT_TRUE(graph.inSourceSegment(y * size.width + 2));
+    }
+}
@@ -0,0 +1,103 @@
+#include "gtest/gtest.h"
+
+#include "airmap/incremental_opencv_stitcher.h"
+#include "airmap/logging.h"
+#include "airmap/panorama.h"
+#include "airmap/stitcher_configuration.h"
+#include "util/images.h"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+using airmap::logging::Logger;
+using util::images::Images;
+
+namespace airmap {
+namespace stitcher {
+
+namespace {
+
+/**
+ * @brief The RecordingLogger class
+ * Keeps the messages logged, to check which steps a stitch took.
+ */
+class RecordingLogger : public Logger {
+public:
+    void log(Severity, const char *message, const char *) override
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _messages.push_back(message);
+    }
+
+    bool should_log(Severity, const char *, const char *) override { return true; }
+
+    bool logged(const std::string &message)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return std::find(_messages.begin(), _messages.end(), message) != _messages.end();
+    }
+
+private:
+    std::mutex _mutex;
+    std::vector<std::string> _messages;
+};
+
+/**
+ * @brief stitchIncrementally
+ * Stitch the fixture images, adding all but the first one as they would be
+ * while being downloaded.
+ */
+void stitchIncrementally(const boost::filesystem::path &directory,
+                         std::shared_ptr<Logger> logger)
+{
+    std::list<GeoImage> input = Images::original();
+    Panorama::Parameters parameters { Panorama::Parameters::defaultMemoryBudgetMB() };
+    parameters.stitchTemplatesPath = (directory / "templates").string();
+
+    IncrementalOpenCVStitcher stitcher(Configuration(StitchType::ThreeSixty),
+                                       Panorama { input.front() }, parameters,
+                                       (directory / "panorama.jpg").string(), logger);
+    for (auto image = std::next(input.begin()); image != input.end(); ++image) {
+        ASSERT_TRUE(stitcher.add(*image));
+    }
+    stitcher.stitch();
+}
+
+} // namespace
+
+TEST(incrementalStitcher, cancelledStitchThrows)
+{
+    std::list<GeoImage> input = Images::original();
+    IncrementalOpenCVStitcher stitcher(
+            Configuration(StitchType::ThreeSixty), Panorama { input },
+            Panorama::Parameters { Panorama::Parameters::defaultMemoryBudgetMB() }, "",
+            std::make_shared<RecordingLogger>());
+    stitcher.cancel();
+    EXPECT_THROW(stitcher.stitch(), std::runtime_error);
+}
+
+TEST(incrementalStitcher, reusesStitchTemplate)
+{
+    boost::filesystem::path directory =
+            boost::filesystem::temp_directory_path()
+            / boost::filesystem::unique_path("incremental-stitcher-%%%%%%%%");
+
+    auto first = std::make_shared<RecordingLogger>();
+    stitchIncrementally(directory, first);
+    EXPECT_FALSE(first->logged("Reusing seams from stitch template."));
+
+    // A second capture of the site starts from the cameras and seams of the
+    // first.
+    auto second = std::make_shared<RecordingLogger>();
+    stitchIncrementally(directory, second);
+    EXPECT_TRUE(second->logged("Reusing seams from stitch template."));
+    EXPECT_TRUE(boost::filesystem::exists(directory / "panorama.jpg"));
+
+    boost::filesystem::remove_all(directory);
+}
+
+} // namespace stitcher
+} // namespace airmap
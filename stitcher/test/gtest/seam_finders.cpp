@@ -0,0 +1,301 @@
+#include "gtest/gtest.h"
+#include "airmap/camera.h"
+#include "airmap/camera_models.h"
+#include "airmap/logging.h"
+#include "airmap/opencv/seam_finders.h"
+
+#include <cstdlib>
+#include <set>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/stitching/detail/seam_finders.hpp>
+
+using airmap::logging::stdoe_logger;
+using airmap::stitcher::Camera;
+using airmap::stitcher::CameraModels;
+using airmap::stitcher::monitor::OperationsEstimator;
+using airmap::stitcher::opencv::detail::MonitoredGraphCutSeamFinder;
+using airmap::stitcher::opencv::detail::ParallelVoronoiSeamFinder;
+using airmap::stitcher::opencv::detail::SeamPair;
+using airmap::stitcher::opencv::detail::gradientMagnitudes;
+using airmap::stitcher::opencv::detail::scheduleSeamPairs;
+
+namespace {
+
+/**
+ * @brief ringOfImages
+ * Images in a ring, each overlapping its neighbours, plus one in the middle
+ * overlapping all of them.
+ */
+void ringOfImages(std::vector<cv::Point> &corners, std::vector<cv::Size> &sizes)
+{
+    for (int i = 0; i < 6; ++i) {
+        corners.emplace_back(i * 80, (i % 2) * 30);
+        sizes.emplace_back(100, 100);
+    }
+    corners.emplace_back(50, 50);
+    sizes.emplace_back(400, 40);
+}
+
+/**
+ * @brief sobelMagnitude
+ * Sum over the channels of the squared Sobel derivative of an image.
+ */
+cv::Mat sobelMagnitude(const cv::Mat &image, int dx, int dy)
+{
+    cv::Mat derivative;
+    cv::Sobel(image, derivative, CV_32F, dx, dy);
+    cv::Mat squared = derivative.mul(derivative);
+    std::vector<cv::Mat> channels;
+    cv::split(squared, channels);
+    return channels[0] + channels[1] + channels[2];
+}
+
+/**
+ * @brief seamColumns
+ * Find the seam between two images of a scene with a vertical edge at
+ * x = 202, in the middle of their overlap, with noise where they differ,
+ * two levels down with the given band radius.  Every pixel is expected to
+ * be kept by an image.
+ * @return Column of the scene from which the second image is kept, for each
+ * row away from the top and bottom.
+ */
+std::vector<int> seamColumns(int band_radius)
+{
+    cv::Mat scene(120, 400, CV_8UC3, cv::Scalar::all(60));
+    scene.colRange(202, 400).setTo(cv::Scalar::all(190));
+    std::vector<cv::Point> corners { cv::Point(0, 0), cv::Point(148, 1) };
+    std::vector<cv::UMat> images, masks;
+    cv::RNG rng(0);
+    for (size_t i = 0; i < corners.size(); ++i) {
+        cv::Mat image = scene(cv::Rect(corners[i], cv::Size(252, 119))).clone();
+        cv::Mat noise(image.size(), CV_8UC3);
+        rng.fill(noise, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(40));
+        cv::add(image, noise, image);
+        images.push_back(image.getUMat(cv::ACCESS_READ).clone());
+        masks.emplace_back(image.size(), CV_8U, cv::Scalar::all(255));
+    }
+
+    auto logger = std::make_shared<stdoe_logger>();
+    auto monitor = airmap::stitcher::monitor::Monitor::create(
+            OperationsEstimator::create(
+                    std::make_shared<Camera>(CameraModels::ParrotAnafiThermal()), logger),
+            logger);
+    MonitoredGraphCutSeamFinder finder(monitor);
+    finder.setLevels(2, band_radius);
+    finder.find(images, corners, masks);
+
+    cv::Mat mask1 = masks[0].getMat(cv::ACCESS_READ);
+    cv::Mat mask2 = masks[1].getMat(cv::ACCESS_READ);
+    std::vector<int> columns;
+    for (int y = 5; y < 114; ++y) {
+        int column = 252;
+        for (int x = 148; x < 252; ++x) {
+            bool kept1 = mask1.at<uchar>(y, x) != 0;
+            bool kept2 = mask2.at<uchar>(y - 1, x - 148) != 0;
+            EXPECT_TRUE(kept1 || kept2);
+            if (!kept1 && column == 252) {
+                column = x;
+            }
+        }
+        columns.push_back(column);
+    }
+    return columns;
+}
+
+} // namespace
+
+TEST(gradientMagnitudes, matchesSobel)
+{
+    // Odd sizes, more rows than a strip, and a single row image, with
+    // reflected borders all around.
+    std::vector<cv::UMat> images;
+    for (cv::Size size : { cv::Size(53, 77), cv::Size(40, 1), cv::Size(1, 40) }) {
+        cv::Mat image(size, CV_8UC3);
+        cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(255));
+        images.push_back(image.getUMat(cv::ACCESS_READ).clone());
+    }
+    cv::Mat float_image(45, 61, CV_32FC3);
+    cv::randu(float_image, cv::Scalar::all(-1), cv::Scalar::all(1));
+    images.push_back(float_image.getUMat(cv::ACCESS_READ).clone());
+
+    std::vector<cv::Mat> dx, dy;
+    gradientMagnitudes(images, dx, dy);
+
+    ASSERT_EQ(dx.size(), images.size());
+    ASSERT_EQ(dy.size(), images.size());
+    for (size_t i = 0; i < images.size(); ++i) {
+        cv::Mat image = images[i].getMat(cv::ACCESS_READ);
+        cv::Mat expected_dx = sobelMagnitude(image, 1, 0);
+        cv::Mat expected_dy = sobelMagnitude(image, 0, 1);
+        ASSERT_EQ(dx[i].size(), expected_dx.size());
+        ASSERT_EQ(dy[i].size(), expected_dy.size());
+
+        // Exact in integers for 8 bit images, up to rounding for floats.
+        double tolerance = image.depth() == CV_8U ? 0. : 1e-3;
+        EXPECT_LE(cv::norm(dx[i], expected_dx, cv::NORM_INF), tolerance) << i;
+        EXPECT_LE(cv::norm(dy[i], expected_dy, cv::NORM_INF), tolerance) << i;
+    }
+}
+
+TEST(scheduleSeamPairs, batchesPairsWithoutSharedImages)
+{
+    std::vector<cv::Point> corners;
+    std::vector<cv::Size> sizes;
+    ringOfImages(corners, sizes);
+
+    std::vector<std::vector<SeamPair>> batches = scheduleSeamPairs(corners, sizes);
+
+    // Each overlapping pair is scheduled exactly once.
+    std::set<std::pair<size_t, size_t>> scheduled;
+    for (const auto &batch : batches) {
+        std::set<size_t> images;
+        for (const auto &pair : batch) {
+            EXPECT_TRUE(images.insert(pair.first).second);
+            EXPECT_TRUE(images.insert(pair.second).second);
+            EXPECT_TRUE(scheduled.emplace(pair.first, pair.second).second);
+        }
+    }
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        for (size_t j = i + 1; j < sizes.size(); ++j) {
+            cv::Rect overlap = cv::Rect(corners[i], sizes[i]) & cv::Rect(corners[j], sizes[j]);
+            EXPECT_EQ(scheduled.count({ i, j }), overlap.empty() ? 0u : 1u);
+        }
+    }
+
+    // Pairs sharing an image keep their sequential order.
+    std::vector<std::pair<size_t, size_t>> last_pair(sizes.size(), { 0, 0 });
+    for (const auto &batch : batches) {
+        for (const auto &pair : batch) {
+            for (size_t image : { pair.first, pair.second }) {
+                EXPECT_LE(last_pair[image], std::make_pair(pair.first, pair.second));
+                last_pair[image] = { pair.first, pair.second };
+            }
+        }
+    }
+
+    // The pairs of neighbours in the ring don't all have to wait for each
+    // other.
+    EXPECT_LT(batches.size(), scheduled.size());
+}
+
+TEST(parallelVoronoiSeamFinder, matchesVoronoiSeamFinder)
+{
+    std::vector<cv::Point> corners;
+    std::vector<cv::Size> sizes;
+    ringOfImages(corners, sizes);
+
+    std::vector<cv::UMat> images;
+    std::vector<cv::UMat> expected_masks, masks;
+    for (const auto &size : sizes) {
+        images.emplace_back(size, CV_8UC3, cv::Scalar::all(128));
+        expected_masks.emplace_back(size, CV_8U, cv::Scalar::all(255));
+        masks.emplace_back(size, CV_8U, cv::Scalar::all(255));
+    }
+
+    cv::detail::VoronoiSeamFinder expected_finder;
+    expected_finder.find(images, corners, expected_masks);
+
+    ParallelVoronoiSeamFinder finder;
+    finder.find(images, corners, masks);
+
+    for (size_t i = 0; i < masks.size(); ++i) {
+        EXPECT_EQ(cv::norm(masks[i], expected_masks[i], cv::NORM_INF), 0.);
+    }
+}
+
+TEST(monitoredGraphCutSeamFinder, refinesCoarseSeams)
+{
+    // Refined seams follow the edge.  Seams upscaled from two levels down,
+    // as with a band of 0 pixels, are a multiple of 4 pixels, 2 pixels away
+    // from it.
+    std::vector<int> refined = seamColumns(4);
+    std::vector<int> upscaled = seamColumns(0);
+    ASSERT_EQ(refined.size(), upscaled.size());
+    for (size_t row = 0; row < refined.size(); ++row) {
+        EXPECT_LE(std::abs(refined[row] - 202), 1) << row;
+        EXPECT_GE(std::abs(upscaled[row] - 202), 2) << row;
+    }
+}
+
+TEST(monitoredGraphCutSeamFinder, keepsPixelsInOneMask)
+{
+    // Image 2 covers the bottom of the overlap of images 0 and 1.  Image 0
+    // is noisy there, so it loses that region to image 2, next to its seam
+    // with image 1.
+    cv::Mat scene(160, 400, CV_8UC3);
+    cv::randu(scene, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::GaussianBlur(scene, scene, cv::Size(15, 15), 5.);
+    std::vector<cv::Point> corners { cv::Point(0, 0), cv::Point(150, 0),
+                                     cv::Point(100, 80) };
+    std::vector<cv::Size> sizes { cv::Size(250, 160), cv::Size(250, 160),
+                                  cv::Size(200, 80) };
+    std::vector<cv::UMat> images, masks;
+    for (size_t i = 0; i < corners.size(); ++i) {
+        cv::Mat image = scene(cv::Rect(corners[i], sizes[i])).clone();
+        if (i == 0) {
+            cv::Mat noise(80, 150, CV_8UC3);
+            cv::randu(noise, cv::Scalar::all(0), cv::Scalar::all(120));
+            cv::Mat region = image(cv::Rect(100, 80, 150, 80));
+            cv::add(region, noise, region);
+        }
+        images.push_back(image.getUMat(cv::ACCESS_READ).clone());
+        masks.emplace_back(image.size(), CV_8U, cv::Scalar::all(255));
+    }
+
+    auto logger = std::make_shared<stdoe_logger>();
+    auto monitor = airmap::stitcher::monitor::Monitor::create(
+            OperationsEstimator::create(
+                    std::make_shared<Camera>(CameraModels::ParrotAnafiThermal()), logger),
+            logger);
+    MonitoredGraphCutSeamFinder finder(monitor);
+    finder.setLevels(2);
+    finder.find(images, corners, masks);
+
+    // Every pixel of the panorama is kept by exactly one image.
+    cv::Mat kept(scene.size(), CV_8U, cv::Scalar::all(0));
+    for (size_t i = 0; i < masks.size(); ++i) {
+        cv::Mat mask = masks[i].getMat(cv::ACCESS_READ) != 0;
+        cv::Mat region = kept(cv::Rect(corners[i], sizes[i]));
+        cv::add(region, mask / 255, region);
+    }
+    EXPECT_EQ(cv::countNonZero(kept > 1), 0);
+    EXPECT_EQ(cv::countNonZero(kept == 0), 0);
+}
+
+TEST(monitoredGraphCutSeamFinder, splitsSmallOverlapsAsVoronoi)
+{
+    // Images whose masks only overlap over about 70 pixels of the
+    // intersection of the images.
+    std::vector<cv::Point> corners { cv::Point(0, 0), cv::Point(60, 40) };
+    std::vector<cv::UMat> images;
+    std::vector<cv::UMat> expected_masks, masks;
+    for (size_t i = 0; i < corners.size(); ++i) {
+        cv::Mat image(100, 100, CV_8UC3);
+        cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(255));
+        images.push_back(image.getUMat(cv::ACCESS_READ).clone());
+        cv::Mat mask(image.size(), CV_8U, cv::Scalar::all(0));
+        cv::circle(mask, i == 0 ? cv::Point(40, 40) : cv::Point(50, 50), 45,
+                   cv::Scalar::all(255), cv::FILLED);
+        expected_masks.push_back(mask.getUMat(cv::ACCESS_READ).clone());
+        masks.push_back(mask.getUMat(cv::ACCESS_READ).clone());
+    }
+
+    cv::detail::VoronoiSeamFinder expected_finder;
+    expected_finder.find(images, corners, expected_masks);
+
+    auto logger = std::make_shared<stdoe_logger>();
+    auto monitor = airmap::stitcher::monitor::Monitor::create(
+            OperationsEstimator::create(
+                    std::make_shared<Camera>(CameraModels::ParrotAnafiThermal()), logger),
+            logger);
+    MonitoredGraphCutSeamFinder finder(monitor);
+    finder.setMinOverlapPixels(1000);
+    finder.find(images, corners, masks);
+
+    for (size_t i = 0; i < masks.size(); ++i) {
+        EXPECT_EQ(cv::norm(masks[i], expected_masks[i], cv::NORM_INF), 0.);
+    }
+}
@@ -6,6 +6,10 @@
 #include "airmap/stitcher_configuration.h"
 #include "util/images.h"
 
+#include <cmath>
+
+#include <opencv2/calib3d.hpp>
+
 using airmap::logging::stdoe_logger;
 using util::images::Images;
 
@@ -37,6 +41,8 @@ public:
         return LowLevelOpenCVStitcher::shouldRotateThreeSixty(
             source_images.images_scaled, warped_images);
     }
+
+    using LowLevelOpenCVStitcher::rotateCameras;
 };
 
 TEST(shouldRotate, shouldRotate)
@@ -66,5 +72,47 @@ TEST(shouldRotate, shouldNotRotate)
     EXPECT_EQ(stitcher.shouldRotateThreeSixty(warped_rotated_images), false);
 }
 
+TEST(rotateCameras, rotatesAboutZAndBack)
+{
+    TestLowLevelOpenCVStitcher stitcher;
+
+    std::vector<cv::detail::CameraParams> cameras(3);
+    std::vector<cv::detail::CameraParams> expected_cameras(3);
+    for (size_t i = 0; i < cameras.size(); ++i) {
+        cv::Mat rvec = (cv::Mat_<float>(3, 1) << 0.1f * i, 0.3f - 0.2f * i, 0.5f * i);
+        cv::Rodrigues(rvec, cameras[i].R);
+        cameras[i].focal = 1000. + i;
+        cameras[i].aspect = 1.01;
+        cameras[i].ppx = 320. + i;
+        cameras[i].ppy = 240. - i;
+        cameras[i].t = (cv::Mat_<double>(3, 1) << 1., 2., 3.);
+        expected_cameras[i] = cameras[i];
+        expected_cameras[i].R = cameras[i].R.clone();
+    }
+
+    // Rotating by a known angle applies a rotation about z in front of R.
+    const double angle = 37.;
+    double radians = angle * M_PI / 180.;
+    cv::Mat_<float> rotation = (cv::Mat_<float>(3, 3) << std::cos(radians),
+                                -std::sin(radians), 0, std::sin(radians),
+                                std::cos(radians), 0, 0, 0, 1);
+    stitcher.rotateCameras(cameras, angle);
+    for (size_t i = 0; i < cameras.size(); ++i) {
+        cv::Mat expected_R = rotation * expected_cameras[i].R;
+        EXPECT_LE(cv::norm(cameras[i].R, expected_R, cv::NORM_INF), 1e-5);
+    }
+
+    // Rotating back restores R, and intrinsics are left alone throughout.
+    stitcher.rotateCameras(cameras, -angle);
+    for (size_t i = 0; i < cameras.size(); ++i) {
+        EXPECT_LE(cv::norm(cameras[i].R, expected_cameras[i].R, cv::NORM_INF), 1e-5);
+        EXPECT_EQ(cameras[i].focal, expected_cameras[i].focal);
+        EXPECT_EQ(cameras[i].aspect, expected_cameras[i].aspect);
+        EXPECT_EQ(cameras[i].ppx, expected_cameras[i].ppx);
+        EXPECT_EQ(cameras[i].ppy, expected_cameras[i].ppy);
+        EXPECT_EQ(cv::norm(cameras[i].t, expected_cameras[i].t, cv::NORM_INF), 0.);
+    }
+}
+
 } // namespace stitcher
 } // namespace airmap
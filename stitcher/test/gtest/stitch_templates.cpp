@@ -0,0 +1,234 @@
+#include "gtest/gtest.h"
+#include "airmap/logging.h"
+#include "airmap/opencv_stitcher.h"
+#include "airmap/stitch_templates.h"
+#include "util/images.h"
+
+#include <algorithm>
+#include <iterator>
+#include <mutex>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+using airmap::logging::Logger;
+using airmap::logging::stdoe_logger;
+using airmap::stitcher::Configuration;
+using airmap::stitcher::ExposureCompensatorType;
+using airmap::stitcher::geocoordinate_t;
+using airmap::stitcher::GeoImage;
+using airmap::stitcher::LowLevelOpenCVStitcher;
+using airmap::stitcher::Panorama;
+using airmap::stitcher::StitchTemplate;
+using airmap::stitcher::StitchTemplates;
+using airmap::stitcher::StitchType;
+using util::images::Images;
+
+namespace {
+
+Panorama capture(double lng, double lat, double yaw_offset,
+                 const std::string &camera_model = "ANAFI")
+{
+    std::list<GeoImage> images;
+    for (int i = 0; i < 8; ++i) {
+        images.push_back(GeoImage { "/capture/image" + std::to_string(i) + ".jpg",
+                                    geocoordinate_t { lng, lat },
+                                    "Parrot",
+                                    camera_model,
+                                    i < 4 ? 0. : -45.,
+                                    0.,
+                                    yaw_offset + (i % 4) * 90.,
+                                    i,
+                                    i });
+    }
+    return Panorama { images };
+}
+
+StitchTemplate stitchTemplate(const Panorama &panorama)
+{
+    StitchTemplate stitch_template = StitchTemplate::fromPanorama(panorama);
+    stitch_template.work_width = 800;
+    for (size_t i = 0; i < panorama.size(); ++i) {
+        cv::detail::CameraParams camera;
+        camera.focal = 600. + i;
+        camera.ppx = 400.;
+        camera.ppy = 300.;
+        camera.R = cv::Mat::eye(3, 3, CV_32F) * (1.f + i);
+        stitch_template.cameras.push_back(camera);
+        stitch_template.corners.push_back(cv::Point(static_cast<int>(i) * 10, -5));
+        stitch_template.seam_masks.push_back(
+                cv::Mat(20, 30, CV_8U, cv::Scalar::all(i % 2 ? 255 : 0)));
+        stitch_template.gains.push_back(cv::Mat(1, 1, CV_64F, cv::Scalar(0.5 + i)));
+    }
+    stitch_template.exposure_compensator_type = ExposureCompensatorType::GainBlocks;
+    stitch_template.exposure_compensation_block_size = 32;
+    return stitch_template;
+}
+
+size_t templateCount(const boost::filesystem::path &directory)
+{
+    return static_cast<size_t>(
+            std::distance(boost::filesystem::directory_iterator(directory),
+                          boost::filesystem::directory_iterator()));
+}
+
+/**
+ * @brief The RecordingLogger class
+ * Keeps the messages logged, to check which steps a stitch took.
+ */
+class RecordingLogger : public Logger
+{
+public:
+    void log(Severity, const char *message, const char *) override
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _messages.push_back(message);
+    }
+
+    bool should_log(Severity, const char *, const char *) override { return true; }
+
+    bool logged(const std::string &message)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return std::find(_messages.begin(), _messages.end(), message) != _messages.end();
+    }
+
+private:
+    std::mutex _mutex;
+    std::vector<std::string> _messages;
+};
+
+/**
+ * @brief stitch
+ * Stitch the fixture images with the given configuration, keeping stitch
+ * templates in the given directory.
+ */
+std::shared_ptr<RecordingLogger> stitch(const Configuration &config,
+                                        const boost::filesystem::path &directory)
+{
+    Panorama::Parameters parameters { Panorama::Parameters::defaultMemoryBudgetMB() };
+    parameters.stitchTemplatesPath = (directory / "templates").string();
+    auto logger = std::make_shared<RecordingLogger>();
+    LowLevelOpenCVStitcher stitcher(config, Panorama { Images::original() }, parameters,
+                                    (directory / "panorama.jpg").string(), logger);
+    stitcher.stitch();
+    return logger;
+}
+
+} // namespace
+
+TEST(stitchTemplates, matches)
+{
+    StitchTemplate stitch_template =
+            StitchTemplate::fromPanorama(capture(8.5417, 47.3769, 0.));
+
+    // Same site, same pattern with a different heading.
+    EXPECT_TRUE(stitch_template.matches(capture(8.5417, 47.3769, 170.)));
+    // A couple of metres away.
+    EXPECT_TRUE(stitch_template.matches(capture(8.54172, 47.37691, 0.)));
+    // Another site.
+    EXPECT_FALSE(stitch_template.matches(capture(8.5427, 47.3769, 0.)));
+    // Another camera.
+    EXPECT_FALSE(stitch_template.matches(capture(8.5417, 47.3769, 0., "BEBOP")));
+}
+
+TEST(stitchTemplates, saveAndFind)
+{
+    boost::filesystem::path directory =
+            boost::filesystem::temp_directory_path()
+            / boost::filesystem::unique_path("stitch-templates-%%%%%%%%");
+    auto logger = std::make_shared<stdoe_logger>();
+    StitchTemplates templates(directory.string(), logger);
+
+    Panorama panorama = capture(8.5417, 47.3769, 0.);
+    StitchTemplate found;
+    EXPECT_FALSE(templates.find(panorama, found));
+
+    StitchTemplate stitch_template = stitchTemplate(panorama);
+    templates.save(stitch_template);
+
+    ASSERT_TRUE(templates.find(capture(8.5417, 47.3769, 90.), found));
+    ASSERT_EQ(found.cameras.size(), panorama.size());
+    EXPECT_EQ(found.work_width, 800);
+    EXPECT_EQ(found.corners, stitch_template.corners);
+    for (size_t i = 0; i < panorama.size(); ++i) {
+        EXPECT_DOUBLE_EQ(found.cameras[i].focal, stitch_template.cameras[i].focal);
+        EXPECT_EQ(cv::norm(found.cameras[i].R, stitch_template.cameras[i].R), 0.);
+        EXPECT_EQ(cv::norm(found.seam_masks[i], stitch_template.seam_masks[i]), 0.);
+        EXPECT_EQ(cv::norm(found.gains[i], stitch_template.gains[i]), 0.);
+    }
+    EXPECT_EQ(found.exposure_compensator_type, ExposureCompensatorType::GainBlocks);
+    EXPECT_EQ(found.exposure_compensation_block_size, 32);
+
+    // Intrinsics follow the work scale.
+    auto scaled_cameras = found.scaleCameras(400);
+    EXPECT_DOUBLE_EQ(scaled_cameras[0].focal, 300.);
+    EXPECT_DOUBLE_EQ(scaled_cameras[0].ppx, 200.);
+
+    boost::filesystem::remove_all(directory);
+}
+
+TEST(stitchTemplates, savesOneTemplatePerSite)
+{
+    boost::filesystem::path directory =
+            boost::filesystem::temp_directory_path()
+            / boost::filesystem::unique_path("stitch-templates-%%%%%%%%");
+    auto logger = std::make_shared<stdoe_logger>();
+    StitchTemplates templates(directory.string(), logger);
+
+    templates.save(stitchTemplate(capture(8.5417, 47.3769, 0.)));
+    EXPECT_EQ(templateCount(directory), 1u);
+
+    // A later capture a couple of metres away replaces it.
+    templates.save(stitchTemplate(capture(8.54172, 47.37691, 0.)));
+    EXPECT_EQ(templateCount(directory), 1u);
+
+    // So does a warm start, whichever centre it has.
+    StitchTemplate found;
+    ASSERT_TRUE(templates.find(capture(8.54172, 47.37691, 0.), found));
+    StitchTemplate warm_start = stitchTemplate(capture(8.54175, 47.37692, 0.));
+    warm_start.directory = found.directory;
+    templates.save(warm_start);
+    EXPECT_EQ(templateCount(directory), 1u);
+
+    // Another site, or another camera, has its own template.
+    templates.save(stitchTemplate(capture(8.5427, 47.3769, 0.)));
+    templates.save(stitchTemplate(capture(8.5417, 47.3769, 0., "BEBOP")));
+    EXPECT_EQ(templateCount(directory), 3u);
+
+    boost::filesystem::remove_all(directory);
+}
+
+TEST(stitchTemplates, warmStartReusesSeamsAndGains)
+{
+    boost::filesystem::path directory =
+            boost::filesystem::temp_directory_path()
+            / boost::filesystem::unique_path("stitch-templates-%%%%%%%%");
+    Configuration config(StitchType::ThreeSixty);
+
+    auto first = stitch(config, directory);
+    EXPECT_FALSE(first->logged("Reusing seams from stitch template."));
+    EXPECT_EQ(templateCount(directory / "templates"), 1u);
+
+    // A second capture of the site starts from the cameras, seams and gains
+    // of the first, and saves over its template.
+    auto second = stitch(config, directory);
+    EXPECT_TRUE(second->logged("Reusing seams from stitch template."));
+    EXPECT_TRUE(second->logged("Reusing exposure compensation from stitch template."));
+    EXPECT_EQ(templateCount(directory / "templates"), 1u);
+
+    // Gains of another compensator block size are compensated again.
+    config.exposure_compensation_block_size *= 2;
+    auto third = stitch(config, directory);
+    EXPECT_TRUE(third->logged("Reusing seams from stitch template."));
+    EXPECT_FALSE(third->logged("Reusing exposure compensation from stitch template."));
+
+    // As are gains of another compensator type.
+    config.exposure_compensator_type = ExposureCompensatorType::Gain;
+    auto fourth = stitch(config, directory);
+    EXPECT_TRUE(fourth->logged("Reusing seams from stitch template."));
+    EXPECT_FALSE(fourth->logged("Reusing exposure compensation from stitch template."));
+    EXPECT_TRUE(boost::filesystem::exists(directory / "panorama.jpg"));
+
+    boost::filesystem::remove_all(directory);
+}
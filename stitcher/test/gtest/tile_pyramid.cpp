@@ -0,0 +1,82 @@
+#include "gtest/gtest.h"
+#include "tile_pyramid.h"
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+namespace {
+
+const char faceNames[] = { 'f', 'r', 'b', 'l', 'u', 'd' };
+
+} // namespace
+
+TEST(tilePyramid, levels)
+{
+    EXPECT_EQ(TilePyramid::levels(512, 512), 1);
+    EXPECT_EQ(TilePyramid::levels(513, 512), 2);
+    EXPECT_EQ(TilePyramid::levels(1024, 512), 2);
+    // 75, 38, 19, 10.
+    EXPECT_EQ(TilePyramid::levels(75, 10), 4);
+}
+
+TEST(tilePyramid, writesLevelsOfTiles)
+{
+    boost::filesystem::path directory =
+            boost::filesystem::temp_directory_path()
+            / boost::filesystem::unique_path("tile-pyramid-%%%%%%%%");
+
+    // Faces of an odd size, halved to 38, 19 and 10 pixels.
+    const int faceSize = 75;
+    const int tileSize = 10;
+    cv::Mat in(faceSize * 2, faceSize * 4, CV_8UC3);
+    cv::randu(in, cv::Scalar::all(0), cv::Scalar::all(255));
+    TilePyramid::write(in, directory.string(), tileSize);
+
+    const int levels = 4;
+    const int levelSizes[levels] = { 10, 19, 38, 75 };
+    for (int level = 1; level <= levels; ++level) {
+        int size = levelSizes[level - 1];
+        int tiles = (size + tileSize - 1) / tileSize;
+        boost::filesystem::path levelPath = directory / std::to_string(level);
+
+        int files = static_cast<int>(
+                std::distance(boost::filesystem::directory_iterator(levelPath),
+                              boost::filesystem::directory_iterator()));
+        EXPECT_EQ(files, 6 * tiles * tiles) << level;
+
+        for (char face : faceNames) {
+            for (int y = 0; y < tiles; ++y) {
+                for (int x = 0; x < tiles; ++x) {
+                    std::string name = face + std::to_string(y) + "_" + std::to_string(x)
+                            + ".jpg";
+                    cv::Mat tile = cv::imread((levelPath / name).string());
+                    ASSERT_FALSE(tile.empty()) << (levelPath / name).string();
+
+                    // Tiles on the right and bottom edges hold what is left.
+                    int width = std::min(tileSize, size - x * tileSize);
+                    int height = std::min(tileSize, size - y * tileSize);
+                    EXPECT_EQ(tile.size(), cv::Size(width, height))
+                            << (levelPath / name).string();
+                }
+            }
+        }
+    }
+    EXPECT_FALSE(boost::filesystem::exists(directory / std::to_string(levels + 1)));
+
+    cv::FileStorage fs((directory / "config.json").string(), cv::FileStorage::READ);
+    ASSERT_TRUE(fs.isOpened());
+    EXPECT_EQ(static_cast<std::string>(fs["type"]), "multires");
+    cv::FileNode multiRes = fs["multiRes"];
+    EXPECT_EQ(static_cast<std::string>(multiRes["path"]), "/%l/%s%y_%x");
+    EXPECT_EQ(static_cast<std::string>(multiRes["extension"]), "jpg");
+    EXPECT_EQ(static_cast<int>(multiRes["maxLevel"]), levels);
+    EXPECT_EQ(static_cast<int>(multiRes["cubeResolution"]), faceSize);
+    EXPECT_EQ(static_cast<int>(multiRes["tileResolution"]), tileSize);
+
+    boost::filesystem::remove_all(directory);
+}
@@ -0,0 +1,146 @@
+#include "gtest/gtest.h"
+#include "airmap/opencv/warpers.h"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#include <opencv2/calib3d.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/stitching/warpers.hpp>
+
+using airmap::stitcher::opencv::detail::warpImageAndMask;
+
+namespace {
+
+void expectSameAsWarper(const cv::Ptr<cv::WarperCreator> &warper_creator)
+{
+    cv::Mat image(300, 400, CV_8UC3);
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(255));
+
+    cv::Mat_<float> K = cv::Mat::eye(3, 3, CV_32F);
+    K(0, 0) = K(1, 1) = 350.f;
+    K(0, 2) = 200.f;
+    K(1, 2) = 150.f;
+    cv::Mat R;
+    cv::Rodrigues(cv::Vec3d(0.2, 0.7, -0.1), R);
+    R.convertTo(R, CV_32F);
+
+    auto warper = warper_creator->create(350.f);
+
+    cv::Mat expected_image, expected_mask;
+    cv::Mat mask(image.size(), CV_8U, cv::Scalar::all(255));
+    cv::Point expected_corner = warper->warp(image, K, R, cv::INTER_LINEAR,
+                                             cv::BORDER_REFLECT, expected_image);
+    warper->warp(mask, K, R, cv::INTER_NEAREST, cv::BORDER_CONSTANT, expected_mask);
+
+    cv::Mat warped_image, warped_mask;
+    cv::Point corner = warpImageAndMask(*warper, image, K, R, cv::INTER_LINEAR,
+                                        cv::BORDER_REFLECT, warped_image, warped_mask);
+
+    EXPECT_EQ(corner, expected_corner);
+    ASSERT_EQ(warped_image.size(), expected_image.size());
+    ASSERT_EQ(warped_mask.size(), expected_mask.size());
+    // Maps may differ in the last bit where the compiler fuses multiply-adds.
+    EXPECT_LE(cv::norm(warped_image, expected_image, cv::NORM_INF), 1.);
+
+    // Only pixels whose map is exactly half way between two source pixels
+    // may round differently.
+    EXPECT_LE(cv::countNonZero(warped_mask != expected_mask),
+              static_cast<int>(expected_mask.total() / 1000));
+}
+
+} // namespace
+
+TEST(warpers, warpImageAndMaskSpherical)
+{
+    expectSameAsWarper(cv::makePtr<cv::SphericalWarper>());
+}
+
+TEST(warpers, warpImageAndMaskCylindrical)
+{
+    expectSameAsWarper(cv::makePtr<cv::CylindricalWarper>());
+}
+
+TEST(warpers, warpImageAndMaskRows)
+{
+    cv::Mat image(300, 400, CV_8UC3);
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(255));
+
+    cv::Mat_<float> K = cv::Mat::eye(3, 3, CV_32F);
+    K(0, 0) = K(1, 1) = 350.f;
+    K(0, 2) = 200.f;
+    K(1, 2) = 150.f;
+    cv::Mat R;
+    cv::Rodrigues(cv::Vec3d(0.2, 0.7, -0.1), R);
+    R.convertTo(R, CV_32F);
+
+    for (const cv::Ptr<cv::WarperCreator> &warper_creator :
+         { cv::Ptr<cv::WarperCreator>(cv::makePtr<cv::SphericalWarper>()),
+           cv::Ptr<cv::WarperCreator>(cv::makePtr<cv::PlaneWarper>()) }) {
+        auto warper = warper_creator->create(350.f);
+
+        cv::Mat full_image, full_mask;
+        cv::Point full_corner =
+                warpImageAndMask(*warper, image, K, R, cv::INTER_LINEAR,
+                                 cv::BORDER_REFLECT, full_image, full_mask);
+
+        // A range of rows starting above the warped image, and one inside it.
+        for (const cv::Range &rows :
+             { cv::Range(full_corner.y - 10, full_corner.y + 57),
+               cv::Range(full_corner.y + 33, full_corner.y + 150) }) {
+            // Tiles may be called back concurrently.
+            std::mutex mutex;
+            std::vector<int> callback_rows;
+            cv::Mat image_rows, mask_rows;
+            cv::Point corner = warpImageAndMask(
+                    *warper, image, K, R, cv::INTER_LINEAR, cv::BORDER_REFLECT,
+                    image_rows, mask_rows,
+                    [&mutex, &callback_rows](cv::Mat &, int first_row) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        callback_rows.push_back(first_row);
+                    },
+                    rows);
+
+            int first_row = std::max(rows.start - full_corner.y, 0);
+            cv::Rect expected(0, first_row, full_image.cols,
+                              rows.end - full_corner.y - first_row);
+            EXPECT_EQ(corner, full_corner + expected.tl());
+            ASSERT_EQ(image_rows.size(), expected.size());
+            EXPECT_EQ(cv::norm(image_rows, full_image(expected), cv::NORM_INF), 0.);
+            EXPECT_EQ(cv::norm(mask_rows, full_mask(expected), cv::NORM_INF), 0.);
+            ASSERT_FALSE(callback_rows.empty());
+            EXPECT_EQ(*std::min_element(callback_rows.begin(), callback_rows.end()),
+                      first_row);
+        }
+    }
+}
+
+TEST(warpers, warpImageAndMaskSphericalUMat)
+{
+    cv::Mat image(240, 320, CV_8UC1);
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(255));
+
+    cv::Mat_<float> K = cv::Mat::eye(3, 3, CV_32F);
+    K(0, 0) = K(1, 1) = 280.f;
+    K(0, 2) = 160.f;
+    K(1, 2) = 120.f;
+    cv::Mat R;
+    cv::Rodrigues(cv::Vec3d(-0.6, 2.5, 0.3), R);
+    R.convertTo(R, CV_32F);
+
+    auto warper = cv::SphericalWarper().create(280.f);
+    cv::Mat expected_image;
+    cv::Point expected_corner = warper->warp(image, K, R, cv::INTER_LINEAR,
+                                             cv::BORDER_REFLECT, expected_image);
+
+    cv::UMat warped_image, warped_mask;
+    cv::Point corner = warpImageAndMask(*warper, image, K, R, cv::INTER_LINEAR,
+                                        cv::BORDER_REFLECT, warped_image, warped_mask);
+
+    EXPECT_EQ(corner, expected_corner);
+    ASSERT_EQ(warped_image.size(), expected_image.size());
+    EXPECT_LE(cv::norm(warped_image.getMat(cv::ACCESS_READ), expected_image,
+                       cv::NORM_INF),
+              1.);
+}